@@ -30,10 +30,19 @@
 #define USER_END_VMA    0xD0000000UL // End of user program space
 #define USER_STACK_VMA  USER_END_VMA // starting user stack pointer
 
+// Each thread of a process runs on a user stack of its own, in one of
+// USER_NSTACK slots below USER_STACK_VMA (see process_thread_stack). A slot
+// holds USER_THREAD_STACK_SIZE bytes of stack above an unmapped guard page.
+
+#define USER_THREAD_STACK_SIZE (64*1024UL)
+#define USER_NSTACK 16
+
 #define UART0_IOBASE 0x10000000 // PMA
 #define UART1_IOBASE 0x10000100 // PMA
 #define UART0_IRQNO 10
 
+#define RTC_IOBASE 0x101000 // PMA, Goldfish RTC
+
 #define VIRT0_IOBASE 0x10001000 // PMA
 #define VIRT1_IOBASE 0x10002000 // PMA
 #define VIRT0_IRQNO 1
@@ -248,6 +248,12 @@ static inline void csrc_mstatus(intptr_t mask) {
 #define RISCV_SSTATUS_SPP (1UL << 8)
 #define RISCV_SSTATUS_SUM (1UL << 18)
 
+#define RISCV_SSTATUS_FS (3UL << 13)
+#define RISCV_SSTATUS_FS_OFF (0UL << 13)
+#define RISCV_SSTATUS_FS_INITIAL (1UL << 13)
+#define RISCV_SSTATUS_FS_CLEAN (2UL << 13)
+#define RISCV_SSTATUS_FS_DIRTY (3UL << 13)
+
 static inline intptr_t csrr_sstatus(void) {
     intptr_t val;
 
@@ -298,4 +304,20 @@ static inline uintptr_t csrrw_satp(uintptr_t satp_new) {
     return satp_old;
 }
 
+// time counter
+
+static inline uint64_t csrr_time(void) {
+    uint64_t val;
+
+    asm inline volatile ("rdtime %0" : "=r" (val));
+    return val;
+}
+
+// stimecmp (Sstc extension). Referred to by number (0x14d) since older
+// assemblers do not know the name.
+
+static inline void csrw_stimecmp(uint64_t val) {
+    asm inline volatile ("csrw 0x14d, %0" :: "r" (val));
+}
+
 #endif // _CSR_H_
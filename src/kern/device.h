@@ -21,7 +21,9 @@ extern char devmgr_initialized;
 //           /aux/ argument to device_register is passed as the second argument to
 //           /openfn/ when it is called.
 //           The device_register should be called by a device driver's attach function to
-//           register the device with the system.
+//           register the device with the system. Drivers attach during boot, before
+//           any other thread runs, and devtab is not written afterwards, so device_open
+//           scans it without a lock.
 //           The device_register function returns a non-negative instance number on
 //           success and a negative error number if an error occurs.
 
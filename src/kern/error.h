@@ -15,5 +15,11 @@
 #define EACCESS     8
 #define EBADFD      9
 #define EMFILE     10
+#define ENOMEM     11
+#define EAGAIN     12
+#define ETIMEDOUT  13
+#define EPIPE      14
+#define EINTR      15
+#define ECHILD     16
 
 #endif // _ERROR_H_
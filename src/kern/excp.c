@@ -4,7 +4,10 @@
 #include "trap.h"
 #include "csr.h"
 #include "halt.h"
+#include "intr.h"
 #include "memory.h"
+#include "process.h"
+#include "thread.h"
 
 #include <stddef.h>
 
@@ -54,24 +57,37 @@ void smode_excp_handler(unsigned int code, struct trap_frame * tfr) {
 }
 
 void umode_excp_handler(unsigned int code, struct trap_frame * tfr) {
+    void * fault_addr;
+
     switch (code) {
     // TODO: FIXME dispatch to various U mode exception handlers
     case RISCV_SCAUSE_ECALL_FROM_UMODE:
+        // System calls that miss the fast path in trapasm.S, including fork,
+        // run with interrupts disabled: fork copies the kernel stack
         syscall_handler(tfr);
         break;
     case RISCV_SCAUSE_STORE_PAGE_FAULT:
-        memory_handle_page_fault((void*)csrr_stval());
-        break;
     case RISCV_SCAUSE_LOAD_PAGE_FAULT:
-        memory_handle_page_fault((void*)csrr_stval());
-        break;
     case RISCV_SCAUSE_INSTR_PAGE_FAULT:
-        memory_handle_page_fault((void*)csrr_stval());
+        // Read stval before an interrupt can overwrite it
+        fault_addr = (void*)csrr_stval();
+        intr_enable();
+        memory_handle_page_fault(fault_addr);
+        intr_disable();
+        break;
+    case RISCV_SCAUSE_ILLEGAL_INSTR:
+        // First FP instruction since the thread was switched in
+        if (thread_fp_trap())
+            break;
+        default_excp_handler(code, tfr);
         break;
     default:
         default_excp_handler(code, tfr);
         break;
     }
+
+    // About to return to U mode; leave if the process is exiting
+    process_check_exit();
 }
 
 void default_excp_handler (
@@ -1,4 +1,13 @@
-// ezheap.c - Leaking memory manager for small allocations
+// ezheap.c - Memory manager for small allocations
+//
+// Blocks are carved from the current heap block, and from new pages when it
+// runs out. Each block is preceded by a 16-byte header recording its size,
+// rounded up to a multiple of 16. Freed blocks go on a free list for their
+// size and are reused by later requests of the same size, so that the memory
+// of objects allocated and freed over and over (processes, threads, pipes)
+// stays flat. Requests too big for a header and the data to share a page get
+// a page of their own, which is page-aligned; kfree tells these apart from
+// small blocks, whose data is never page-aligned.
 //
 
 #ifndef TRACE
@@ -18,6 +27,7 @@
 #include "console.h"
 #include "string.h"
 #include "halt.h"
+#include "intr.h"
 #include "memory.h"
 
 #include <stdint.h>
@@ -27,12 +37,31 @@
 
 char heap_initialized = 0;
 
+// INTERNAL TYPE DEFINITIONS
+//
+
+struct block_header {
+    size_t size; // size of the data following the header
+    struct block_header * next; // next free block of the same size
+};
+
+#define HDRSZ sizeof(struct block_header)
+
 // INTERNAL GLOBAL VARIABLES
 //
 
 static void * heap_start;
 static void * heap_end;
 
+// free_lists[n] holds the free blocks of 16*n bytes
+
+static struct block_header * free_lists[PAGE_SIZE / 16];
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static void * carve(size_t blksz);
+
 // EXPORTED FUNCTION DEFINITIONS
 //
 
@@ -45,7 +74,8 @@ void heap_init(void * start, void * end) {
 }
 
 void * kmalloc(size_t size) {
-    void * new_block;
+    struct block_header * hdr;
+    int saved_intr_state;
 
     trace("%s(%zu)", __func__, size);
 
@@ -55,30 +85,33 @@ void * kmalloc(size_t size) {
     if (PAGE_SIZE < size)
         panic("heap alloc request too large");
     
-    // If the request fits in the current heap block, allocate from it.
+    // Big requests get a page of their own, without a header
 
-    if (size <= heap_end - heap_start) {
-        heap_end -= size;
-        return heap_end;
-    }
+    if (PAGE_SIZE - HDRSZ < size)
+        return memory_alloc_page();
 
-    // The request is no more than a page, but we don't have room for it in the
-    // current block of heap memory. Get a direct-mapped page of physical memory
-    // from the memory manager.
+    // The heap is shared by all threads, and the kernel is preemptible.
 
-    new_block = memory_alloc_page();
+    saved_intr_state = intr_disable();
 
-    // Do we have more free space left if we abandon the current block and
-    // switch to the new one, or just use the new block for this request and
-    // stay with the current block?
+    hdr = free_lists[size / 16];
 
-    if (heap_end - heap_start < PAGE_SIZE - size) {
-        // switch to new block
-        heap_start = new_block;
-        heap_end = new_block + PAGE_SIZE - size;
-        return heap_end;
-    } else
-        return new_block;
+    if (hdr != NULL)
+        free_lists[size / 16] = hdr->next;
+    else {
+        hdr = carve(HDRSZ + size);
+
+        // The data of a small block must not be page-aligned (see kfree).
+        // That can only happen where the initial heap block crosses a page
+        // boundary; the block carved next is not aligned, so give up this one.
+
+        if ((uintptr_t)(hdr + 1) % PAGE_SIZE == 0)
+            hdr = carve(HDRSZ + size);
+    }
+
+    hdr->size = size;
+    intr_restore(saved_intr_state);
+    return hdr + 1;
 }
 
 void * kcalloc(size_t n, size_t size) {
@@ -99,6 +132,52 @@ void * krealloc(void * ptr, size_t size) {
 }
 
 void kfree(void * ptr) {
+    struct block_header * hdr;
+    int saved_intr_state;
+
     trace("%s(%p)", __func__, ptr);
-    // do nothing
+
+    if (ptr == NULL)
+        return;
+    
+    if ((uintptr_t)ptr % PAGE_SIZE == 0) {
+        memory_free_page(ptr);
+        return;
+    }
+
+    hdr = (struct block_header *)ptr - 1;
+    assert (0 < hdr->size && hdr->size <= PAGE_SIZE - HDRSZ);
+
+    saved_intr_state = intr_disable();
+    hdr->next = free_lists[hdr->size / 16];
+    free_lists[hdr->size / 16] = hdr;
+    intr_restore(saved_intr_state);
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Carves /blksz/ bytes off the top of the current heap block and returns
+// them. If the current heap block is too small, gets a direct-mapped page of
+// physical memory from the memory manager, and either switches to it or uses
+// it just for this request, whichever leaves more free space. Must be called
+// with interrupts disabled.
+
+static void * carve(size_t blksz) {
+    void * new_block;
+
+    if (blksz <= heap_end - heap_start) {
+        heap_end -= blksz;
+        return heap_end;
+    }
+
+    new_block = memory_alloc_page();
+
+    if (heap_end - heap_start < PAGE_SIZE - blksz) {
+        // switch to new block
+        heap_start = new_block;
+        heap_end = new_block + PAGE_SIZE - blksz;
+        return heap_end;
+    } else
+        return new_block;
 }
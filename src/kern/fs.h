@@ -89,6 +89,8 @@ extern int fs_getblksz(file_t* fd, void* arg);
 extern int fs_ioctl(struct io_intf* io, int cmd, void* arg);
 extern long fs_write(struct io_intf* io, const void* buf, unsigned long n);
 extern long fs_read(struct io_intf* io, void* buf, unsigned long n);
+extern long fs_writeat(struct io_intf* io, uint64_t pos, const void* buf, unsigned long n);
+extern long fs_readat(struct io_intf* io, uint64_t pos, void* buf, unsigned long n);
 
 
 //           _FS_H_
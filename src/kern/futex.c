@@ -0,0 +1,156 @@
+// futex.c - Fast user-space mutex support
+//
+
+#ifdef FUTEX_TRACE
+#define TRACE
+#endif
+
+#ifdef FUTEX_DEBUG
+#define DEBUG
+#endif
+
+#include "futex.h"
+
+#include <stdint.h>
+
+#include "console.h"
+#include "error.h"
+#include "intr.h"
+#include "memory.h"
+#include "thread.h"
+
+// COMPILE-TIME PARAMETERS
+//
+
+// NFUTEXBKT is the number of wait queue hash buckets (must be a power of two)
+
+#ifndef NFUTEXBKT
+#define NFUTEXBKT 16
+#endif
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// A waiter lives on the kernel stack of the waiting thread for as long as it
+// is blocked in futex_wait. Waiters with different keys may share a bucket.
+
+struct futex_waiter {
+    struct futex_waiter * next;
+    uintptr_t key; // physical address of the user word
+    struct condition woken;
+    int done;
+};
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static struct futex_waiter * futex_bktab[NFUTEXBKT];
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static uintptr_t futex_key(volatile int * uaddr);
+static struct futex_waiter ** futex_bucket(uintptr_t key);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int futex_wait(volatile int * uaddr, int val) {
+    struct futex_waiter self;
+    struct futex_waiter ** wp;
+    int saved_intr_state;
+
+    trace("%s(uaddr=%p,val=%d)", __func__, uaddr, val);
+
+    self.key = futex_key(uaddr);
+    if (self.key == 0)
+        return -EINVAL;
+    
+    self.next = NULL;
+    self.done = 0;
+    condition_init(&self.woken, "futex");
+
+    // The value check and the enqueue must not be separated by a wake-up, so
+    // both happen with interrupts disabled. The word is read through the user
+    // mapping (SUM is set).
+
+    saved_intr_state = intr_disable();
+
+    if (*uaddr != val) {
+        intr_restore(saved_intr_state);
+        return -EAGAIN;
+    }
+
+    // Append to the tail so that waiters are woken in FIFO order
+
+    for (wp = futex_bucket(self.key); *wp != NULL; wp = &(*wp)->next)
+        continue;
+    *wp = &self;
+
+    while (!self.done) {
+        if (condition_wait_interruptible(&self.woken) != 0 && !self.done) {
+            // Our process is exiting: leave the queue without being woken
+            for (wp = futex_bucket(self.key); *wp != &self; wp = &(*wp)->next)
+                continue;
+            *wp = self.next;
+            intr_restore(saved_intr_state);
+            return -EINTR;
+        }
+    }
+
+    intr_restore(saved_intr_state);
+    return 0;
+}
+
+int futex_wake(volatile int * uaddr, int n) {
+    struct futex_waiter ** wp;
+    struct futex_waiter * w;
+    int saved_intr_state;
+    uintptr_t key;
+    int cnt = 0;
+
+    trace("%s(uaddr=%p,n=%d)", __func__, uaddr, n);
+
+    key = futex_key(uaddr);
+    if (key == 0)
+        return -EINVAL;
+    
+    saved_intr_state = intr_disable();
+
+    wp = futex_bucket(key);
+    while (cnt < n && *wp != NULL) {
+        w = *wp;
+        if (w->key == key) {
+            *wp = w->next; // unlink
+            w->done = 1;
+            condition_broadcast(&w->woken);
+            cnt++;
+        } else
+            wp = &w->next;
+    }
+
+    intr_restore(saved_intr_state);
+
+    debug("futex_wake(%p) woke %d thread(s)", uaddr, cnt);
+    return cnt;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Returns the physical address of a user futex word, or 0 if it is misaligned
+// or not mapped readable by the user.
+
+static uintptr_t futex_key(volatile int * uaddr) {
+    if ((uintptr_t)uaddr % sizeof(int) != 0)
+        return 0;
+    
+    return memory_vptr_to_pma((const void *)uaddr, PTE_R | PTE_U);
+}
+
+static struct futex_waiter ** futex_bucket(uintptr_t key) {
+    // Futex words are int-aligned, and neighboring words on the same page
+    // should spread out, so drop the low two bits and fold in the page number.
+
+    return &futex_bktab[((key >> 2) ^ (key >> 12)) & (NFUTEXBKT-1)];
+}
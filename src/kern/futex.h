@@ -0,0 +1,27 @@
+// futex.h - Fast user-space mutex support
+//
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// int futex_wait(volatile int * uaddr, int val)
+// Suspends the current thread if the user word at /uaddr/ still contains /val/.
+// The check and the enqueue are atomic with respect to futex_wake. Waiters are
+// keyed on the physical address of the word, so processes that map the same
+// page wait on the same futex. Returns 0 after being woken, -EAGAIN if the word
+// did not contain /val/, -EINVAL if /uaddr/ is misaligned or not mapped, or
+// -EINTR if the process of the current thread starts to exit meanwhile.
+
+extern int futex_wait(volatile int * uaddr, int val);
+
+// int futex_wake(volatile int * uaddr, int n)
+// Wakes up to /n/ threads waiting on the futex at /uaddr/, in the order they
+// started waiting. Returns the number of threads woken, or -EINVAL if /uaddr/
+// is misaligned or not mapped.
+
+extern int futex_wake(volatile int * uaddr, int n);
+
+#endif // _FUTEX_H_
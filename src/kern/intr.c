@@ -15,6 +15,7 @@
 #include "csr.h"
 #include "plic.h"
 #include "timer.h"
+#include "process.h"
 
 #include <stddef.h>
 
@@ -39,6 +40,11 @@ static struct {
     int prio;
 } isrtab[NIRQ];
 
+// Priority of the ISR currently running, or 0 if none. The PLIC threshold is
+// kept equal to it, so only higher-priority sources can interrupt an ISR.
+
+static int intr_cur_prio;
+
 // INTERNAL FUNCTION DECLARATIONS
 //
 
@@ -87,7 +93,7 @@ void intr_disable_irq(int irqno) {
 }
 
 // void intr_handler(int code, struct trap_frame * tfr)
-// Called from trapasm.s to handle an interrupt. Dispataches to
+// Called from trapasm.S to handle an interrupt. Dispataches to
 // timer_intr_handler and extern_intr_handler.
 
 void intr_handler(int code, struct trap_frame * tfr) {
@@ -103,9 +109,13 @@ void intr_handler(int code, struct trap_frame * tfr) {
         break;
     }
 
-    // If we were running user mode, yield thread.
+    // If we were running user mode, yield thread. In S mode, only yield if
+    // the interrupted thread is not in a non-preemptible section.
 
-    if ((tfr->sstatus & RISCV_SSTATUS_SPP) == 0)
+    if ((tfr->sstatus & RISCV_SSTATUS_SPP) == 0) {
+        thread_yield();
+        process_check_exit();
+    } else if (thread_preemptible())
         thread_yield();
 }
 
@@ -113,6 +123,7 @@ void intr_handler(int code, struct trap_frame * tfr) {
 //
 
 void extern_intr_handler(void) {
+    int saved_prio;
     int irqno;
 
     irqno = plic_claim_irq();
@@ -126,7 +137,22 @@ void extern_intr_handler(void) {
     if (isrtab[irqno].isr == NULL)
         panic("unhandled irq");
     
+    // Run the ISR with interrupts enabled and the threshold raised to its
+    // priority, so that a higher-priority device (or the timer) can
+    // interrupt it. The ISR must not be preempted by another thread while it
+    // holds the claim, hence preempt_disable.
+
+    saved_prio = intr_cur_prio;
+    intr_cur_prio = isrtab[irqno].prio;
+    plic_set_threshold(intr_cur_prio);
+    preempt_disable();
+    intr_enable();
+
     isrtab[irqno].isr(irqno, isrtab[irqno].isr_aux);
 
+    intr_disable();
+    preempt_enable();
     plic_close_irq(irqno);
+    intr_cur_prio = saved_prio;
+    plic_set_threshold(intr_cur_prio);
 }
@@ -5,6 +5,7 @@
 #include "string.h"
 #include "error.h"
 #include "console.h"
+#include "thread.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -66,6 +67,88 @@ long iowrite(struct io_intf * io, const void * buf, unsigned long n) {
     return acc;
 }
 
+long ioreadv(struct io_intf * io, const struct iovec * iov, int iovcnt) {
+    long cnt, acc = 0;
+    int i;
+
+    if (io->ops->readv != NULL)
+        return io->ops->readv(io, iov, iovcnt);
+    
+    if (io->ops->read == NULL)
+        return -ENOTSUP;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0)
+            continue;
+        cnt = io->ops->read(io, iov[i].iov_base, iov[i].iov_len);
+        if (cnt < 0)
+            return (acc != 0) ? acc : cnt;
+        acc += cnt;
+        if (cnt < iov[i].iov_len)
+            break;
+    }
+
+    return acc;
+}
+
+long iowritev(struct io_intf * io, const struct iovec * iov, int iovcnt) {
+    long cnt, acc = 0;
+    int i;
+
+    if (io->ops->writev != NULL)
+        return io->ops->writev(io, iov, iovcnt);
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0)
+            continue;
+        cnt = iowrite(io, iov[i].iov_base, iov[i].iov_len);
+        if (cnt < 0)
+            return (acc != 0) ? acc : cnt;
+        acc += cnt;
+        if (cnt < iov[i].iov_len)
+            break;
+    }
+
+    return acc;
+}
+
+long iowriteat (
+    struct io_intf * io, uint64_t pos, const void * buf, unsigned long n)
+{
+    long cnt, acc = 0;
+
+    if (io->ops->writeat == NULL)
+        return -ENOTSUP;
+
+    while (acc < n) {
+        cnt = io->ops->writeat(io, pos+acc, buf+acc, n-acc);
+        if (cnt < 0)
+            return cnt;
+        else if (cnt == 0)
+            return acc;
+        acc += cnt;
+    }
+
+    return acc;
+}
+
+// One wait queue is shared by all I/O objects, so a thread polling several
+// objects can wait for all of them at once. A notification wakes every poller,
+// which then checks its own objects again.
+
+static struct condition iopoll_cond = { .name = "iopoll" };
+
+void iopoll_notify(void) {
+    condition_broadcast(&iopoll_cond);
+}
+
+int iopoll_wait(uint64_t tcnt) {
+    if (tcnt == 0)
+        return condition_wait_interruptible(&iopoll_cond);
+    else
+        return condition_wait_timeout_interruptible(&iopoll_cond, tcnt);
+}
+
 //           Initialize an io_lit. This function should be called with an io_lit, a buffer, and the size of the device.
 //           It should set up all fields within the io_lit struct so that I/O operations can be performed on the io_lit
 //           through the io_intf interface. This function should return a pointer to an io_intf object that can be used 
@@ -80,7 +163,9 @@ struct io_intf * iolit_init (
         .close = iolit_close,
         .read = iolit_read,
         .write = iolit_write,
-        .ctl = iolit_ctl
+        .ctl = iolit_ctl,
+        .readat = iolit_readat,
+        .writeat = iolit_writeat
     };
     // set all iolit components
     lit->io_intf.ops = &ct_ops;
@@ -137,6 +222,44 @@ long iolit_read(struct io_intf * io, void * buf, unsigned long bufsz) {
     return bufsz;
 }
 
+/*
+ * @brief performs positional iolit write
+ *
+ * writes at pos using memcpy, up to the end of the literal
+ */
+long iolit_writeat (
+    struct io_intf * io, uint64_t pos, const void * buf, unsigned long n)
+{
+    struct io_lit * lit = (void*)io - offsetof(struct io_lit, io_intf);
+
+    if (pos >= lit->size)
+        return 0;
+    if (lit->size - pos < n)
+        n = lit->size - pos;
+    
+    memcpy(lit->buf + pos, buf, n);
+    return n;
+}
+
+/*
+ * @brief performs positional iolit read
+ *
+ * reads at pos using memcpy, up to the end of the literal
+ */
+long iolit_readat (
+    struct io_intf * io, uint64_t pos, void * buf, unsigned long bufsz)
+{
+    struct io_lit * lit = (void*)io - offsetof(struct io_lit, io_intf);
+
+    if (pos >= lit->size)
+        return 0;
+    if (lit->size - pos < bufsz)
+        bufsz = lit->size - pos;
+    
+    memcpy(buf, lit->buf + pos, bufsz);
+    return bufsz;
+}
+
 /*
  * @brief other cmds
  */
@@ -15,6 +15,15 @@
 
 struct io_intf; // forward decl.
 
+// A segment of a scatter/gather list, for vectored reads and writes.
+
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
+
+#define IOV_MAX 16 // maximum number of segments in one vectored call
+
 // I/O operations provided by the interface. Do not call these directly, use the
 // function below instead (e.g. ioread). The /read/ function is allowed to read
 // fewer than /bufsz/ bytes, but must read at least one. A return value of 0
@@ -22,17 +31,40 @@ struct io_intf; // forward decl.
 // allowed to write fewer than /n/ bytes, but must write at least one. A return
 // value of 0 from /write/ indicates an end-of-file condition (for files that
 // cannot grow).
+//
+// The /readv/ and /writev/ functions are optional. They transfer to or from
+// /iovcnt/ segments in order, as if the segments were one buffer, and have the
+// same short-count rules as /read/ and /write/. Interfaces that do not provide
+// them get a loop over /read/ or /write/ (see ioreadv and iowritev).
+//
+// The /readat/ and /writeat/ functions are optional. They are like /read/ and
+// /write/, but transfer at byte offset /pos/ and neither use nor change the
+// current position, so threads and processes sharing the object do not race
+// on it. Objects without a position (e.g. a UART) do not provide them.
+//
+// The /poll/ function is optional. It returns the subset of POLLIN and POLLOUT
+// for which a read or write would not block right now, without waiting. An
+// object whose readiness changes must call iopoll_notify afterwards, so that
+// threads waiting in poll look again. Objects without it are always ready.
 
 struct io_ops {
 	void (*close)(struct io_intf * io);
 	long (*read)(struct io_intf * io, void * buf, unsigned long bufsz);
 	long (*write)(struct io_intf * io, const void * buf, unsigned long n);
 	int (*ctl)(struct io_intf * io, int cmd, void * arg);
+	long (*readv)(struct io_intf * io, const struct iovec * iov, int iovcnt);
+	long (*writev)(struct io_intf * io, const struct iovec * iov, int iovcnt);
+	long (*readat)(struct io_intf * io, uint64_t pos,
+		void * buf, unsigned long bufsz);
+	long (*writeat)(struct io_intf * io, uint64_t pos,
+		const void * buf, unsigned long n);
+	int (*poll)(struct io_intf * io);
 };
 
 struct io_intf {
 	const struct io_ops * ops;
     uint32_t refcnt;
+    uint32_t flags; // O_* flags, set with IOCTL_SETFL
 };
 
 struct io_lit {
@@ -57,6 +89,52 @@ struct io_term {
 #define IOCTL_SETPOS        4   // arg is pointer to uint64_t
 #define IOCTL_FLUSH         5   // arg is ignored
 #define IOCTL_GETBLKSZ      6   // arg is pointer to uint32_t
+#define IOCTL_SETFL         7   // arg is pointer to int (O_* flags)
+
+// Device-specific IOCTL numbers (block devices)
+
+#define IOCTL_SETPOLL       8   // arg is pointer to int (IOCTL_POLL_*)
+#define IOCTL_GETPOLLSTAT   9   // arg is pointer to struct io_pollstat
+
+#define IOCTL_POLL_OFF      0   // always sleep until the completion interrupt
+#define IOCTL_POLL_HYBRID   1   // spin for a while, then sleep
+
+// Completion counters reported by IOCTL_GETPOLLSTAT
+
+struct io_pollstat {
+    uint64_t npolled;   // requests found complete while spinning
+    uint64_t nintr;     // requests completed by the interrupt
+    uint64_t spin_us;   // current spin budget in microseconds
+};
+
+// Flags set by IOCTL_SETFL. With O_NONBLOCK, a read or write that would have
+// to wait fails with -EAGAIN instead (or returns a short count, if some data
+// was already transferred).
+
+#define O_NONBLOCK          0x1
+
+// Descriptor flags, read and set with the F_GETFD and F_SETFD commands of the
+// fcntl system call. Unlike O_* flags, they belong to the descriptor, not to
+// the object. Descriptors made by dup and dup2 start without them; fork
+// copies them.
+
+#define F_GETFD             1
+#define F_SETFD             2
+
+#define FD_CLOEXEC          0x1 // close the descriptor on exec
+
+// An entry of the descriptor array passed to the poll system call. The caller
+// sets /fd/ and /events/; poll sets /revents/ to the events that are ready.
+// Entries with a negative /fd/ are ignored.
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+#define POLLIN              0x1 // read would not block
+#define POLLOUT             0x4 // write would not block
 
 #define FS_BLKSZ            4096
 
@@ -113,6 +191,36 @@ extern long
 __attribute__ ((nonnull(1,2)))
 iowrite(struct io_intf * io, const void * buf, unsigned long n);
 
+// The ioreadv and iowritev functions are the vectored forms of ioread and
+// iowrite: /iov/ is an array of /iovcnt/ buffers that are filled or written in
+// order. They use the object's readv or writev operation if it has one.
+// Otherwise ioreadv reads into each segment in turn and stops after the first
+// short read, and iowritev writes each segment in full with iowrite. Both
+// return the total number of bytes transferred, or a negative error code if
+// the first transfer fails.
+
+extern long
+__attribute__ ((nonnull(1,2)))
+ioreadv(struct io_intf * io, const struct iovec * iov, int iovcnt);
+
+extern long
+__attribute__ ((nonnull(1,2)))
+iowritev(struct io_intf * io, const struct iovec * iov, int iovcnt);
+
+// The ioreadat and iowriteat functions are the positional forms of ioread and
+// iowrite: they transfer at offset /pos/ and leave the current position alone.
+// Like ioread, ioreadat may return after reading fewer than /bufsz/ bytes;
+// like iowrite, iowriteat writes all /n/ bytes unless it reaches the end of
+// the object. Both return -ENOTSUP if the object does not support them.
+
+static inline long
+__attribute__ ((nonnull(1,3)))
+ioreadat(struct io_intf * io, uint64_t pos, void * buf, unsigned long bufsz);
+
+extern long
+__attribute__ ((nonnull(1,3)))
+iowriteat(struct io_intf * io, uint64_t pos, const void * buf, unsigned long n);
+
 // The ioctl function invokes special functions on the I/O object. See the IOCTL
 // numbers defined above.
 
@@ -120,6 +228,25 @@ static inline int
 __attribute__ ((nonnull(1)))
 ioctl(struct io_intf * io, int cmd, void * arg);
 
+// The iopoll function returns the events in POLLIN | POLLOUT that are ready on
+// the I/O object. Objects without a poll operation are always ready.
+//
+// The iopoll_notify function wakes every thread waiting in iopoll_wait. It is
+// called by I/O objects when they may have become ready, and may be called
+// from an ISR. The iopoll_wait function waits for the next call to
+// iopoll_notify, or for /tcnt/ timer ticks if /tcnt/ is not zero; it returns
+// -ETIMEDOUT if the time ran out, or -EINTR if the wait ended because the
+// process of the current thread is exiting. Call it with interrupts
+// disabled, after checking readiness, so that a notification cannot be missed
+// in between.
+
+static inline int
+__attribute__ ((nonnull(1)))
+iopoll(struct io_intf * io);
+
+extern void iopoll_notify(void);
+extern int iopoll_wait(uint64_t tcnt);
+
 // The ioseek function sets the current position in the I/O object. This is a
 // convenience function that is equivalent to ioctl(io, IOCTL_SETPOS, pos).
 
@@ -178,6 +305,16 @@ extern long
 __attribute__ ((nonnull(1,2)))
 iolit_read(struct io_intf * io, void * buf, unsigned long bufsz);
 
+extern long
+__attribute__ ((nonnull(1,3)))
+iolit_writeat(struct io_intf * io, uint64_t pos,
+    const void * buf, unsigned long n);
+
+extern long
+__attribute__ ((nonnull(1,3)))
+iolit_readat(struct io_intf * io, uint64_t pos,
+    void * buf, unsigned long bufsz);
+
 extern int
 __attribute__ ((nonnull(1)))
 iolit_ctl(struct io_intf * io, int cmd, void * arg);
@@ -205,8 +342,8 @@ ioterm_getsn(struct io_term * iot, char * buf, size_t n);
 //
 
 static inline uint32_t ioref(struct io_intf * io) {
-    io->refcnt += 1;
-    return io->refcnt;
+    // one instruction, so a preempted close cannot lose the update
+    return __atomic_add_fetch(&io->refcnt, 1, __ATOMIC_RELAXED);
 }
 
 static inline void ioclose(struct io_intf * io) {
@@ -223,7 +360,28 @@ static inline long ioread (
         return -ENOTSUP;
 }
 
+static inline long ioreadat (
+    struct io_intf * io, uint64_t pos, void * buf, unsigned long bufsz)
+{
+    if (io->ops->readat)
+        return io->ops->readat(io, pos, buf, bufsz);
+    else
+        return -ENOTSUP;
+}
+
+static inline int iopoll(struct io_intf * io) {
+    if (io->ops->poll)
+        return io->ops->poll(io);
+    else
+        return POLLIN | POLLOUT;
+}
+
 static inline int ioctl(struct io_intf * io, int cmd, void * arg) {
+    if (cmd == IOCTL_SETFL) {
+        io->flags = *(int*)arg;
+        return 0;
+    }
+
     if (io->ops->ctl)
         return io->ops->ctl(io, cmd, arg);
     else
@@ -0,0 +1,261 @@
+// ioring.c - Asynchronous system call rings
+//
+
+#ifdef IORING_TRACE
+#define TRACE
+#endif
+
+#ifdef IORING_DEBUG
+#define DEBUG
+#endif
+
+#include "ioring.h"
+
+#include <stddef.h>
+
+#include "console.h"
+#include "error.h"
+#include "heap.h"
+#include "intr.h"
+#include "memory.h"
+#include "process.h"
+#include "scnum.h"
+#include "syscall.h"
+#include "thread.h"
+#include "workq.h"
+
+// COMPILE-TIME PARAMETERS
+//
+
+// NIORINGWORKER is the number of worker threads running ring entries
+
+#ifndef NIORINGWORKER
+#define NIORINGWORKER 2
+#endif
+
+// EXPORTED GLOBAL VARIABLES
+//
+
+char ioring_initialized = 0;
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// Kernel side of a registered ring. The ring itself lives in user memory, so
+// the worker running it takes on the process (and with it the memory space)
+// for as long as it runs entries.
+
+struct ioring_ctx {
+    struct process * proc;
+    struct ioring * ring; // user address
+    struct work work;
+    struct condition cq_ready; // signalled when a CQ entry is posted
+    uint32_t sq_limit; // entries before this index have been submitted
+    uint32_t sq_next; // next entry to run
+    int inflight; // submitted and not yet completed
+    int running; // a worker is running entries
+};
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+// Ring entries may block indefinitely (a read from a serial port or a pipe),
+// so rings are run on a work queue of their own. Blocked entries then hold up
+// only other rings, never the driver work on the system work queue that would
+// complete them.
+
+static struct workqueue ioring_wq;
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static void ioring_work(struct work * wk);
+static long ioring_dispatch(const struct ioring_sqe * sqe);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+void ioring_init(void) {
+    workqueue_init(&ioring_wq, "ioring", NIORINGWORKER);
+    ioring_initialized = 1;
+}
+
+int ioring_setup(struct ioring * ring) {
+    struct process * const proc = current_process();
+    struct ioring_ctx * ctx;
+
+    if (!ioring_initialized)
+        return -ENOTSUP;
+    if (memory_validate_vptr_len(ring, sizeof(*ring), PTE_U | PTE_R | PTE_W) != 0)
+        return -EINVAL;
+
+    // Another thread of the process may be setting up or entering the ring
+    preempt_disable();
+    ctx = proc->ioring;
+
+    if (ctx == NULL) {
+        ctx = kmalloc(sizeof(struct ioring_ctx));
+        ctx->proc = proc;
+        work_init(&ctx->work, ioring_work);
+        condition_init(&ctx->cq_ready, "ioring.cq_ready");
+        ctx->inflight = 0;
+        ctx->running = 0;
+        proc->ioring = ctx;
+    } else if (ctx->inflight != 0) {
+        preempt_enable();
+        return -EBUSY;
+    }
+
+    ring->sq_head = 0;
+    ring->sq_tail = 0;
+    ring->cq_head = 0;
+    ring->cq_tail = 0;
+
+    ctx->ring = ring;
+    ctx->sq_limit = 0;
+    ctx->sq_next = 0;
+    preempt_enable();
+    return 0;
+}
+
+long ioring_enter(unsigned int min_complete) {
+    struct ioring_ctx * const ctx = current_process()->ioring;
+    struct ioring * ring;
+    uint32_t nsub, room;
+    int saved_intr_state;
+
+    if (ctx == NULL)
+        return -EINVAL;
+
+    ring = ctx->ring;
+    nsub = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE) - ctx->sq_limit;
+
+    // Never have more entries in flight than free CQ slots, so the worker
+    // never has to wait for the program to consume completions. Entries that
+    // do not fit stay queued for the next call.
+
+    saved_intr_state = intr_disable();
+    room = IORING_NENT - (ring->cq_tail - ring->cq_head) - ctx->inflight;
+
+    if (nsub > IORING_NENT)
+        nsub = 0; // sq_tail is garbage
+    if (nsub > room)
+        nsub = room;
+    
+    ctx->sq_limit += nsub;
+    ctx->inflight += nsub;
+    intr_restore(saved_intr_state);
+
+    if (nsub != 0)
+        work_queue_on(&ioring_wq, &ctx->work);
+
+    // If fewer completions than requested can ever arrive, stop waiting
+    // once the ring is idle. An exiting process stops waiting at once.
+
+    saved_intr_state = intr_disable();
+    while (ring->cq_tail - ring->cq_head < min_complete && ctx->inflight != 0) {
+        if (condition_wait_interruptible(&ctx->cq_ready) != 0)
+            break;
+    }
+    intr_restore(saved_intr_state);
+
+    return nsub;
+}
+
+void ioring_release(struct process * proc) {
+    struct ioring_ctx * const ctx = proc->ioring;
+    int saved_intr_state;
+
+    if (ctx == NULL)
+        return;
+
+    saved_intr_state = intr_disable();
+    while (ctx->inflight != 0 || ctx->running)
+        condition_wait(&ctx->cq_ready);
+    intr_restore(saved_intr_state);
+
+    proc->ioring = NULL;
+    kfree(ctx);
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Runs submitted entries until there are none left. A ring is only ever run
+// by one worker at a time: if the work is queued again while a worker is
+// running it, the second worker leaves the new entries to the first, which
+// checks for them before it stops.
+
+void ioring_work(struct work * wk) {
+    struct ioring_ctx * const ctx =
+        (void*)wk - offsetof(struct ioring_ctx, work);
+    struct ioring * const ring = ctx->ring;
+    struct ioring_sqe sqe;
+    struct ioring_cqe * cqe;
+    int saved_intr_state;
+    long res;
+
+    saved_intr_state = intr_disable();
+    if (ctx->running) {
+        intr_restore(saved_intr_state);
+        return;
+    }
+    ctx->running = 1;
+    intr_restore(saved_intr_state);
+
+    // Run in the context of the process that owns the ring
+
+    thread_set_process(running_thread(), ctx->proc);
+    memory_space_switch(ctx->proc->mtag);
+
+    for (;;) {
+        // Leave the process before clearing /running/: once it is clear,
+        // ioring_release may return and the process may be freed, so a
+        // preemption must not find this thread still using it.
+
+        saved_intr_state = intr_disable();
+        if (ctx->sq_next == ctx->sq_limit) {
+            thread_set_process(running_thread(), NULL);
+            memory_space_switch(main_mtag);
+            ctx->running = 0;
+            condition_broadcast(&ctx->cq_ready);
+            intr_restore(saved_intr_state);
+            break;
+        }
+        intr_restore(saved_intr_state);
+
+        sqe = ring->sq[ctx->sq_next % IORING_NENT];
+        ctx->sq_next += 1;
+        ring->sq_head = ctx->sq_next;
+
+        res = ioring_dispatch(&sqe);
+        trace("ioring op %d fd %d = %ld", sqe.op, sqe.fd, res);
+
+        cqe = &ring->cq[ring->cq_tail % IORING_NENT];
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        __atomic_store_n(&ring->cq_tail, ring->cq_tail + 1, __ATOMIC_RELEASE);
+
+        saved_intr_state = intr_disable();
+        ctx->inflight -= 1;
+        condition_broadcast(&ctx->cq_ready);
+        intr_restore(saved_intr_state);
+    }
+}
+
+// Runs one SQ entry as the system call it names. Only calls that make sense
+// without a trap frame or a waiting user thread are allowed.
+
+long ioring_dispatch(const struct ioring_sqe * sqe) {
+    switch (sqe->op) {
+    case SYSCALL_READ:
+    case SYSCALL_WRITE:
+    case SYSCALL_IOCTL:
+    case SYSCALL_FSOPEN:
+    case SYSCALL_CLOSE:
+        return syscall_table[sqe->op] (
+            (uintptr_t)sqe->fd, sqe->arg[0], sqe->arg[1], 0, 0, 0);
+    default:
+        return -ENOTSUP;
+    }
+}
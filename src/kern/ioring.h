@@ -0,0 +1,79 @@
+// ioring.h - Asynchronous system call rings (shared with user programs)
+//
+
+#ifndef _IORING_H_
+#define _IORING_H_
+
+#include <stdint.h>
+
+// A process registers one struct ioring in its own memory with
+// _ioring_setup. It holds a submission queue (SQ) and a completion queue (CQ)
+// of IORING_NENT entries each, indexed by free-running 32-bit counters masked
+// with IORING_NENT-1. The program fills SQ entries and advances sq_tail, then
+// calls _ioring_enter to submit them all with one system call. Kernel worker
+// threads run the entries in order and post a CQ entry for each; the program
+// consumes CQ entries and advances cq_head.
+//
+// Each SQ entry is one system call: op is SYSCALL_READ, SYSCALL_WRITE,
+// SYSCALL_IOCTL, SYSCALL_FSOPEN or SYSCALL_CLOSE, called as op(fd, arg[0],
+// arg[1]). The CQ entry carries the same user_data and the return value.
+// Buffers must stay valid until the completion is posted.
+
+#define IORING_NENT 32 // must be a power of two
+
+struct ioring_sqe {
+    int32_t op;
+    int32_t fd;
+    uint64_t arg[2];
+    uint64_t user_data;
+};
+
+struct ioring_cqe {
+    uint64_t user_data;
+    int64_t res;
+};
+
+struct ioring {
+    volatile uint32_t sq_head;  // advanced by the kernel
+    volatile uint32_t sq_tail;  // advanced by the program
+    volatile uint32_t cq_head;  // advanced by the program
+    volatile uint32_t cq_tail;  // advanced by the kernel
+    struct ioring_sqe sq[IORING_NENT];
+    struct ioring_cqe cq[IORING_NENT];
+};
+
+// KERNEL INTERFACE
+//
+
+struct process;
+
+extern char ioring_initialized;
+
+// void ioring_init(void)
+// Starts the worker threads that run ring entries. Must be called after
+// workq_init.
+
+extern void ioring_init(void);
+
+// int ioring_setup(struct ioring * ring)
+// Registers /ring/ as the ring of the current process and resets its counters.
+// Fails with -EBUSY if a previously registered ring still has entries in
+// flight, and with -ENOTSUP if ioring_init has not been called.
+
+extern int ioring_setup(struct ioring * ring);
+
+// long ioring_enter(unsigned int min_complete)
+// Submits the SQ entries added since the last call, as many as fit without
+// overflowing the CQ, and waits until at least /min_complete/ CQ entries are
+// available or nothing is left in flight. The wait ends early if the process
+// starts to exit. Returns the number of entries submitted.
+
+extern long ioring_enter(unsigned int min_complete);
+
+// void ioring_release(struct process * proc)
+// Waits for the entries in flight on the ring of /proc/ and unregisters it.
+// Called before the address space of /proc/ is torn down.
+
+extern void ioring_release(struct process * proc);
+
+#endif // _IORING_H_
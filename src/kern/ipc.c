@@ -0,0 +1,589 @@
+// ipc.c - Synchronous message passing
+//
+// A call lives on the kernel stack of the calling thread for as long as the
+// caller is blocked in ipc_call. It sits first on its port's pending queue,
+// until a server receives it, and then on the port's accepted list, until the
+// server replies. The message words are copied into the call from the
+// sender's memory and out of it into the receiver's memory, each by the
+// thread whose memory space is active; a granted page travels as a physical
+// page pointer.
+//
+// The handoff: a client calling a port that a server waits on switches to
+// the server with condition_wait_handoff, and a server replying to a client
+// with no other call pending switches back to the client the same way. A
+// round trip thus takes two thread switches and never goes through the
+// ready-to-run list. All port state is changed with interrupts disabled.
+//
+// A port belongs to the process that created it and is torn down when that
+// process exits: it leaves the port table, its outstanding calls fail with
+// -EPIPE and its waiting servers return. Every thread inside a port operation
+// holds a reference to the port, so the memory outlives the last of them.
+// A server that exits fails the calls it accepted but did not reply to.
+//
+
+#ifdef IPC_TRACE
+#define TRACE
+#endif
+
+#ifdef IPC_DEBUG
+#define DEBUG
+#endif
+
+#include "ipc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "console.h"
+#include "error.h"
+#include "heap.h"
+#include "intr.h"
+#include "memory.h"
+#include "process.h"
+#include "string.h"
+#include "thread.h"
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// A message in the kernel. The page, if any, is a direct-mapped pointer.
+
+struct ipc_kmsg {
+    uint64_t word[IPC_NWORD];
+    void * page;
+};
+
+struct ipc_call {
+    struct ipc_call * next;
+    int tid; // caller; the handle of the call
+    int replied;
+    int result; // 0, or -EPIPE if the call failed without a reply
+    int withdrawn; // the caller gave up while a server copied the call out
+    struct process * server; // process that accepted the call
+    struct ipc_kmsg msg;
+    struct ipc_kmsg reply;
+    struct condition reply_cond; // the caller waits here
+};
+
+struct ipc_port {
+    struct ipc_call * pending_head;
+    struct ipc_call * pending_tail;
+    struct ipc_call * accepted;
+    struct condition recv_cond; // servers wait here
+    struct process * owner; // creator, or NULL for the kernel
+    int refcnt; // the table entry plus threads using the port
+    int dead; // torn down; no longer in the table
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static struct ipc_port * ipc_port_get(int id);
+static void ipc_port_put(struct ipc_port * port);
+static void ipc_port_teardown(struct ipc_port * port);
+static void ipc_fail_call(struct ipc_call * call);
+static int ipc_withdraw(struct ipc_port * port, struct ipc_call * call);
+static int ipc_post_reply(struct ipc_port * port, int handle,
+    const struct ipc_msg * msg, struct ipc_call ** clientptr);
+static struct ipc_call ** ipc_find_accepted(struct ipc_port * port, int handle);
+static int ipc_msg_ok(const struct ipc_msg * msg);
+static int ipc_msg_get(struct ipc_kmsg * kmsg, const struct ipc_msg * msg);
+static void ipc_msg_put(struct ipc_msg * msg, const struct ipc_kmsg * kmsg);
+static int ipc_page_ok(const void * vp);
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static struct ipc_port * ipctab[NIPC];
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int ipc_port_create(void) {
+    struct ipc_port * port;
+    int saved_intr_state;
+    int id;
+
+    port = kcalloc(1, sizeof(struct ipc_port));
+    condition_init(&port->recv_cond, "ipc.recv");
+    port->owner = current_process();
+    port->refcnt = 1;
+
+    saved_intr_state = intr_disable();
+
+    // An exiting process has released its ports already (see ipc_release),
+    // so it must not create another one.
+
+    id = NIPC;
+    if (port->owner == NULL || !port->owner->exiting) {
+        for (id = 0; id < NIPC; id++) {
+            if (ipctab[id] == NULL) {
+                ipctab[id] = port;
+                break;
+            }
+        }
+    }
+    intr_restore(saved_intr_state);
+
+    if (id == NIPC) {
+        kfree(port);
+        return -EBUSY;
+    }
+
+    return id;
+}
+
+int ipc_call(int id, struct ipc_msg * msg) {
+    struct ipc_port * port;
+    struct ipc_call call;
+    int saved_intr_state;
+
+    port = ipc_port_get(id);
+    if (port == NULL)
+        return -EINVAL;
+    if (!ipc_msg_ok(msg) || ipc_msg_get(&call.msg, msg) != 0) {
+        ipc_port_put(port);
+        return -EINVAL;
+    }
+
+    call.next = NULL;
+    call.tid = running_thread();
+    call.replied = 0;
+    call.result = 0;
+    call.withdrawn = 0;
+    call.server = NULL;
+    condition_init(&call.reply_cond, "ipc.reply");
+
+    trace("%s(%d) in thread %d", __func__, id, call.tid);
+
+    saved_intr_state = intr_disable();
+
+    if (port->dead) {
+        intr_restore(saved_intr_state);
+        if (call.msg.page != NULL)
+            memory_free_page(call.msg.page);
+        ipc_port_put(port);
+        return -EPIPE;
+    }
+
+    if (port->pending_tail != NULL)
+        port->pending_tail->next = &call;
+    else
+        port->pending_head = &call;
+    port->pending_tail = &call;
+
+    condition_wait_handoff(&call.reply_cond, &port->recv_cond);
+
+    // If our process starts to exit, give up the call. A server copying it
+    // out right now fails it instead, shortly.
+
+    while (!call.replied) {
+        if (condition_wait_interruptible(&call.reply_cond) != 0 &&
+            !call.replied)
+        {
+            if (ipc_withdraw(port, &call)) {
+                intr_restore(saved_intr_state);
+                ipc_port_put(port);
+                return -EINTR;
+            }
+            while (!call.replied)
+                condition_wait(&call.reply_cond);
+        }
+    }
+
+    intr_restore(saved_intr_state);
+    ipc_port_put(port);
+
+    if (call.result != 0)
+        return call.result;
+
+    ipc_msg_put(msg, &call.reply);
+    return 0;
+}
+
+int ipc_reply(int id, int handle, struct ipc_msg * msg) {
+    struct ipc_port * port;
+    struct ipc_call * client;
+    int result;
+
+    port = ipc_port_get(id);
+    if (port == NULL)
+        return -EINVAL;
+
+    result = -EINVAL;
+    if (ipc_msg_ok(msg))
+        result = ipc_post_reply(port, handle, msg, &client);
+    if (result == 0)
+        condition_broadcast(&client->reply_cond);
+
+    ipc_port_put(port);
+    return result;
+}
+
+int ipc_replyrecv(int id, int handle, struct ipc_msg * msg) {
+    struct ipc_port * port;
+    struct ipc_call * client = NULL;
+    struct ipc_call * call;
+    struct process * server;
+    int saved_intr_state;
+    int result = 0;
+
+    port = ipc_port_get(id);
+    if (port == NULL)
+        return -EINVAL;
+    if (!ipc_msg_ok(msg)) {
+        ipc_port_put(port);
+        return -EINVAL;
+    }
+
+    if (0 <= handle) {
+        result = ipc_post_reply(port, handle, msg, &client);
+        if (result != 0) {
+            ipc_port_put(port);
+            return result;
+        }
+    }
+
+    saved_intr_state = intr_disable();
+
+    // Switch straight to the client unless another call is waiting, in which
+    // case the client goes on the ready-to-run list and we carry on.
+
+    if (port->pending_head == NULL && client != NULL)
+        condition_wait_handoff(&port->recv_cond, &client->reply_cond);
+    else if (client != NULL)
+        condition_broadcast(&client->reply_cond);
+
+    server = current_process();
+
+    for (;;) {
+        result = 0;
+        while (port->pending_head == NULL && !port->dead && result == 0)
+            result = condition_wait_interruptible(&port->recv_cond);
+
+        if (port->dead || result != 0) {
+            intr_restore(saved_intr_state);
+            ipc_port_put(port);
+            return port->dead ? -EPIPE : result;
+        }
+
+        call = port->pending_head;
+        port->pending_head = call->next;
+        if (port->pending_head == NULL)
+            port->pending_tail = NULL;
+
+        intr_restore(saved_intr_state);
+
+        // The call is on neither list while its message is copied out, so no
+        // other server can reply to it and the caller stays blocked. Once it
+        // is on the accepted list, the reply may end the call at any moment.
+
+        ipc_msg_put(msg, &call->msg);
+
+        // If the port died or our process started exiting meanwhile,
+        // ipc_release has already run and cannot see the call, so fail it
+        // here.
+
+        saved_intr_state = intr_disable();
+
+        if (port->dead || (server != NULL && server->exiting)) {
+            ipc_fail_call(call);
+            intr_restore(saved_intr_state);
+            ipc_port_put(port);
+            return -EPIPE;
+        }
+
+        if (!call->withdrawn)
+            break;
+
+        // The caller gave up meanwhile (see ipc_withdraw); take the next call
+
+        ipc_fail_call(call);
+    }
+
+    handle = call->tid;
+    call->server = server;
+    call->next = port->accepted;
+    port->accepted = call;
+
+    intr_restore(saved_intr_state);
+    ipc_port_put(port);
+
+    trace("%s(%d) received call %d", __func__, id, handle);
+    return handle;
+}
+
+void ipc_release(struct process * proc) {
+    struct ipc_port * dead[NIPC];
+    struct ipc_call ** link;
+    struct ipc_call * call;
+    struct ipc_port * port;
+    int saved_intr_state;
+    int ndead = 0;
+    int id;
+
+    saved_intr_state = intr_disable();
+
+    for (id = 0; id < NIPC; id++) {
+        port = ipctab[id];
+        if (port == NULL)
+            continue;
+
+        if (port->owner == proc) {
+            ipctab[id] = NULL;
+            ipc_port_teardown(port);
+            dead[ndead++] = port;
+            continue;
+        }
+
+        link = &port->accepted;
+        while (*link != NULL) {
+            call = *link;
+            if (call->server == proc) {
+                *link = call->next;
+                ipc_fail_call(call);
+            } else
+                link = &call->next;
+        }
+    }
+
+    intr_restore(saved_intr_state);
+
+    // Drop the table's references; threads still in the ports drop theirs
+    // on the way out.
+
+    while (0 < ndead)
+        ipc_port_put(dead[--ndead]);
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Returns the port /id/ with a reference taken, or NULL if there is none.
+
+static struct ipc_port * ipc_port_get(int id) {
+    struct ipc_port * port;
+    int saved_intr_state;
+
+    if (id < 0 || NIPC <= id)
+        return NULL;
+
+    saved_intr_state = intr_disable();
+    port = ipctab[id];
+    if (port != NULL)
+        port->refcnt += 1;
+    intr_restore(saved_intr_state);
+
+    return port;
+}
+
+// Drops a reference to /port/, freeing it with the last one.
+
+static void ipc_port_put(struct ipc_port * port) {
+    int saved_intr_state;
+    int refcnt;
+
+    saved_intr_state = intr_disable();
+    refcnt = --port->refcnt;
+    intr_restore(saved_intr_state);
+
+    if (refcnt == 0)
+        kfree(port);
+}
+
+// Marks /port/ dead, fails its pending and accepted calls and wakes its
+// waiting servers. The page granted by a call no server received is freed.
+// Must be called with interrupts disabled.
+
+static void ipc_port_teardown(struct ipc_port * port) {
+    struct ipc_call * call;
+
+    port->dead = 1;
+
+    while ((call = port->pending_head) != NULL) {
+        port->pending_head = call->next;
+        if (call->msg.page != NULL)
+            memory_free_page(call->msg.page);
+        ipc_fail_call(call);
+    }
+    port->pending_tail = NULL;
+
+    while ((call = port->accepted) != NULL) {
+        port->accepted = call->next;
+        ipc_fail_call(call);
+    }
+
+    condition_broadcast(&port->recv_cond);
+}
+
+// Ends /call/, which is on no list, with -EPIPE and wakes its caller. Must be
+// called with interrupts disabled.
+
+static void ipc_fail_call(struct ipc_call * call) {
+    call->result = -EPIPE;
+    call->replied = 1;
+    condition_broadcast(&call->reply_cond);
+}
+
+// Takes /call/ off the pending queue or the accepted list of /port/ for a
+// caller that gives up, freeing the page it granted if no server received it.
+// Returns 0 if the call is on neither, since a server is copying it out; the
+// call is then marked withdrawn, and that server fails it. Must be called with
+// interrupts disabled.
+
+static int ipc_withdraw(struct ipc_port * port, struct ipc_call * call) {
+    struct ipc_call * prev = NULL;
+    struct ipc_call ** link;
+
+    for (link = &port->pending_head; *link != NULL; link = &(*link)->next) {
+        if (*link == call) {
+            *link = call->next;
+            if (port->pending_tail == call)
+                port->pending_tail = prev;
+            if (call->msg.page != NULL)
+                memory_free_page(call->msg.page);
+            return 1;
+        }
+        prev = *link;
+    }
+
+    for (link = &port->accepted; *link != NULL; link = &(*link)->next) {
+        if (*link == call) {
+            *link = call->next;
+            return 1;
+        }
+    }
+
+    call->withdrawn = 1;
+    return 0;
+}
+
+// Takes the call /handle/ off the accepted list of /port/ and stores the reply
+// /msg/ in it, leaving the caller to be woken through *clientptr. The caller
+// stays blocked until then, since nothing else wakes it. Returns -EINVAL,
+// having done nothing, if there is no such call or the page to grant is bad.
+
+static int ipc_post_reply(struct ipc_port * port, int handle,
+    const struct ipc_msg * msg, struct ipc_call ** clientptr)
+{
+    struct ipc_call ** link;
+    struct ipc_kmsg reply;
+    int saved_intr_state;
+
+    // Check the handle before taking the reply's page, so that a bad handle
+    // changes nothing. The call is looked up again afterwards, since other
+    // servers of the port may have changed the accepted list meanwhile.
+
+    saved_intr_state = intr_disable();
+    link = ipc_find_accepted(port, handle);
+    intr_restore(saved_intr_state);
+
+    if (link == NULL || ipc_msg_get(&reply, msg) != 0)
+        return -EINVAL;
+
+    saved_intr_state = intr_disable();
+    link = ipc_find_accepted(port, handle);
+
+    if (link == NULL) {
+        intr_restore(saved_intr_state);
+        if (reply.page != NULL)
+            memory_free_page(reply.page);
+        return -EINVAL;
+    }
+
+    *clientptr = *link;
+    *link = (*clientptr)->next;
+    (*clientptr)->reply = reply;
+    (*clientptr)->replied = 1;
+
+    intr_restore(saved_intr_state);
+    return 0;
+}
+
+// Returns the link to the call /handle/ in the accepted list of /port/, or NULL
+// if there is no such call. Must be called with interrupts disabled.
+
+static struct ipc_call ** ipc_find_accepted(struct ipc_port * port, int handle) {
+    struct ipc_call ** link;
+
+    for (link = &port->accepted; *link != NULL; link = &(*link)->next) {
+        if ((*link)->tid == handle)
+            return link;
+    }
+
+    return NULL;
+}
+
+// Checks that /msg/ is a writable user message whose page addresses are
+// NULL or page-aligned user addresses.
+
+static int ipc_msg_ok(const struct ipc_msg * msg) {
+    if (memory_validate_vptr_len(msg, sizeof(*msg), PTE_U | PTE_R | PTE_W) != 0)
+        return 0;
+
+    return ((msg->grant == NULL || ipc_page_ok(msg->grant))
+        && (msg->rcvwin == NULL || ipc_page_ok(msg->rcvwin)));
+}
+
+// Copies the user message /msg/ into /kmsg/, taking the granted page (if
+// any) out of the active memory space and leaving a zeroed page in its place.
+// Returns -EINVAL if the page to grant is not a mapped writable user page.
+
+static int ipc_msg_get(struct ipc_kmsg * kmsg, const struct ipc_msg * msg) {
+    void * pp;
+
+    memcpy(kmsg->word, msg->word, sizeof(kmsg->word));
+    kmsg->page = NULL;
+
+    if (msg->grant != NULL) {
+        pp = memory_alloc_page();
+        memset(pp, 0, PAGE_SIZE);
+        kmsg->page = memory_swap_page(msg->grant, pp);
+        if (kmsg->page == NULL) {
+            memory_free_page(pp);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+// Copies /kmsg/ into the user message /msg/, mapping its page (if any) at
+// msg->rcvwin in the active memory space. The page is dropped if there is no
+// receive window or a read-only page is mapped there.
+
+static void ipc_msg_put(struct ipc_msg * msg, const struct ipc_kmsg * kmsg) {
+    void * old;
+
+    memcpy(msg->word, kmsg->word, sizeof(msg->word));
+    msg->grant = NULL;
+
+    if (kmsg->page == NULL)
+        return;
+
+    if (msg->rcvwin == NULL) {
+        memory_free_page(kmsg->page);
+        return;
+    }
+
+    if (memory_vptr_to_pma(msg->rcvwin, 0) == 0) {
+        memory_alloc_and_map_page (
+            (uintptr_t)msg->rcvwin, PTE_U | PTE_R | PTE_W);
+    }
+
+    old = memory_swap_page(msg->rcvwin, kmsg->page);
+
+    if (old != NULL) {
+        memory_free_page(old);
+        msg->grant = msg->rcvwin;
+    } else
+        memory_free_page(kmsg->page);
+}
+
+static int ipc_page_ok(const void * vp) {
+    const uintptr_t vma = (uintptr_t)vp;
+
+    return (vma % PAGE_SIZE == 0
+        && USER_START_VMA <= vma && vma < USER_END_VMA);
+}
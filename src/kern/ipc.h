@@ -0,0 +1,80 @@
+// ipc.h - Synchronous message passing (shared with user programs)
+//
+
+#ifndef _IPC_H_
+#define _IPC_H_
+
+#include <stdint.h>
+
+// A server creates a port with _ipc_port and serves it with _ipc_replyrecv,
+// which replies to the previous call (if any) and waits for the next one. A
+// client calls the port with _ipc_call, which delivers its message and waits
+// for the reply. Both calls are synchronous and nothing is buffered: when the
+// server is already waiting, the client switches straight to it, and the
+// server's reply switches straight back. Calls made while no server is
+// waiting are queued in order. _ipc_reply replies without waiting for the
+// next call, e.g. before the server exits.
+//
+// A message is IPC_NWORD words plus, optionally, one page. The page at the
+// sender's page-aligned address /grant/ moves to the receiver: it is replaced
+// by a zeroed page in the sender and mapped at the receiver's page-aligned
+// address /rcvwin/, replacing whatever was mapped there. On return, /grant/
+// holds the address the received page was mapped at, or NULL if no page was
+// received. A page sent to a receiver with a NULL /rcvwin/ is dropped.
+//
+// A port lasts until the process that created it exits. Calls outstanding
+// then fail with -EPIPE, as do calls whose server exits without replying,
+// and servers waiting on the port return -EPIPE.
+
+#define NIPC 16
+#define IPC_NWORD 4
+
+struct ipc_msg {
+    uint64_t word[IPC_NWORD];
+    void * grant; // page to send, or NULL
+    void * rcvwin; // where to map a received page, or NULL
+};
+
+// KERNEL INTERFACE
+//
+
+struct process; // process.h
+
+// int ipc_port_create(void)
+// Creates a port and returns its id, or -EBUSY if all NIPC ports exist.
+
+extern int ipc_port_create(void);
+
+// int ipc_call(int port, struct ipc_msg * msg)
+// Sends the message at user address /msg/ to /port/ and waits for the reply,
+// which is stored back in /msg/. Returns 0, -EINVAL for a bad port, message
+// or page, -EPIPE if the port or its server went away before replying, or
+// -EINTR if the process of the caller started to exit.
+
+extern int ipc_call(int port, struct ipc_msg * msg);
+
+// int ipc_reply(int port, int handle, struct ipc_msg * msg)
+// Sends the message at user address /msg/ as the reply to the call /handle/
+// received earlier on /port/, without waiting for another call. The caller
+// is made ready to run rather than switched to. Returns 0, or -EINVAL, having
+// done nothing, for a bad port, handle, message or page.
+
+extern int ipc_reply(int port, int handle, struct ipc_msg * msg);
+
+// int ipc_replyrecv(int port, int handle, struct ipc_msg * msg)
+// Unless /handle/ is negative, sends the message at user address /msg/ as the
+// reply to the call /handle/ received earlier on /port/. Then waits for the
+// next call on /port/, stores its message in /msg/ and returns its handle.
+// Returns -EINVAL, having done nothing, for a bad port, handle, message or
+// page, -EPIPE if the port is torn down while waiting, or -EINTR if the
+// process of the caller starts to exit.
+
+extern int ipc_replyrecv(int port, int handle, struct ipc_msg * msg);
+
+// void ipc_release(struct process * proc)
+// Called as /proc/ exits. Tears down the ports /proc/ created and fails the
+// calls its threads accepted on other ports but did not reply to.
+
+extern void ipc_release(struct process * proc);
+
+#endif // _IPC_H_
@@ -7,6 +7,7 @@ static struct io_intf * system_io;
 static struct boot_block_t super_block;
 
 extern void * kmalloc(size_t size);
+extern void kfree(void * ptr);
 
 static struct lock flk;
 
@@ -68,6 +69,7 @@ int fs_open(const char* name, struct io_intf** io) {
         }
     }
     if (requested_inode == -1) {
+        lock_release(&flk);
         return -ENOENT;
     }
     
@@ -79,6 +81,8 @@ int fs_open(const char* name, struct io_intf** io) {
     // this will read the needed inode block
     long read_result = system_io->ops->read(system_io, file_struct, FS_BLKSZ);
     if (read_result < 0) {
+        kfree(file_struct);
+        lock_release(&flk);
         return -EFILESYS;
     }
 
@@ -89,10 +93,13 @@ int fs_open(const char* name, struct io_intf** io) {
         .read = fs_read,
         .write = fs_write,
         .close = fs_close,
-        .ctl = fs_ioctl
+        .ctl = fs_ioctl,
+        .readat = fs_readat,
+        .writeat = fs_writeat
     };
     new_io->ops = &new_file_ops;
     new_io->refcnt = 1; // setting refcnt for new io
+    new_io->flags = 0;
     *io = new_io;
 
     // find the first empty file locaton and store current file
@@ -103,11 +110,16 @@ int fs_open(const char* name, struct io_intf** io) {
             opened_files.current_opened_files[i].usage_flag = IN_USE;
             opened_files.current_opened_files[i].file_position = inode_position;
             opened_files.current_opened_files[i].inode = requested_inode;
+            kfree(file_struct);
             lock_release(&flk);
             return 0;
         }
     }
-    // failed fs_open
+    // failed fs_open: no free slot
+    kfree(new_io);
+    kfree(file_struct);
+    *io = NULL;
+    lock_release(&flk);
     return -EFILESYS;
 }
 
@@ -121,16 +133,21 @@ int fs_open(const char* name, struct io_intf** io) {
  * -> struct io_intf* io, io_intf corresponding to the file to close
  */
 void fs_close(struct io_intf* io) {
+    lock_acquire(&flk);
     // loop to find the file to close
     for (int i = 0; i < MAX_OPEN_FILE_CT; i++) {
         if (opened_files.current_opened_files[i].io_intf == io) {
-            io->refcnt -= 1; // decrease refcnt by 1
-            if (io->refcnt <= 0) {
+            // decrease refcnt by 1, atomically as in ioref
+            if (__atomic_sub_fetch(&io->refcnt, 1, __ATOMIC_RELAXED) == 0) {
+                // free the slot for fs_open and the io_intf it allocated
                 opened_files.current_opened_files[i].usage_flag = UNUSED;
+                opened_files.current_opened_files[i].io_intf = NULL;
+                kfree(io);
             }
             break;
         }
     }
+    lock_release(&flk);
 }
 
 /*
@@ -211,6 +228,7 @@ int fs_getblksz(file_t* fd, void* arg) {
  */
 int fs_ioctl(struct io_intf* io, int cmd, void* arg) {
     file_t* target_file = NULL;
+    lock_acquire(&flk);
     // finding the file to use
     for (int i = 0; i < MAX_OPEN_FILE_CT; i++) {
         if (opened_files.current_opened_files[i].io_intf == io) {
@@ -219,9 +237,9 @@ int fs_ioctl(struct io_intf* io, int cmd, void* arg) {
     }
 
     if (target_file == NULL) {
+        lock_release(&flk);
         return -EFILESYS;
     }
-    lock_acquire(&flk);
     int ret;
     // switch on cmd to determine what to do
     switch (cmd)
@@ -265,12 +283,38 @@ int fs_ioctl(struct io_intf* io, int cmd, void* arg) {
  * -> unsigned long n, length to write
  * 
  * @return val
- * -> 0
+ * -> number of bytes written
  */
 long fs_write(struct io_intf* io, const void* buf, unsigned long n) {
     // executing fs_write
     uint64_t write_position = ioctl(io, IOCTL_GETPOS, &write_position);
+    long result = fs_writeat(io, write_position, buf, n);
+    if (result > 0) {
+        write_position += result;
+        // set file position (after writing)
+        ioctl(io, IOCTL_SETPOS, &write_position);
+    }
+    return result;
+}
+
+/*
+ * @brief Writes n bytes from buf into the file associated with io at byte offset pos, like fs_write, but without using or updating the file position.
+ *
+ * @param
+ * -> struct io_intf* io, io_intf corresponding to the file
+ * -> uint64_t pos, offset in the file to start writing at
+ * -> const void* buf, buffer that contains the contents to write to file
+ * -> unsigned long n, length to write
+ * 
+ * @return val
+ * -> number of bytes written
+ */
+long fs_writeat(struct io_intf* io, uint64_t pos, const void* buf, unsigned long n) {
+    uint64_t write_position = pos;
     uint64_t inode = -1;
+    // flk is held from the lookup to the last write, so the slot cannot be
+    // closed and system_io cannot be repositioned by another file meanwhile
+    lock_acquire(&flk);
     for (int i = 0; i < MAX_OPEN_FILE_CT; i++) {
         if (opened_files.current_opened_files[i].io_intf == io) {
             inode = opened_files.current_opened_files[i].inode;
@@ -278,24 +322,25 @@ long fs_write(struct io_intf* io, const void* buf, unsigned long n) {
         }
     }
     if (inode == -1) {
+        lock_release(&flk);
         return -EFILESYS;
     }
 
-    // Initialize
-    lock_acquire(&flk);
     // read the inode blocks to get data block addr
     size_t buffer_start = inode * FS_BLKSZ + FS_BLKSZ;
     system_io->ops->ctl(system_io, IOCTL_SETPOS, &buffer_start);
     // read the file_struct to perform write
     struct inode_t * file_struct = kmalloc(sizeof(struct inode_t));
     ioread_full(system_io, file_struct, FS_BLKSZ);
+    if (write_position >= file_struct->byte_len) {
+        kfree(file_struct);
+        lock_release(&flk);
+        return 0;
+    }
     if (write_position + n > file_struct->byte_len) {
         n = file_struct->byte_len - write_position;
     }
 
-    // Release lock
-    lock_release(&flk);
-
     // determine how many cycles to go through, and the remainder bytes to write after block-size writes have finished
     size_t leading = write_position % FS_BLKSZ; 
     // leading is non-zero when writing_position is no multiple of FS_BLKSZ (that current write start position in middle of a data block)
@@ -322,8 +367,6 @@ long fs_write(struct io_intf* io, const void* buf, unsigned long n) {
 
     // set file system memory position to where we'd start writing
     system_io->ops->ctl(system_io, IOCTL_SETPOS, &buffer_start);
-    // Acquire lock here and release it later
-    lock_acquire(&flk);
     for (int i = block_passed; i < DATA_BLOCK_NUM; i++) {
         // if compensation not zero, we have to start writing in the middentering vioblk readle of a previous read/write but not finished block
         if (leading_compensation != 0) {
@@ -346,11 +389,8 @@ long fs_write(struct io_intf* io, const void* buf, unsigned long n) {
             cycle--;
         }
     }
-    write_position += n;
+    kfree(file_struct);
     lock_release(&flk);
-    
-    // set file position (after writing)
-    ioctl(io, IOCTL_SETPOS, &write_position);
     return n;
 }
 
@@ -369,11 +409,36 @@ long fs_write(struct io_intf* io, const void* buf, unsigned long n) {
  * -> unsigned long n, length to read
  * 
  * @return val
- * -> 0
+ * -> number of bytes read
  */
 long fs_read(struct io_intf* io, void* buf, unsigned long n) {
     uint64_t read_position = fs_ioctl(io, IOCTL_GETPOS, &read_position);
+    long result = fs_readat(io, read_position, buf, n);
+    if (result > 0) {
+        read_position += result;
+        // set file position (after reading)
+        ioctl(io, IOCTL_SETPOS, &read_position);
+    }
+    return result;
+}
+
+/*
+ * @brief Reads n bytes at byte offset pos from the file associated with io into buf, like fs_read, but without using or updating the file position.
+ *
+ * @param
+ * -> struct io_intf* io, io_intf corresponding to the file
+ * -> uint64_t pos, offset in the file to start reading at
+ * -> void* buf, buffer to store read results
+ * -> unsigned long n, length to read
+ * 
+ * @return val
+ * -> number of bytes read
+ */
+long fs_readat(struct io_intf* io, uint64_t pos, void* buf, unsigned long n) {
+    uint64_t read_position = pos;
     uint64_t inode = -1;
+    // held from the lookup to the last read, as in fs_writeat
+    lock_acquire(&flk);
     for (int i = 0; i < MAX_OPEN_FILE_CT; i++) {
         if (opened_files.current_opened_files[i].io_intf == io) {
             inode = opened_files.current_opened_files[i].inode;
@@ -381,12 +446,10 @@ long fs_read(struct io_intf* io, void* buf, unsigned long n) {
         }
     }
     if (inode == -1) {
+        lock_release(&flk);
         return -EFILESYS;
     }
 
-    // Initialize
-    lock_acquire(&flk);
-
     // read the inode blocks to get data block addr
     size_t buffer_start = inode * FS_BLKSZ + FS_BLKSZ;
     ioctl(system_io, IOCTL_SETPOS, &buffer_start);
@@ -394,15 +457,15 @@ long fs_read(struct io_intf* io, void* buf, unsigned long n) {
     // read the file_struct to perform write
     struct inode_t * file_struct = kmalloc(sizeof(struct inode_t));
     ioread_full(system_io, file_struct, FS_BLKSZ);
+    if (read_position >= file_struct->byte_len) {
+        kfree(file_struct);
+        lock_release(&flk);
+        return 0;
+    }
     if (read_position + n > file_struct->byte_len) {
         n = file_struct->byte_len - read_position;
     }
 
-    // Release lock
-    lock_release(&flk);
-    
-    // lock here
-    lock_acquire(&flk);
     // determine how many cycles to go through, and the remainder bytes to read after block-size reads have finished
     size_t leading = read_position % FS_BLKSZ; 
     // leading is non-zero when reading_position is no multiple of FS_BLKSZ (that current read start position in middle of a data block)
@@ -454,10 +517,8 @@ long fs_read(struct io_intf* io, void* buf, unsigned long n) {
         }
         
     }
-    read_position += n;
+    kfree(file_struct);
     lock_release(&flk);
-    // set file position (after reading)
-    ioctl(io, IOCTL_SETPOS, &read_position);
-    // finish fs_read
+    // finish fs_readat
     return n;
 }
\ No newline at end of file
@@ -16,6 +16,8 @@
 #include "device.h"
 #include "uart.h"
 #include "timer.h"
+#include "workq.h"
+#include "ioring.h"
 #include "intr.h"
 #include "memory.h"
 #include "heap.h"
@@ -42,6 +44,8 @@ void main(void) {
     thread_init();
     procmgr_init();
     timer_init();
+    workq_init();
+    ioring_init();
 
     // Attach NS16550a serial devices
 
@@ -6,6 +6,7 @@
 #include "device.h"
 #include "uart.h"
 #include "timer.h"
+#include "workq.h"
 #include "intr.h"
 #include "heap.h"
 #include "virtio.h"
@@ -47,6 +48,7 @@ void main(void) {
     timer_init();
 
     heap_init(_kimg_end, (void*)USER_START);
+    workq_init();
 
     //           Attach NS16550a serial devices
 
@@ -142,7 +144,7 @@ void shell_main(struct io_intf * termio_raw) {
             if (tid < 0)
                 ioprintf(termio, "%s: Error %d\n", -result);
             else
-                thread_join(tid);
+                thread_join(tid, NULL);
         }
 
         ioclose(exeio);
@@ -24,6 +24,8 @@
 #include "error.h"
 #include "thread.h"
 #include "process.h"
+#include "vdata.h"
+#include "intr.h"
 
 #include <stdint.h>
 
@@ -97,6 +99,11 @@ static inline void sfence_vma(void);
 
 static union linked_page * free_list;
 
+// Number of mappings (and other holders) of each shared page of RAM, indexed
+// by page number relative to RAM_START. Unused for private pages.
+
+static uint32_t shared_refcnt[RAM_SIZE / PAGE_SIZE];
+
 static struct pte main_pt2[PTE_CNT]
     __attribute__ ((section(".bss.pagetable"), aligned(4096)));
 static struct pte main_pt1_0x80000[PTE_CNT]
@@ -124,7 +131,8 @@ static struct pte main_pt0_0x80000[PTE_CNT]
 struct pte* walk_pt(struct pte* root, uintptr_t vma, int create) {
     if (create != 0) {
         if ((root[VPN2(vma)].flags & PTE_V) == 0) {
-            struct pte* new_pt1 = kmalloc(PAGE_SIZE);
+            struct pte* new_pt1 = memory_alloc_page();
+            memset(new_pt1, 0, PAGE_SIZE); // recycled pages hold stale PTEs
             root[VPN2(vma)] = ptab_pte(new_pt1, 0); // if create enabled, creates a level 1 sub-directory
             sfence_vma();
         }
@@ -136,7 +144,8 @@ struct pte* walk_pt(struct pte* root, uintptr_t vma, int create) {
 
     if (create != 0) {
         if ((subdirectory_pt1[VPN1(vma)].flags & PTE_V) == 0) {
-            struct pte* new_pt0 = kmalloc(PAGE_SIZE);
+            struct pte* new_pt0 = memory_alloc_page();
+            memset(new_pt0, 0, PAGE_SIZE);
             subdirectory_pt1[VPN1(vma)] = ptab_pte(new_pt0, 0); // creates a leaf directory
             sfence_vma();
         }
@@ -296,7 +305,7 @@ void memory_init(void) {
  * @specific: Switch the active memory space to the main memory space and reclaims the memory space that was active on entry. 
  * All physical pages mapped by the memory space that are not part of the global mapping are reclaimed.
  * Walks through tables and free all level 0 & 1 tables(intermediate & leaf), free all leaf ptes without flag G
- * Does not free root page table
+ * Frees the root page table too, unless it is that of the main memory space
  */
 void memory_space_reclaim(void) {
     // Switch memory space and obtain the previous level 2 page table
@@ -323,7 +332,10 @@ void memory_space_reclaim(void) {
                             // if leaf exists and isn't global, free the page
                             if ((leafdirectory_pt0[pt0_idx].flags & PTE_G) == 0) {
 
-                                if (free_list == NULL) {
+                                // a shared page only loses this mapping's reference
+                                if (leafdirectory_pt0[pt0_idx].rsw == PTE_RSW_SHARED) {
+                                    memory_page_unref(pagenum_to_pageptr(leafdirectory_pt0[pt0_idx].ppn));
+                                } else if (free_list == NULL) {
                                     free_list = pagenum_to_pageptr(leafdirectory_pt0[pt0_idx].ppn);
                                 } else {
                                     union linked_page* new_free_page = pagenum_to_pageptr(leafdirectory_pt0[pt0_idx].ppn);
@@ -332,6 +344,7 @@ void memory_space_reclaim(void) {
                                 // unmap page
                                 leafdirectory_pt0[pt0_idx].ppn &= 0;
                                 leafdirectory_pt0[pt0_idx].flags &= 0;
+                                leafdirectory_pt0[pt0_idx].rsw = 0;
                                 sfence_vma();
                             }
                         }
@@ -351,6 +364,11 @@ void memory_space_reclaim(void) {
         }
     }
 
+    // free the root page table (from memory_space_create or memory_space_clone)
+    if (prev_pt2 != main_pt2) {
+        memory_free_page(prev_pt2);
+    }
+
     sfence_vma();
 }
 
@@ -363,12 +381,14 @@ void memory_space_reclaim(void) {
  * void * physical_mem: a physical page extracted from free_list
  */
 void * memory_alloc_page(void) {
+    int saved_intr_state = intr_disable();
     if (free_list == NULL) {
         panic("No Available Free Space: Probably Caused by Infinite Access to Non-Permitted Page\n");
     }
     // Extract the head of free_list thus make it the pma to allocate
     union linked_page * physical_mem = free_list;
     free_list = free_list->next;
+    intr_restore(saved_intr_state);
     sfence_vma();
     return (void*)physical_mem;
 }
@@ -384,8 +404,10 @@ void * memory_alloc_page(void) {
  */
 void memory_free_page(void * pp) {
     union linked_page* freed_ppage = (union linked_page*)pp;
+    int saved_intr_state = intr_disable();
     freed_ppage->next = free_list;
     free_list = freed_ppage;
+    intr_restore(saved_intr_state);
     sfence_vma();
 }
 
@@ -406,6 +428,7 @@ void * memory_alloc_and_map_page (uintptr_t vma, uint_fast8_t rwxug_flags) {
     struct pte* dest_pte = (struct pte*)walk_pt(active_space_root(), vma, CREATE_PTE);
     dest_pte->flags |= rwxug_flags | PTE_A | PTE_D | PTE_V;
     dest_pte->ppn = pageptr_to_pagenum(newly_allocated);
+    dest_pte->rsw = 0;
     sfence_vma();
     return (void*)vma;
 }
@@ -506,7 +529,10 @@ void memory_unmap_and_free_user(void) {
                             // if leaf exists and belongs to user, free the page
                             if ((leafdirectory_pt0[pt0_idx].flags & PTE_U) != 0) {
 
-                                if (free_list == NULL) {
+                                // a shared page only loses this mapping's reference
+                                if (leafdirectory_pt0[pt0_idx].rsw == PTE_RSW_SHARED) {
+                                    memory_page_unref(pagenum_to_pageptr(leafdirectory_pt0[pt0_idx].ppn));
+                                } else if (free_list == NULL) {
                                     free_list = pagenum_to_pageptr(leafdirectory_pt0[pt0_idx].ppn);
                                 } else {
                                     union linked_page* new_free_page = pagenum_to_pageptr(leafdirectory_pt0[pt0_idx].ppn);
@@ -515,6 +541,7 @@ void memory_unmap_and_free_user(void) {
                                 // unmap the page
                                 leafdirectory_pt0[pt0_idx].ppn &= 0;
                                 leafdirectory_pt0[pt0_idx].flags &= 0;
+                                leafdirectory_pt0[pt0_idx].rsw = 0;
                                 sfence_vma();
                             }
                         }
@@ -543,14 +570,26 @@ void memory_unmap_and_free_user(void) {
  * @brief: handles page fault from user exception handler
  * @specific: Handle a page fault at a virtual address. If vptr in user range, allocate a new page, otherwise panics.
  * The system call this function when a store page fault is triggered by a user program.
- * The page assigned to user must have flag U set
+ * The page assigned to user must have flag U set. The read-only vdata page is never
+ * backed on demand, so a fault there (a store) is refused like any other bad address.
  * 
  * @param:
  * const void * vptr: virtual memory where fault took place
  */
 void memory_handle_page_fault(const void * vptr) {
-    if (((size_t)vptr >= USER_START_VMA) && ((size_t)vptr <= USER_END_VMA)) {
-        memory_alloc_and_map_page((uintptr_t)vptr, PTE_R | PTE_W | PTE_U);
+    size_t va = (size_t)vptr;
+
+    if (USER_START_VMA <= va && va < USER_END_VMA &&
+        !(VDATA_VMA <= va && va < VDATA_VMA + PAGE_SIZE) &&
+        !process_stack_guard(va)) {
+        // Faults are taken with interrupts enabled, so another thread of the
+        // process may have mapped the page since this one faulted
+        struct pte* pte;
+        preempt_disable();
+        pte = walk_pt(active_space_root(), va, CREATE_PTE);
+        if (!(pte->flags & PTE_V))
+            memory_alloc_and_map_page(va, PTE_R | PTE_W | PTE_U);
+        preempt_enable();
         sfence_vma();
     } else {
         kprintf("Memory Handle Page Fault Exited Anomaly at %x\n", vptr);
@@ -558,6 +597,36 @@ void memory_handle_page_fault(const void * vptr) {
     }
 }
 
+/*
+ * @brief: creates an empty memory space
+ * @specific: The new space has the same global identity mapping of MMIO and RAM as the main memory
+ * space and no user mappings. It becomes the active memory space. Used to build a process from an
+ * executable without cloning the parent first.
+ * 
+ * @param:
+ * uint_fast16_t asid: unused
+ * @return val:
+ * uintptr_t new_mtag: mtag for the new memory space
+ */
+uintptr_t memory_space_create(uint_fast16_t asid) {
+    struct pte* new_root_page_table = memory_alloc_page();
+    uintptr_t new_mtag = ((uintptr_t)RISCV_SATP_MODE_Sv39 << RISCV_SATP_MODE_shift) | pageptr_to_pagenum(new_root_page_table);
+    uintptr_t pma;
+
+    memset(new_root_page_table, 0, PAGE_SIZE);
+
+    // Identity mapping of two gigabytes (as two gigapage mappings)
+    for (pma = 0; pma < RAM_START_PMA; pma += GIGA_SIZE)
+        new_root_page_table[VPN2(pma)] = leaf_pte((void*)pma, PTE_R | PTE_W | PTE_G);
+    
+    // Third gigarange has a second-level page table
+    new_root_page_table[VPN2(RAM_START_PMA)] = ptab_pte(main_pt1_0x80000, PTE_G);
+
+    memory_space_switch(new_mtag);
+    sfence_vma();
+    return new_mtag;
+}
+
 /*
  * @brief: clones all userspace memory for forked procss
  * @specific: Function implemented in memory.c that should clone your memory space for current process and return the
@@ -570,11 +639,14 @@ void memory_handle_page_fault(const void * vptr) {
  * uintptr_t new_mtag: mtag for cloned memory space
  */
 uintptr_t memory_space_clone(uint_fast16_t asid) {
-    struct pte* new_root_page_table = kmalloc(PAGE_SIZE);
+    struct pte* new_root_page_table = memory_alloc_page();
     uintptr_t new_mtag = ((uintptr_t)RISCV_SATP_MODE_Sv39 << RISCV_SATP_MODE_shift) | pageptr_to_pagenum(new_root_page_table);
     uintptr_t pma;
     uintptr_t vma;
 
+    // freed by memory_space_reclaim
+    memset(new_root_page_table, 0, PAGE_SIZE);
+
     // Shallow copy the global contents
     // Identity mapping of two gigabytes (as two gigapage mappings)
     for (pma = 0; pma < RAM_START_PMA; pma += GIGA_SIZE)
@@ -591,6 +663,15 @@ uintptr_t memory_space_clone(uint_fast16_t asid) {
         // If pte allocated and contexts have flag PTE_V
         if ((size_t)parent_leaf_pte <= (size_t)RAM_END && (size_t)parent_leaf_pte >= (size_t)RAM_START 
             && (parent_leaf_pte->flags & PTE_V) != 0 && parent_leaf_pte->ppn != 0) {
+            // shared pages stay shared: the child maps the same page
+            if (parent_leaf_pte->rsw == PTE_RSW_SHARED) {
+                // a page cannot have more references than there are PTEs
+                // to hold them, far fewer than the counter allows
+                if (memory_page_ref(pagenum_to_pageptr(parent_leaf_pte->ppn)) != 0)
+                    panic("shared page reference count overflow");
+                *child_leaf_pte = *parent_leaf_pte;
+                continue;
+            }
             uint8_t original_flag = parent_leaf_pte->flags;
             child_leaf_pte->ppn = pageptr_to_pagenum(memory_alloc_page());
             // Set R/W flags which permits clone
@@ -634,6 +715,192 @@ int memory_validate_vstr (const char * vs, uint_fast8_t ug_flags) {
     return 0;
 }
 
+/*
+ * @brief: translate a virtual address of the active memory space to a physical address
+ * @specific: Walks the active page table without creating anything. Any invalid or
+ * leaf PTE above level 0 ends the walk, so unmapped user addresses are safe to query.
+ *
+ * @param:
+ * const void * vp: virtual address to translate
+ * uint_fast8_t rwxug_flags: flags the leaf PTE must have
+ * @return val:
+ * uintptr_t: physical address of vp, or 0 if not mapped with the flags
+ */
+uintptr_t memory_vptr_to_pma(const void * vp, uint_fast8_t rwxug_flags) {
+    const uintptr_t vma = (uintptr_t)vp;
+    struct pte * pt = active_space_root();
+    struct pte pte;
+
+    if (!wellformed_vptr(vp))
+        return 0;
+
+    pte = pt[VPN2(vma)];
+    if ((pte.flags & PTE_V) == 0 || (pte.flags & (PTE_R | PTE_W | PTE_X)) != 0)
+        return 0;
+    
+    pt = pagenum_to_pageptr(pte.ppn);
+    pte = pt[VPN1(vma)];
+    if ((pte.flags & PTE_V) == 0 || (pte.flags & (PTE_R | PTE_W | PTE_X)) != 0)
+        return 0;
+    
+    pt = pagenum_to_pageptr(pte.ppn);
+    pte = pt[VPN0(vma)];
+    if ((pte.flags & PTE_V) == 0 || (pte.flags & rwxug_flags) != rwxug_flags)
+        return 0;
+
+    return (uintptr_t)pagenum_to_pageptr(pte.ppn) + (vma & (PAGE_SIZE - 1));
+}
+
+/*
+ * @brief: allocate a shared page
+ * @specific: The page starts out zeroed, so no data leaks between the processes sharing it, and
+ * with the caller's reference.
+ *
+ * @return val:
+ * void *: direct-mapped pointer to the page
+ */
+void * memory_alloc_shared_page(void) {
+    void * pp = memory_alloc_page();
+
+    memset(pp, 0, PAGE_SIZE);
+    shared_refcnt[((uintptr_t)pp - RAM_START_PMA) / PAGE_SIZE] = 1;
+    return pp;
+}
+
+/*
+ * @brief: add a reference to a shared page
+ *
+ * @return val:
+ * int: 0, or -ENOMEM if the count would overflow
+ */
+int memory_page_ref(void * pp) {
+    uint32_t * const refcnt = &shared_refcnt[((uintptr_t)pp - RAM_START_PMA) / PAGE_SIZE];
+    int saved_intr_state = intr_disable();
+    int result = -ENOMEM;
+
+    if (*refcnt < UINT32_MAX) {
+        *refcnt += 1;
+        result = 0;
+    }
+    intr_restore(saved_intr_state);
+    return result;
+}
+
+/*
+ * @brief: drop a reference to a shared page, freeing it with the last one
+ */
+void memory_page_unref(void * pp) {
+    uint32_t * const refcnt = &shared_refcnt[((uintptr_t)pp - RAM_START_PMA) / PAGE_SIZE];
+    int saved_intr_state = intr_disable();
+
+    assert (*refcnt > 0);
+    *refcnt -= 1;
+    if (*refcnt == 0) {
+        memory_free_page(pp);
+    }
+    intr_restore(saved_intr_state);
+}
+
+/*
+ * @brief: map a shared page in the active memory space
+ * @specific: Like memory_alloc_and_map_page, but with a given page, which is marked shared in its
+ * PTE and gains a reference for the mapping.
+ *
+ * @param:
+ * uintptr_t vma: virtual address to map the page at
+ * void * pp: direct-mapped pointer to a shared page
+ * uint_fast8_t rwxug_flags: flags of the mapping
+ * @return val:
+ * int: 0, -EBUSY or -ENOMEM
+ */
+int memory_map_shared_page(uintptr_t vma, void * pp, uint_fast8_t rwxug_flags) {
+    struct pte* dest_pte = walk_pt(active_space_root(), vma, CREATE_PTE);
+
+    if ((dest_pte->flags & PTE_V) != 0) {
+        return -EBUSY;
+    }
+
+    // take the reference first, so nothing is mapped if it fails
+    if (memory_page_ref(pp) != 0) {
+        return -ENOMEM;
+    }
+
+    *dest_pte = leaf_pte(pp, rwxug_flags);
+    dest_pte->rsw = PTE_RSW_SHARED;
+    sfence_vma();
+    return 0;
+}
+
+/*
+ * @brief: remove a mapping of a shared page from the active memory space
+ *
+ * @param:
+ * uintptr_t vma: virtual address the page is mapped at
+ * @return val:
+ * int: 0 or -EINVAL
+ */
+int memory_unmap_shared_page(uintptr_t vma) {
+    const uintptr_t pma = memory_vptr_to_pma((void *)vma, 0);
+    struct pte* dest_pte;
+
+    if (pma == 0) {
+        return -EINVAL;
+    }
+
+    dest_pte = walk_pt(active_space_root(), vma, 0);
+    if (dest_pte->rsw != PTE_RSW_SHARED) {
+        return -EINVAL;
+    }
+
+    *dest_pte = null_pte();
+    sfence_vma();
+    memory_page_unref((void *)(pma & ~(PAGE_SIZE - 1)));
+    return 0;
+}
+
+/*
+ * @brief: hand a physical page over to a user mapping
+ * @specific: The leaf PTE for vp is found the same way as in memory_vptr_to_pma, so nothing is
+ * created. The new page takes the place of the old one with the same flags; the caller owns
+ * the old page afterwards.
+ *
+ * @param:
+ * const void * vp: page-aligned user address
+ * void * pp: direct-mapped pointer to the page to map at vp
+ * @return val:
+ * void *: direct-mapped pointer to the page that was mapped at vp, or NULL
+ */
+void * memory_swap_page(const void * vp, void * pp) {
+    const uintptr_t vma = (uintptr_t)vp;
+    struct pte * pt = active_space_root();
+    struct pte * leaf;
+    void * old_pp;
+
+    if (!aligned_addr(vma, PAGE_SIZE) || vma < USER_START_VMA || USER_END_VMA <= vma)
+        return NULL;
+
+    if ((pt[VPN2(vma)].flags & PTE_V) == 0 || (pt[VPN2(vma)].flags & (PTE_R | PTE_W | PTE_X)) != 0)
+        return NULL;
+
+    pt = pagenum_to_pageptr(pt[VPN2(vma)].ppn);
+    if ((pt[VPN1(vma)].flags & PTE_V) == 0 || (pt[VPN1(vma)].flags & (PTE_R | PTE_W | PTE_X)) != 0)
+        return NULL;
+
+    pt = pagenum_to_pageptr(pt[VPN1(vma)].ppn);
+    leaf = &pt[VPN0(vma)];
+    if ((leaf->flags & (PTE_V | PTE_U | PTE_W)) != (PTE_V | PTE_U | PTE_W))
+        return NULL;
+
+    // other mappings of a shared page would not see the new page
+    if (leaf->rsw == PTE_RSW_SHARED)
+        return NULL;
+
+    old_pp = pagenum_to_pageptr(leaf->ppn);
+    leaf->ppn = pageptr_to_pagenum(pp);
+    sfence_vma();
+    return old_pp;
+}
+
 // INTERNAL FUNCTION DEFINITIONS
 //
 
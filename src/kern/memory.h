@@ -43,6 +43,8 @@
 
 #define CREATE_PTE 1
 
+#define PTE_RSW_SHARED 1 // rsw field of a PTE that maps a shared page
+
 struct pte {
     uint64_t flags:8;
     uint64_t rsw:2;
@@ -86,7 +88,8 @@ extern uintptr_t memory_space_create(uint_fast16_t asid);
 // void memory_space_reclaim(uintptr_t mtag)
 // Switches the active memory space to the main memory space and reclaims the
 // memory space that was active on entry. All physical pages mapped by a user
-// mapping are reclaimed.
+// mapping are reclaimed, and so are the page tables of the memory space, root
+// included, unless it is the main memory space.
 
 extern void memory_space_reclaim(void);
 
@@ -175,6 +178,62 @@ extern int memory_validate_vptr_len (
 extern int memory_validate_vstr (
     const char * vs, uint_fast8_t ug_flags);
 
+// uintptr_t memory_vptr_to_pma (
+//     const void * vp, uint_fast8_t rwxug_flags)
+// Translates a virtual address in the active memory space to the physical
+// address it is mapped to. Returns 0 if the page containing /vp/ is not mapped
+// by a 4 kB leaf PTE with at least the specified flags. Unlike walk_pt, never
+// follows an invalid intermediate PTE.
+
+extern uintptr_t memory_vptr_to_pma (
+    const void * vp, uint_fast8_t rwxug_flags);
+
+// Shared pages. A shared page is reference counted: each mapping made with
+// memory_map_shared_page holds a reference, and so may other holders (such as
+// a shared memory segment) through memory_page_ref. The page is freed when the
+// last reference is dropped. Mappings of shared pages are marked with
+// PTE_RSW_SHARED, so that memory_space_reclaim and memory_unmap_and_free_user
+// drop their reference instead of freeing the page, and memory_space_clone
+// maps the same page in the child instead of copying it.
+
+// void * memory_alloc_shared_page(void)
+// Allocates a zeroed shared page with one reference, owned by the caller.
+
+extern void * memory_alloc_shared_page(void);
+
+// int memory_page_ref(void * pp)
+// void memory_page_unref(void * pp)
+// Add and drop a reference to the shared page /pp/. memory_page_ref returns
+// 0, or -ENOMEM if the page already has the maximum number of references.
+
+extern int memory_page_ref(void * pp);
+extern void memory_page_unref(void * pp);
+
+// int memory_map_shared_page(uintptr_t vma, void * pp, uint_fast8_t rwxug_flags)
+// Maps the shared page /pp/ at /vma/ in the active memory space with the
+// given flags, adding a reference for the mapping. Returns 0, -EBUSY if
+// something is already mapped at /vma/, or -ENOMEM if the page cannot take
+// another reference.
+
+extern int memory_map_shared_page (
+    uintptr_t vma, void * pp, uint_fast8_t rwxug_flags);
+
+// int memory_unmap_shared_page(uintptr_t vma)
+// Removes the mapping of a shared page at /vma/ in the active memory space and
+// drops its reference. Returns 0, or -EINVAL if /vma/ does not map a shared
+// page.
+
+extern int memory_unmap_shared_page(uintptr_t vma);
+
+// void * memory_swap_page(const void * vp, void * pp)
+// Replaces the physical page mapped at the page-aligned user address /vp/ of
+// the active memory space by the page /pp/, keeping the PTE flags, and returns
+// the page that was mapped there. Returns NULL and changes nothing if /vp/ is
+// not mapped by a writable 4 kB user page, or if the page is shared. Used to
+// hand over a page instead of copying it.
+
+extern void * memory_swap_page(const void * vp, void * pp);
+
 // Called from excp.c to handle a page fault at the specified address. Either
 // maps a page containing the faulting address, or calls process_exit().
 
@@ -0,0 +1,323 @@
+// pipe.c - Kernel pipes
+//
+// A pipe is a queue of up to PIPE_NPAGE physical pages. A write copies into
+// the page at the tail of the queue and starts a new page when that one is
+// full. A write of whole pages from a page-aligned buffer always starts on a
+// fresh page (if one is left), so that each of its pages is filled exactly.
+// When a full page reaches the head of the queue and the reader asks for at
+// least a page into a page-aligned buffer, the page itself is mapped into the
+// reader in place of its buffer page, and the reader's old page is freed. Big
+// aligned transfers thus cost one copy instead of two.
+//
+
+#ifdef PIPE_TRACE
+#define TRACE
+#endif
+
+#ifdef PIPE_DEBUG
+#define DEBUG
+#endif
+
+#include "pipe.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "console.h"
+#include "error.h"
+#include "heap.h"
+#include "intr.h"
+#include "limits.h"
+#include "memory.h"
+#include "string.h"
+#include "thread.h"
+
+// COMPILE-TIME PARAMETERS
+//
+
+// PIPE_NPAGE is the capacity of a pipe in pages
+
+#ifndef PIPE_NPAGE
+#define PIPE_NPAGE 16
+#endif
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// Data in a queued page runs from /off/ to /end/. Pages are freed (or handed
+// to the reader) as soon as they are read completely, so a queued page is
+// never empty.
+
+struct pipe_page {
+    char * data; // direct-mapped pointer to the page
+    uint32_t off; // next byte to read
+    uint32_t end; // one past the last byte written
+};
+
+struct pipe {
+    struct io_intf rd_io;
+    struct io_intf wr_io;
+    int8_t rd_open;
+    int8_t wr_open;
+
+    unsigned int head; // queue position of the page read next
+    unsigned int tail; // queue position one past the page written last
+    struct pipe_page pages[PIPE_NPAGE];
+
+    struct condition notempty;
+    struct condition notfull;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static void pipe_rd_close(struct io_intf * io);
+static void pipe_wr_close(struct io_intf * io);
+static long pipe_read(struct io_intf * io, void * buf, unsigned long bufsz);
+static long pipe_write(struct io_intf * io, const void * buf, unsigned long n);
+static int pipe_rd_poll(struct io_intf * io);
+static int pipe_wr_poll(struct io_intf * io);
+
+static int pipe_empty(const struct pipe * p);
+static int pipe_full(const struct pipe * p);
+static void pipe_free(struct pipe * p);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int pipe_open(struct io_intf ** rdioptr, struct io_intf ** wrioptr) {
+    static const struct io_ops rd_ops = {
+        .close = pipe_rd_close,
+        .read = pipe_read,
+        .poll = pipe_rd_poll
+    };
+
+    static const struct io_ops wr_ops = {
+        .close = pipe_wr_close,
+        .write = pipe_write,
+        .poll = pipe_wr_poll
+    };
+
+    struct pipe * p;
+
+    p = kcalloc(1, sizeof(struct pipe));
+
+    p->rd_io.ops = &rd_ops;
+    p->rd_io.refcnt = 1;
+    p->wr_io.ops = &wr_ops;
+    p->wr_io.refcnt = 1;
+    p->rd_open = 1;
+    p->wr_open = 1;
+
+    condition_init(&p->notempty, "pipe_notempty");
+    condition_init(&p->notfull, "pipe_notfull");
+
+    *rdioptr = &p->rd_io;
+    *wrioptr = &p->wr_io;
+    return 0;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+void pipe_rd_close(struct io_intf * io) {
+    struct pipe * const p = (void*)io - offsetof(struct pipe, rd_io);
+
+    if (__atomic_sub_fetch(&io->refcnt, 1, __ATOMIC_RELAXED) > 0)
+        return;
+
+    // Writers waiting for room now fail with -EPIPE
+
+    p->rd_open = 0;
+    condition_broadcast(&p->notfull);
+    iopoll_notify();
+
+    if (!p->wr_open)
+        pipe_free(p);
+}
+
+void pipe_wr_close(struct io_intf * io) {
+    struct pipe * const p = (void*)io - offsetof(struct pipe, wr_io);
+
+    if (__atomic_sub_fetch(&io->refcnt, 1, __ATOMIC_RELAXED) > 0)
+        return;
+
+    // Readers waiting for data now see the end of file
+
+    p->wr_open = 0;
+    condition_broadcast(&p->notempty);
+    iopoll_notify();
+
+    if (!p->rd_open)
+        pipe_free(p);
+}
+
+long pipe_read(struct io_intf * io, void * buf, unsigned long bufsz) {
+    struct pipe * const p = (void*)io - offsetof(struct pipe, rd_io);
+    char * const dst = buf;
+    struct pipe_page * pg;
+    unsigned long acc = 0;
+    unsigned long cnt;
+    void * old_pp;
+    int saved_intr_state;
+
+    trace("%s(buf=%p,bufsz=%ld)", __func__, buf, bufsz);
+
+    if (LONG_MAX < bufsz)
+        bufsz = LONG_MAX;
+
+    if (bufsz == 0)
+        return 0;
+
+    saved_intr_state = intr_disable();
+
+    while (pipe_empty(p)) {
+        if (!p->wr_open || (io->flags & O_NONBLOCK)) {
+            intr_restore(saved_intr_state);
+            return p->wr_open ? -EAGAIN : 0;
+        }
+        if (condition_wait_interruptible(&p->notempty) != 0) {
+            intr_restore(saved_intr_state);
+            return -EINTR;
+        }
+    }
+
+    intr_restore(saved_intr_state);
+
+    // Readers and writers of the same pipe take turns with the queue
+
+    preempt_disable();
+
+    while (!pipe_empty(p) && acc < bufsz) {
+        pg = &p->pages[p->head % PIPE_NPAGE];
+
+        if (pg->off == 0 && pg->end == PAGE_SIZE && PAGE_SIZE <= bufsz - acc &&
+            (old_pp = memory_swap_page(dst + acc, pg->data)) != NULL)
+        {
+            // the page now belongs to the reader
+            memory_free_page(old_pp);
+            pg->data = NULL;
+            pg->off = PAGE_SIZE;
+            acc += PAGE_SIZE;
+        } else {
+            cnt = pg->end - pg->off;
+            if (bufsz - acc < cnt)
+                cnt = bufsz - acc;
+            memcpy(dst + acc, pg->data + pg->off, cnt);
+            pg->off += cnt;
+            acc += cnt;
+        }
+
+        if (pg->off == pg->end) {
+            if (pg->data != NULL)
+                memory_free_page(pg->data);
+            p->head += 1;
+        }
+    }
+
+    preempt_enable();
+
+    condition_broadcast(&p->notfull);
+    iopoll_notify();
+    return acc;
+}
+
+long pipe_write(struct io_intf * io, const void * buf, unsigned long n) {
+    struct pipe * const p = (void*)io - offsetof(struct pipe, wr_io);
+    const char * const src = buf;
+    struct pipe_page * pg;
+    unsigned long acc = 0;
+    unsigned long cnt;
+    int saved_intr_state;
+    int whole;
+
+    trace("%s(n=%ld)", __func__, n);
+
+    if (LONG_MAX < n)
+        n = LONG_MAX;
+
+    while (acc < n) {
+        saved_intr_state = intr_disable();
+        while (p->rd_open && pipe_full(p)) {
+            if (io->flags & O_NONBLOCK) {
+                intr_restore(saved_intr_state);
+                return (acc == 0) ? -EAGAIN : acc;
+            }
+            if (condition_wait_interruptible(&p->notfull) != 0) {
+                intr_restore(saved_intr_state);
+                return (acc == 0) ? -EINTR : acc;
+            }
+        }
+        intr_restore(saved_intr_state);
+
+        if (!p->rd_open)
+            return (acc == 0) ? -EPIPE : acc;
+
+        preempt_disable();
+
+        while (acc < n && !pipe_full(p)) {
+            pg = (p->head == p->tail) ? NULL :
+                &p->pages[(p->tail - 1) % PIPE_NPAGE];
+
+            // A whole page from an aligned buffer goes to a page of its own
+            // if there is one left, so the reader can take it over.
+
+            whole = ((uintptr_t)(src + acc) % PAGE_SIZE == 0 &&
+                PAGE_SIZE <= n - acc && p->tail - p->head < PIPE_NPAGE);
+
+            if (pg == NULL || pg->end == PAGE_SIZE || (whole && pg->end != 0)) {
+                pg = &p->pages[p->tail % PIPE_NPAGE];
+                pg->data = memory_alloc_page();
+                pg->off = 0;
+                pg->end = 0;
+                p->tail += 1;
+            }
+
+            cnt = PAGE_SIZE - pg->end;
+            if (n - acc < cnt)
+                cnt = n - acc;
+            memcpy(pg->data + pg->end, src + acc, cnt);
+            pg->end += cnt;
+            acc += cnt;
+        }
+
+        preempt_enable();
+
+        condition_broadcast(&p->notempty);
+        iopoll_notify();
+    }
+
+    return acc;
+}
+
+int pipe_rd_poll(struct io_intf * io) {
+    struct pipe * const p = (void*)io - offsetof(struct pipe, rd_io);
+
+    // The end of file is readable, too
+    return (!pipe_empty(p) || !p->wr_open) ? POLLIN : 0;
+}
+
+int pipe_wr_poll(struct io_intf * io) {
+    struct pipe * const p = (void*)io - offsetof(struct pipe, wr_io);
+
+    // A write to a pipe without reader fails right away
+    return (!pipe_full(p) || !p->rd_open) ? POLLOUT : 0;
+}
+
+int pipe_empty(const struct pipe * p) {
+    return (p->head == p->tail);
+}
+
+int pipe_full(const struct pipe * p) {
+    return (p->tail - p->head == PIPE_NPAGE &&
+        p->pages[(p->tail - 1) % PIPE_NPAGE].end == PAGE_SIZE);
+}
+
+void pipe_free(struct pipe * p) {
+    while (!pipe_empty(p)) {
+        memory_free_page(p->pages[p->head % PIPE_NPAGE].data);
+        p->head += 1;
+    }
+
+    kfree(p);
+}
@@ -0,0 +1,22 @@
+// pipe.h - Kernel pipes
+//
+
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+#include "io.h"
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// int pipe_open(struct io_intf ** rdioptr, struct io_intf ** wrioptr)
+// Creates a pipe and returns its read end in /*rdioptr/ and its write end in
+// /*wrioptr/, each with one reference. Data written to the write end is read
+// from the read end in order. Reads return 0 once the pipe is empty and the
+// write end is closed; writes fail with -EPIPE once the read end is closed.
+// Both ends support poll and O_NONBLOCK. A blocked read or write returns
+// -EINTR if the process of the blocked thread starts to exit. Returns 0.
+
+extern int pipe_open(struct io_intf ** rdioptr, struct io_intf ** wrioptr);
+
+#endif // _PIPE_H_
@@ -81,6 +81,12 @@ extern void plic_close_irq(int irqno) {
     plic_complete_context_interrupt(1, irqno);
 }
 
+extern void plic_set_threshold(int level) {
+    // Hardwired context 1 (S mode on hart 0), as for claim and complete
+    trace("%s(level=%d)", __func__, level);
+    plic_set_context_threshold(1, level);
+}
+
 // INTERNAL FUNCTION DEFINITIONS
 //
 
@@ -17,4 +17,9 @@ extern void plic_disable_irq(int irqno);
 extern int plic_claim_irq(void);
 extern void plic_close_irq(int irqno);
 
+// Sets the priority threshold of our context. Only sources with a priority
+// strictly greater than the threshold can interrupt.
+
+extern void plic_set_threshold(int level);
+
 #endif
\ No newline at end of file
@@ -22,6 +22,13 @@
 // INTERNAL FUNCTION DECLARATIONS
 //
 
+struct fdtab; // process.h
+
+static int fdtab_resize(struct fdtab * tab, int size);
+static int fdtab_lowest_free(const struct fdtab * tab);
+static struct io_intf * fdtab_lookup(const struct fdtab * tab, int fd);
+static void spawn_drop_fds(struct io_intf ** ios, int n);
+
 // INTERNAL GLOBAL VARIABLES
 //
 
@@ -46,7 +53,10 @@ char procmgr_initialized = 0;
 //
 #include "process.h"
 #include "halt.h"
-#define ENOMEM 11
+#include "intr.h"
+#include "timer.h"
+#include "ioring.h"
+#include "ipc.h"
 
 /**
  * @brief: This function initialize the main user process
@@ -63,10 +73,11 @@ void procmgr_init(void){
     main_proc.tid = running_thread();
     main_proc.mtag = main_mtag;
     thread_set_process(running_thread(), &main_proc);
-    // Clean iotab
-    for (int i = 0; i < PROCESS_IOMAX; i++){
-        main_proc.iotab[i] = NULL;
-    }
+    // Start with no open descriptors
+    process_fd_init(&main_proc);
+    // The main thread is the only user thread for now
+    main_proc.nthr = 1;
+    condition_init(&main_proc.thr_exit, "main_proc.thr_exit");
     // TBD 1
     // update to 1 (this variable is used as flag here)
     procmgr_initialized = 1;
@@ -75,7 +86,8 @@ void procmgr_init(void){
 
 /**
  * @brief: This function takes I/O interface and the execute the program it refer to.
- * @param: exeio: the passed I/O interface
+ * @param: exeio: the passed I/O interface, whose reference is taken over and
+ *                dropped once loading is done or has failed
  * 
  * This function performs the following steps:
  * 1. Unmap virtual memory mapping to other user process
@@ -90,17 +102,32 @@ int process_exec(struct io_intf * exeio){
     if (!exeio){
         return -EINVAL;
     }
+    // Other threads would be left running on the discarded image
+    if (current_process()->nthr > 1){
+        ioclose(exeio);
+        return -EBUSY;
+    }
+    // The registered ring, if any, is in the image being discarded
+    ioring_release(current_process());
     // Then unmap virtual memory mapping of other user process
     memory_unmap_and_free_user();
+    // The new image starts on the top stack slot
+    current_process()->main_stack = 0;
+    // The vdata page went with the rest of the user mappings
+    process_vdata_init(current_process());
     
     // Initialize entry point
     void (*entry_point)(void) = NULL;
     // Run elf_load to update entry_point
     int elf_result = elf_load(exeio, &entry_point);
+    // The image is loaded (or not); the caller's reference is no longer needed
+    ioclose(exeio);
     // Check elf_result
     if (elf_result < 0) {       
         return elf_result;                    
     }
+    // The new image does not inherit close-on-exec descriptors
+    process_fd_close_all(current_process(), 1);
     // console_printf("Elf successfully loaded. Entry point: %p\n", entry_point);
 
     // This is the staring pt of user stack
@@ -128,8 +155,12 @@ int process_exec_for_test_use(struct io_intf * exeio, uint8_t rwxug_flags){
     if (!exeio){
         return -EINVAL;
     }
+    ioring_release(current_process());
     // Then unmap virtual memory mapping of other user process
     memory_unmap_and_free_user();
+    // The new image starts on the top stack slot
+    current_process()->main_stack = 0;
+    process_vdata_init(current_process());
     
     // Initialize entry point
     void (*entry_point)(void) = NULL;
@@ -139,6 +170,8 @@ int process_exec_for_test_use(struct io_intf * exeio, uint8_t rwxug_flags){
     if (elf_result < 0) {       
         return elf_result;                    
     }
+    // The new image does not inherit close-on-exec descriptors
+    process_fd_close_all(current_process(), 1);
     // console_printf("Elf successfully loaded. Entry point: %p\n", entry_point);
 
     // This is the staring pt of user stack
@@ -149,37 +182,595 @@ int process_exec_for_test_use(struct io_intf * exeio, uint8_t rwxug_flags){
     return -EINVAL;
 }
 
+/**
+ * @brief: This function creates a process from an executable
+ * @param: exeio: the executable, referenced by the caller for the duration
+ *         fdmap, nfd: parent descriptors to install as the child's 0..nfd-1
+ * 
+ * Unlike fork followed by exec, the child's memory space is built directly
+ * by elf_load, so nothing is copied from the parent only to be thrown away.
+ * While loading, the calling thread takes on the child process, so that its
+ * memory space stays active if the thread sleeps on I/O or is preempted.
+ * 
+ * @return: thread id of the child's main thread or error code
+ */
+int process_spawn(struct io_intf * exeio, const int * fdmap, int nfd){
+    struct process* cur_prog = current_process();
+    struct process* child;
+    struct io_intf * fdios[PROCESS_IOINIT];
+    void (*entry_point)(void) = NULL;
+    uintptr_t prev_mtag;
+    int elf_result;
+    int pid;
+
+    if (nfd < 0 || nfd > PROCESS_IOINIT){
+        return -EINVAL;
+    }
+    // Take the references now, so the objects outlive a concurrent close
+    // while elf_load sleeps
+    for (int i = 0; i < nfd; i++){
+        fdios[i] = NULL;
+        if (fdmap[i] >= 0){
+            fdios[i] = process_fd_get(cur_prog, fdmap[i]);
+            if (fdios[i] == NULL){
+                spawn_drop_fds(fdios, i);
+                return -EBADFD;
+            }
+        }
+    }
+
+    child = kmalloc(sizeof(struct process));
+    memset(child, 0, sizeof(struct process));
+
+    // claim a process table slot
+    preempt_disable();
+    for (pid = 0; pid < NPROC; pid++){
+        if (proctab[pid] == NULL){
+            proctab[pid] = child;
+            break;
+        }
+    }
+    preempt_enable();
+    if (pid == NPROC){
+        kfree(child);
+        spawn_drop_fds(fdios, nfd);
+        return -EBUSY;
+    }
+
+    child->id = pid;
+    child->nthr = 1;
+    condition_init(&child->thr_exit, "thr_exit");
+
+    // Build the child's memory space
+    thread_set_process(running_thread(), child);
+    prev_mtag = active_memory_space();
+    child->mtag = memory_space_create(0);
+    process_vdata_init(child);
+    elf_result = elf_load(exeio, &entry_point);
+    // no preemption while the active space and our process disagree
+    preempt_disable();
+    if (elf_result < 0){
+        memory_space_reclaim();
+    }
+    thread_set_process(running_thread(), cur_prog);
+    memory_space_switch(prev_mtag);
+    preempt_enable();
+
+    if (elf_result < 0){
+        proctab[pid] = NULL;
+        kfree(child);
+        spawn_drop_fds(fdios, nfd);
+        return elf_result;
+    }
+
+    // the child must not run before it knows its main thread and has its
+    // descriptors
+    preempt_disable();
+    child->tid = thread_spawn_process(child, thread_name(running_thread()),
+        process_thread_stack(0), (uintptr_t)entry_point);
+    if (child->tid >= 0){
+        // Install the inherited descriptors, handing over the references
+        process_fd_init(child);
+        for (int i = 0; i < nfd; i++){
+            if (fdios[i] != NULL){
+                process_fd_install(child, i, fdios[i]);
+            }
+        }
+    }
+    preempt_enable();
+
+    if (child->tid < 0){
+        // No thread slot: take the child's memory space down again
+        preempt_disable();
+        thread_set_process(running_thread(), child);
+        prev_mtag = memory_space_switch(child->mtag);
+        memory_space_reclaim();
+        thread_set_process(running_thread(), cur_prog);
+        memory_space_switch(prev_mtag);
+        preempt_enable();
+        proctab[pid] = NULL;
+        kfree(child);
+        spawn_drop_fds(fdios, nfd);
+        return -EBUSY;
+    }
+    return child->tid;
+}
+
 /**
  * @brief: This function clean up a finished process
+ * @param: status: exit status, reported to the parent through _wait
  * 
  * Relase following: 1. Process memory space
  * 2. Open I/O interfaces
  * 3. Associated kernel thread
+ * 4. Process table slot and struct process
  * 
- * @note: For process memory space, unmap the user space before calling switch function (TBD)
+ * The main thread's own stack and struct thread are freed when its parent
+ * joins it.
  */
-void process_exit(){
+void process_exit(int status){
     // First get current process
     struct process* cur_prog = current_process();
+    struct fdtab* tab;
+    int saved_intr_state;
     // checklist of release: process memory space, I/O interface, associated kernel thread
     if (!cur_prog){
         panic("No current process exist");
     }
 
-    // Release memory space
-    memory_space_reclaim();
+    // Only the main thread tears the process down. Any other thread just
+    // flags the exit and leaves; the main thread notices on its way back to
+    // U mode (process_check_exit).
+    // Interrupts are disabled around nthr updates and the wait below since
+    // the kernel is preemptible. The first exit decides the status.
+    saved_intr_state = intr_disable();
+    if (!cur_prog->exiting){
+        cur_prog->exit_status = status;
+        // Threads blocked for as long as it takes (a pipe, the console, a
+        // futex, an IPC call) give up their waits and leave
+        cur_prog->exiting = 1;
+        thread_interrupt_process(cur_prog);
+    }
+    if (running_thread() != cur_prog->tid){
+        cur_prog->nthr -= 1;
+        condition_broadcast(&cur_prog->thr_exit);
+        thread_exit();
+    }
+    intr_restore(saved_intr_state);
 
-    // Release I/O interfaces
-    for (int i = 0; i < NPROC; i++){
-        if (cur_prog->iotab[i]){
-            ioclose(cur_prog->iotab[i]);
-            cur_prog->iotab[i] = NULL;
-        }
+    // Fail the calls outstanding on our ports and wake their servers, some of
+    // which may be our own threads waiting for the next call
+    ipc_release(cur_prog);
+
+    // Wait for the other threads to leave at their next return to U mode,
+    // then recycle them
+    saved_intr_state = intr_disable();
+    while (cur_prog->nthr > 1){
+        condition_wait(&cur_prog->thr_exit);
     }
+    intr_restore(saved_intr_state);
+    // Let ring entries in flight finish before the memory they use goes away
+    ioring_release(cur_prog);
+    thread_reap_process(cur_prog);
+
+    // Release memory space, including the vdata page and the page tables.
+    // The thread outlives the process until its parent joins it, so it drops
+    // the process here too: being switched back in must not load the freed
+    // root table, and the thread must not be taken for one of a later process
+    // at the same address.
+    cur_prog->vdata = NULL;
+    preempt_disable();
+    memory_space_reclaim();
+    thread_set_process(running_thread(), NULL);
+    preempt_enable();
+
+    // Release I/O interfaces and the descriptor table
+    process_fd_close_all(cur_prog, 0);
+    tab = &cur_prog->fdtab;
+    kfree(tab->io);
+    kfree(tab->used);
+    kfree(tab->cloexec);
+    tab->size = 0;
+
+    thread_set_exit_status(cur_prog->exit_status);
+
     // mark it empty in the process table
     proctab[cur_prog->id] = NULL;
-    //kfree(cur_prog);
+    if (cur_prog != &main_proc){
+        kfree(cur_prog);
+    }
     
     // Exit the thread
     thread_exit();
-}
\ No newline at end of file
+}
+
+/**
+ * @brief: This function starts another thread in the current process
+ * @param: upc: user address the thread starts at
+ *         arg0, arg1: passed to the thread in a0 and a1
+ * 
+ * The new thread shares the memory space and iotab of the process and runs on
+ * its own user stack, which is demand-paged like the main stack.
+ * 
+ * @return: thread id of the new thread, or error code
+ */
+int process_thread_create(uintptr_t upc, uintptr_t arg0, uintptr_t arg1){
+    struct process* cur_prog = current_process();
+    int saved_intr_state;
+    int slot;
+    int tid;
+
+    if (upc < USER_START_VMA || USER_END_VMA <= upc){
+        return -EINVAL;
+    }
+    if (cur_prog->exiting){
+        return -EBUSY;
+    }
+
+    // No other thread of the process may run until the new thread's stack
+    // slot is recorded, or the slot could be taken twice, or freed by the new
+    // thread exiting before it is recorded
+    preempt_disable();
+    for (slot = 0; slot < USER_NSTACK; slot++){
+        if (slot != cur_prog->main_stack && cur_prog->stack_tid[slot] == 0){
+            break;
+        }
+    }
+    if (slot == USER_NSTACK){
+        preempt_enable();
+        return -EBUSY;
+    }
+
+    saved_intr_state = intr_disable();
+    cur_prog->nthr += 1;
+    intr_restore(saved_intr_state);
+
+    tid = thread_spawn_user(thread_name(running_thread()),
+        process_thread_stack(slot), upc, arg0, arg1);
+
+    saved_intr_state = intr_disable();
+    if (tid < 0){
+        cur_prog->nthr -= 1;
+        condition_broadcast(&cur_prog->thr_exit);
+    } else {
+        cur_prog->stack_tid[slot] = tid;
+    }
+    intr_restore(saved_intr_state);
+    preempt_enable();
+    return tid;
+}
+
+/**
+ * @brief: This function terminates the calling user thread
+ * 
+ * The main thread owns the process, so it exiting exits the whole process.
+ */
+void process_thread_exit(){
+    struct process* cur_prog = current_process();
+    int slot;
+
+    if (running_thread() == cur_prog->tid){
+        process_exit(0);
+    }
+
+    intr_disable();
+    slot = process_stack_slot(cur_prog, running_thread());
+    cur_prog->stack_tid[slot] = 0;
+    cur_prog->nthr -= 1;
+    condition_broadcast(&cur_prog->thr_exit);
+    thread_exit();
+}
+
+/**
+ * @brief: This function finds the user stack slot of a thread
+ * @param: proc: the process of the thread
+ *         tid: the thread
+ * 
+ * Threads created with process_thread_create are recorded in stack_tid; the
+ * main thread's slot is main_stack.
+ * 
+ * @return: the stack slot
+ */
+int process_stack_slot(struct process * proc, int tid){
+    if (tid == proc->tid){
+        return proc->main_stack;
+    }
+    for (int slot = 0; slot < USER_NSTACK; slot++){
+        if (slot != proc->main_stack && proc->stack_tid[slot] == tid){
+            return slot;
+        }
+    }
+    return proc->main_stack;
+}
+
+/**
+ * @brief: This function makes threads leave a process that is exiting
+ * 
+ * Called on every return to U mode, so a thread running user code leaves
+ * within one timer tick. A thread blocked in the kernel leaves once the
+ * blocking call returns.
+ */
+void process_check_exit(){
+    struct process* cur_prog = current_process();
+
+    if (cur_prog != NULL && cur_prog->exiting){
+        process_thread_exit();
+    }
+}
+
+/**
+ * @brief: This function maps and fills in the vdata page of a process
+ * @param: proc: the process whose memory space is active
+ * 
+ * The page is mapped R|U, so user code cannot write it; the kernel updates it
+ * through the direct mapping of the physical page.
+ */
+void process_vdata_init(struct process * proc){
+    struct vdata * vd;
+
+    memory_alloc_and_map_page(VDATA_VMA, PTE_R | PTE_U);
+    vd = (struct vdata *)memory_vptr_to_pma((void *)VDATA_VMA, PTE_R | PTE_U);
+    memset(vd, 0, PAGE_SIZE);
+
+    vd->pid = proc->id;
+    vd->tid = running_thread();
+    vd->timebase = TIMER_FREQ;
+    vd->boot_offset = timer_boot_wall_ns;
+    proc->vdata = vd;
+}
+
+/**
+ * @brief: This function gives a process an empty descriptor table
+ * @param: proc: the process
+ */
+void process_fd_init(struct process * proc){
+    memset(&proc->fdtab, 0, sizeof(proc->fdtab));
+    fdtab_resize(&proc->fdtab, PROCESS_IOINIT);
+}
+
+/**
+ * @brief: This function copies a descriptor table for fork
+ * @param: dst: the child, whose table is overwritten
+ *         src: the parent
+ * 
+ * Only the open descriptors are visited, a bitmap word at a time.
+ */
+void process_fd_copy(struct process * dst, const struct process * src){
+    const struct fdtab * stab = &src->fdtab;
+    struct fdtab * dtab = &dst->fdtab;
+    uint64_t bits;
+    int fd;
+
+    memset(dtab, 0, sizeof(*dtab));
+    fdtab_resize(dtab, stab->size);
+
+    for (int w = 0; w < stab->size / 64; w++){
+        dtab->used[w] = stab->used[w];
+        dtab->cloexec[w] = stab->cloexec[w];
+        for (bits = stab->used[w]; bits != 0; bits &= bits - 1){
+            fd = 64 * w + __builtin_ctzl(bits);
+            dtab->io[fd] = stab->io[fd];
+            ioref(dtab->io[fd]);
+        }
+    }
+}
+
+/**
+ * @brief: This function looks up a descriptor
+ * 
+ * The reference is taken with preemption disabled, so another thread closing
+ * the descriptor cannot free the object between the lookup and the ioref.
+ * 
+ * @return: a new reference to the object, or NULL
+ */
+struct io_intf * process_fd_get(const struct process * proc, int fd){
+    struct io_intf * io;
+
+    preempt_disable();
+    io = fdtab_lookup(&proc->fdtab, fd);
+    if (io != NULL){
+        ioref(io);
+    }
+    preempt_enable();
+    return io;
+}
+
+/**
+ * @brief: This function opens a descriptor on an I/O object
+ * @param: proc: the process
+ *         fd: the descriptor, or negative for the lowest free one
+ *         io: the object, whose reference the table takes over
+ * 
+ * The table is changed with preemption disabled, so threads of the process
+ * can open and close descriptors at the same time. A replaced object is
+ * closed afterwards, since closing may sleep.
+ * 
+ * @return: the descriptor or error code
+ */
+int process_fd_install(struct process * proc, int fd, struct io_intf * io){
+    struct fdtab * tab = &proc->fdtab;
+    struct io_intf * old_io = NULL;
+    int size;
+
+    if (fd >= PROCESS_IOMAX){
+        return -EBADFD;
+    }
+
+    preempt_disable();
+    if (fd < 0){
+        fd = fdtab_lowest_free(tab);
+    }
+    if (fd < 0 || fd >= tab->size){
+        size = tab->size;
+        while (size <= fd || (fd < 0 && size == tab->size)){
+            size *= 2;
+        }
+        if (size > PROCESS_IOMAX || fdtab_resize(tab, size) != 0){
+            preempt_enable();
+            return -EMFILE;
+        }
+        if (fd < 0){
+            fd = fdtab_lowest_free(tab);
+        }
+    }
+
+    old_io = tab->io[fd];
+    tab->io[fd] = io;
+    tab->used[fd / 64] |= 1UL << (fd % 64);
+    tab->cloexec[fd / 64] &= ~(1UL << (fd % 64));
+    preempt_enable();
+
+    if (old_io != NULL){
+        ioclose(old_io);
+    }
+    return fd;
+}
+
+int process_fd_close(struct process * proc, int fd){
+    struct fdtab * tab = &proc->fdtab;
+    struct io_intf * io;
+
+    preempt_disable();
+    io = fdtab_lookup(tab, fd);
+    if (io == NULL){
+        preempt_enable();
+        return -EBADFD;
+    }
+    tab->io[fd] = NULL;
+    tab->used[fd / 64] &= ~(1UL << (fd % 64));
+    tab->cloexec[fd / 64] &= ~(1UL << (fd % 64));
+    preempt_enable();
+
+    ioclose(io);
+    return 0;
+}
+
+int process_fd_getflags(const struct process * proc, int fd){
+    int flags;
+
+    preempt_disable();
+    if (fdtab_lookup(&proc->fdtab, fd) == NULL){
+        preempt_enable();
+        return -EBADFD;
+    }
+    flags = (proc->fdtab.cloexec[fd / 64] >> (fd % 64)) & 1 ? FD_CLOEXEC : 0;
+    preempt_enable();
+    return flags;
+}
+
+int process_fd_setflags(struct process * proc, int fd, int flags){
+    preempt_disable();
+    if (fdtab_lookup(&proc->fdtab, fd) == NULL){
+        preempt_enable();
+        return -EBADFD;
+    }
+    if (flags & FD_CLOEXEC){
+        proc->fdtab.cloexec[fd / 64] |= 1UL << (fd % 64);
+    } else {
+        proc->fdtab.cloexec[fd / 64] &= ~(1UL << (fd % 64));
+    }
+    preempt_enable();
+    return 0;
+}
+
+/**
+ * @brief: This function closes all (or all close-on-exec) descriptors
+ * @param: proc: the process
+ *         cloexec_only: only close descriptors flagged FD_CLOEXEC
+ * 
+ * Called by exit and exec, when no other thread uses the table.
+ */
+void process_fd_close_all(struct process * proc, int cloexec_only){
+    struct fdtab * tab = &proc->fdtab;
+    uint64_t bits;
+    int fd;
+
+    for (int w = 0; w < tab->size / 64; w++){
+        bits = cloexec_only ? tab->cloexec[w] : tab->used[w];
+        for (; bits != 0; bits &= bits - 1){
+            fd = 64 * w + __builtin_ctzl(bits);
+            process_fd_close(proc, fd);
+        }
+    }
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+/**
+ * @brief: This function grows a descriptor table to /size/ descriptors
+ * 
+ * The arrays are replaced by larger copies; /size/ must be a multiple of 64
+ * and not smaller than the current size.
+ * 
+ * @return: 0 or -ENOMEM
+ */
+static int fdtab_resize(struct fdtab * tab, int size){
+    struct io_intf ** io;
+    uint64_t * used;
+    uint64_t * cloexec;
+
+    io = kcalloc(size, sizeof(struct io_intf *));
+    used = kcalloc(size / 64, sizeof(uint64_t));
+    cloexec = kcalloc(size / 64, sizeof(uint64_t));
+    if (io == NULL || used == NULL || cloexec == NULL){
+        kfree(io);
+        kfree(used);
+        kfree(cloexec);
+        return -ENOMEM;
+    }
+
+    if (tab->size > 0){
+        memcpy(io, tab->io, tab->size * sizeof(struct io_intf *));
+        memcpy(used, tab->used, tab->size / 64 * sizeof(uint64_t));
+        memcpy(cloexec, tab->cloexec, tab->size / 64 * sizeof(uint64_t));
+        kfree(tab->io);
+        kfree(tab->used);
+        kfree(tab->cloexec);
+    }
+
+    tab->io = io;
+    tab->used = used;
+    tab->cloexec = cloexec;
+    tab->size = size;
+    return 0;
+}
+
+/**
+ * @brief: This function finds the lowest free descriptor
+ * @return: the descriptor, or -1 if the table is full
+ */
+static int fdtab_lowest_free(const struct fdtab * tab){
+    for (int w = 0; w < tab->size / 64; w++){
+        if (tab->used[w] != ~0UL){
+            return 64 * w + __builtin_ctzl(~tab->used[w]);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief: This function returns the object open on a descriptor
+ * 
+ * No reference is taken; the caller keeps the table from changing.
+ * 
+ * @return: the object, or NULL if /fd/ is not open or out of range
+ */
+static struct io_intf * fdtab_lookup(const struct fdtab * tab, int fd){
+    if (fd < 0 || fd >= tab->size){
+        return NULL;
+    }
+    return tab->io[fd];
+}
+
+/**
+ * @brief: This function drops the references process_spawn took for the
+ *         child's descriptors, when the spawn fails
+ */
+static void spawn_drop_fds(struct io_intf ** ios, int n){
+    for (int i = 0; i < n; i++){
+        if (ios[i] != NULL){
+            ioclose(ios[i]);
+        }
+    }
+}
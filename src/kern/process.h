@@ -4,8 +4,17 @@
 #ifndef _PROCESS_H_
 #define _PROCESS_H_
 
+// PROCESS_IOMAX is the maximum number of descriptors of a process, and
+// PROCESS_IOINIT the number its descriptor table starts out with. Both must be
+// multiples of 64, and the array of PROCESS_IOMAX pointers must fit in one
+// kmalloc block (a page).
+
 #ifndef PROCESS_IOMAX
-#define PROCESS_IOMAX 16
+#define PROCESS_IOMAX 512
+#endif
+
+#ifndef PROCESS_IOINIT
+#define PROCESS_IOINIT 64
 #endif
 
 #include "config.h"
@@ -20,15 +29,37 @@
 #include "string.h"
 #include "console.h"
 #include "elf.h"
+#include "vdata.h"
 
 // EXPORTED TYPE DEFINITIONS
 //
 
+struct ioring_ctx; // ioring.c
+
+// A descriptor table. The lowest free descriptor is found in the /used/ bitmap
+// a 64-bit word at a time. The table doubles in size when it is full, up to
+// PROCESS_IOMAX descriptors.
+
+struct fdtab {
+    struct io_intf ** io; // object open on each descriptor, NULL if closed
+    uint64_t * used; // bit fd is set if descriptor fd is open
+    uint64_t * cloexec; // bit fd is set if descriptor fd is closed by exec
+    int size; // number of descriptors, a multiple of 64
+};
+
 struct process {
     int id; // process id of this process
     int tid; // thread id of associated thread
     uintptr_t mtag; // memory space identifier
-    struct io_intf * iotab[PROCESS_IOMAX];
+    struct fdtab fdtab; // open descriptors
+    int nthr; // number of live user threads, including the main one
+    int exiting; // set once the process has started to exit
+    int exit_status; // status given to the exit that set /exiting/
+    struct condition thr_exit; // signalled when a user thread exits
+    struct vdata * vdata; // direct-mapped address of the page at VDATA_VMA
+    struct ioring_ctx * ioring; // registered system call ring, or NULL
+    int main_stack; // user stack slot of the main thread
+    int stack_tid[USER_NSTACK]; // thread on each other slot, 0 if free
 };
 
 // EXPORTED VARIABLES DECLARATIONS
@@ -44,7 +75,103 @@ extern void procmgr_init(void);
 extern int process_exec(struct io_intf * exeio);
 extern int process_exec_for_test_use(struct io_intf * exeio, uint8_t rwxug_flags);
 
-extern void __attribute__ ((noreturn)) process_exit(void);
+// int process_spawn(struct io_intf * exeio, const int * fdmap, int nfd)
+// Creates a new process running the executable /exeio/ in a fresh memory
+// space, without cloning the current one. Descriptor i of the child is
+// descriptor fdmap[i] of the caller, for i < nfd <= PROCESS_IOINIT; entries of
+// -1 and all descriptors from nfd on are left closed. Returns the thread id of the
+// child's main thread (for _wait), or a negative error code. The caller must
+// hold a reference to /exeio/ for the duration of the call. References to the
+// inherited objects are taken before loading starts and dropped on failure.
+
+extern int process_spawn(struct io_intf * exeio, const int * fdmap, int nfd);
+
+// void process_exit(int status)
+// Terminates the current process and frees everything it holds: its other
+// threads, its memory space (page tables included), its descriptors and its
+// process table slot. The main thread of the process exits last, with exit
+// status /status/, or the status of an exit already started by another thread
+// of the process. Its parent collects the status with thread_join.
+
+extern void __attribute__ ((noreturn)) process_exit(int status);
+
+// int process_thread_create(uintptr_t upc, uintptr_t arg0, uintptr_t arg1)
+// Starts a new user thread in the current process at /upc/, on a free user
+// stack slot of the process. Returns the thread id of the new thread, or
+// -EBUSY if the process is exiting or there is no free stack or thread slot.
+
+extern int process_thread_create(uintptr_t upc, uintptr_t arg0, uintptr_t arg1);
+
+// void process_thread_exit(void)
+// Terminates the calling user thread. If it is the main thread of the process,
+// this is the same as process_exit(0).
+
+extern void __attribute__ ((noreturn)) process_thread_exit(void);
+
+// int process_stack_slot(struct process * proc, int tid)
+// Returns the user stack slot of thread /tid/ of /proc/: the slot recorded for
+// it by process_thread_create, or else the main thread's.
+
+extern int process_stack_slot(struct process * proc, int tid);
+
+// void process_check_exit(void)
+// Called just before returning to U mode. If another thread of the current
+// process has started to exit the process, terminates the calling thread.
+
+extern void process_check_exit(void);
+
+// void process_vdata_init(struct process * proc)
+// Maps a new vdata page at VDATA_VMA in the active memory space, which must be
+// that of /proc/, and fills it in for the running thread.
+
+extern void process_vdata_init(struct process * proc);
+
+// void process_fd_init(struct process * proc)
+// Gives /proc/ an empty descriptor table with PROCESS_IOINIT descriptors.
+
+extern void process_fd_init(struct process * proc);
+
+// void process_fd_copy(struct process * dst, const struct process * src)
+// Gives /dst/ a copy of the descriptor table of /src/, with a new reference to
+// every open object and the same close-on-exec flags. Used by fork.
+
+extern void process_fd_copy(struct process * dst, const struct process * src);
+
+// struct io_intf * process_fd_get(const struct process * proc, int fd)
+// Returns a new reference to the object open on descriptor /fd/ of /proc/, or
+// NULL if /fd/ is not open (including if it is out of range). The caller drops
+// the reference with ioclose when done, so the object stays valid even if
+// another thread closes /fd/ meanwhile.
+
+extern struct io_intf * process_fd_get(const struct process * proc, int fd);
+
+// int process_fd_install(struct process * proc, int fd, struct io_intf * io)
+// Makes descriptor /fd/ of /proc/ refer to /io/, taking over the caller's
+// reference, and clears its close-on-exec flag. If /fd/ is negative, the
+// lowest free descriptor is used; otherwise whatever was open on /fd/ is
+// closed first. Returns the descriptor, -EMFILE if the table is full and
+// cannot grow, or -EBADFD if /fd/ is PROCESS_IOMAX or more.
+
+extern int process_fd_install(struct process * proc, int fd, struct io_intf * io);
+
+// int process_fd_close(struct process * proc, int fd)
+// Closes descriptor /fd/ of /proc/. Returns 0, or -EBADFD if it is not open.
+
+extern int process_fd_close(struct process * proc, int fd);
+
+// int process_fd_getflags(const struct process * proc, int fd)
+// int process_fd_setflags(struct process * proc, int fd, int flags)
+// Get and set the descriptor flags (FD_CLOEXEC) of descriptor /fd/. Return
+// the flags or 0, or -EBADFD if /fd/ is not open.
+
+extern int process_fd_getflags(const struct process * proc, int fd);
+extern int process_fd_setflags(struct process * proc, int fd, int flags);
+
+// void process_fd_close_all(struct process * proc, int cloexec_only)
+// Closes every descriptor of /proc/, or only those flagged close-on-exec if
+// /cloexec_only/ is non-zero.
+
+extern void process_fd_close_all(struct process * proc, int cloexec_only);
 
 extern int thread_fork_to_user (
     struct process * child_proc, const struct trap_frame * parent_tfr);
@@ -53,6 +180,9 @@ extern int thread_fork_to_user (
 
 static inline struct process * current_process(void);
 static inline int current_pid(void);
+static inline uintptr_t process_thread_stack(int slot);
+static inline int process_stack_guard(uintptr_t vma);
+static inline void process_vdata_set_tid(struct process * proc, int tid);
 
 // INLINE FUNCTION DEFINITIONS
 // 
@@ -65,4 +195,41 @@ static inline int current_pid(void) {
     return thread_process(running_thread())->id;
 }
 
+// Returns the initial user stack pointer of user stack slot /slot/. Slot 0
+// starts at USER_STACK_VMA and is the main thread's in a new process; each
+// slot below it is USER_THREAD_STACK_SIZE bytes plus a guard page lower.
+
+static inline uintptr_t process_thread_stack(int slot) {
+    return USER_STACK_VMA - slot * (USER_THREAD_STACK_SIZE + PAGE_SIZE);
+}
+
+// Returns 1 if /vma/ is in the guard page at the bottom of a user stack slot.
+// Guard pages are never mapped, so a thread that overruns its stack faults
+// instead of writing into the stack of another.
+
+static inline int process_stack_guard(uintptr_t vma) {
+    const uintptr_t slot_size = USER_THREAD_STACK_SIZE + PAGE_SIZE;
+
+    if (vma < USER_STACK_VMA - USER_NSTACK * slot_size || USER_STACK_VMA <= vma)
+        return 0;
+
+    return ((USER_STACK_VMA - 1 - vma) % slot_size >= USER_THREAD_STACK_SIZE);
+}
+
+// Records /tid/ as the running thread of /proc/ in its vdata page. Called on
+// every switch to a user thread, so a thread reading the page sees itself.
+
+static inline void process_vdata_set_tid(struct process * proc, int tid) {
+    struct vdata * const vd = proc->vdata;
+
+    if (vd == NULL || vd->tid == tid)
+        return;
+
+    vd->gen++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vd->tid = tid;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vd->gen++;
+}
+
 #endif // _PROCESS_H_
\ No newline at end of file
@@ -0,0 +1,189 @@
+// shm.c - Shared memory segments
+//
+// A segment holds one reference to each of its pages and each mapping holds
+// another (see memory_map_shared_page), so pages are freed by whichever of
+// shm_destroy, shm_unmap or address space teardown drops the last reference.
+// The segment table is only changed with preemption disabled, and mapping a
+// segment keeps preemption disabled too, so that it cannot be destroyed
+// halfway through.
+//
+
+#ifdef SHM_TRACE
+#define TRACE
+#endif
+
+#ifdef SHM_DEBUG
+#define DEBUG
+#endif
+
+#include "shm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "console.h"
+#include "error.h"
+#include "heap.h"
+#include "memory.h"
+#include "thread.h"
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+struct shm_seg {
+    int npage;
+    void * pages[]; // direct-mapped pointers to the pages
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static int shm_range_ok(const void * addr, int npage);
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static struct shm_seg * shmtab[NSHM];
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int shm_create(int npage) {
+    struct shm_seg * seg;
+    int id, i;
+
+    if (npage <= 0 || SHM_MAXPAGE < npage)
+        return -EINVAL;
+
+    seg = kmalloc(sizeof(struct shm_seg) + npage * sizeof(void *));
+    seg->npage = npage;
+    for (i = 0; i < npage; i++)
+        seg->pages[i] = memory_alloc_shared_page();
+
+    preempt_disable();
+    for (id = 0; id < NSHM; id++) {
+        if (shmtab[id] == NULL) {
+            shmtab[id] = seg;
+            break;
+        }
+    }
+    preempt_enable();
+
+    if (id == NSHM) {
+        for (i = 0; i < npage; i++)
+            memory_page_unref(seg->pages[i]);
+        kfree(seg);
+        return -EBUSY;
+    }
+
+    trace("%s(%d) = %d", __func__, npage, id);
+    return id;
+}
+
+int shm_map(int id, void * addr, int prot) {
+    const uintptr_t vma = (uintptr_t)addr;
+    uint_fast8_t rwxug_flags = PTE_U;
+    struct shm_seg * seg;
+    int result = 0;
+    int i;
+
+    if (id < 0 || NSHM <= id)
+        return -EINVAL;
+    if (prot == 0 || (prot & ~(SHM_READ | SHM_WRITE)) != 0)
+        return -EINVAL;
+
+    // Writable user pages must be readable too, as for ELF segments
+    if (prot & SHM_READ)
+        rwxug_flags |= PTE_R;
+    if (prot & SHM_WRITE)
+        rwxug_flags |= PTE_R | PTE_W;
+
+    preempt_disable();
+    seg = shmtab[id];
+
+    if (seg == NULL || !shm_range_ok(addr, seg->npage)) {
+        result = -EINVAL;
+    } else {
+        for (i = 0; i < seg->npage; i++) {
+            result = memory_map_shared_page (
+                vma + i * PAGE_SIZE, seg->pages[i], rwxug_flags);
+            if (result != 0)
+                break;
+        }
+
+        // Undo a partial mapping
+
+        if (result != 0) {
+            while (i-- > 0)
+                memory_unmap_shared_page(vma + i * PAGE_SIZE);
+        }
+    }
+
+    preempt_enable();
+    return result;
+}
+
+int shm_unmap(void * addr, int npage) {
+    const uintptr_t vma = (uintptr_t)addr;
+    uintptr_t pgvma;
+    int i;
+
+    if (npage <= 0 || !shm_range_ok(addr, npage))
+        return -EINVAL;
+
+    // Check the whole range first, so a bad range is left as it was
+
+    for (i = 0; i < npage; i++) {
+        pgvma = vma + i * PAGE_SIZE;
+        if (memory_vptr_to_pma((void *)pgvma, PTE_U) == 0)
+            return -EINVAL;
+        if (walk_pt(active_space_root(), pgvma, 0)->rsw != PTE_RSW_SHARED)
+            return -EINVAL;
+    }
+
+    for (i = 0; i < npage; i++) {
+        if (memory_unmap_shared_page(vma + i * PAGE_SIZE) != 0)
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+int shm_destroy(int id) {
+    struct shm_seg * seg;
+    int i;
+
+    if (id < 0 || NSHM <= id)
+        return -EINVAL;
+
+    preempt_disable();
+    seg = shmtab[id];
+    shmtab[id] = NULL;
+    preempt_enable();
+
+    if (seg == NULL)
+        return -EINVAL;
+
+    for (i = 0; i < seg->npage; i++)
+        memory_page_unref(seg->pages[i]);
+    kfree(seg);
+
+    trace("%s(%d)", __func__, id);
+    return 0;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Checks that /npage/ pages starting at /addr/ are page-aligned and within
+// the user range.
+
+static int shm_range_ok(const void * addr, int npage) {
+    const uintptr_t vma = (uintptr_t)addr;
+
+    return (vma % PAGE_SIZE == 0
+        && USER_START_VMA <= vma
+        && vma < USER_END_VMA
+        && (uintptr_t)npage <= (USER_END_VMA - vma) / PAGE_SIZE);
+}
@@ -0,0 +1,56 @@
+// shm.h - Shared memory segments (shared with user programs)
+//
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+// A shared memory segment is a run of zeroed physical pages, named by a small
+// integer id. Any process that knows the id can map the segment into its user
+// range with _shm_map, and every mapping of it sees the same pages. Mappings
+// stay shared across _fork. _shm_destroy frees the id; the pages themselves
+// live on until the last mapping is removed, with _shm_unmap or when the
+// process exits.
+
+// NSHM is the number of segments that can exist at once and SHM_MAXPAGE the
+// size limit of a segment in pages.
+
+#define NSHM 16
+#define SHM_MAXPAGE 64
+
+// Permissions of a mapping, passed to _shm_map
+
+#define SHM_READ    0x1
+#define SHM_WRITE   0x2
+
+// KERNEL INTERFACE
+//
+
+// int shm_create(int npage)
+// Creates a segment of /npage/ zeroed pages and returns its id. Fails with
+// -EINVAL if /npage/ is out of range and -EBUSY if all NSHM ids are in use.
+
+extern int shm_create(int npage);
+
+// int shm_map(int id, void * addr, int prot)
+// Maps the segment /id/ at the page-aligned user address /addr/ of the active
+// memory space, with the SHM_READ and SHM_WRITE permissions in /prot/. Fails
+// with -EINVAL for a bad id, address or permission, and with -EBUSY or
+// -ENOMEM, mapping nothing, if some page of the range is already mapped or
+// a page cannot take another reference.
+
+extern int shm_map(int id, void * addr, int prot);
+
+// int shm_unmap(void * addr, int npage)
+// Removes /npage/ pages of shared mappings starting at the page-aligned user
+// address /addr/ of the active memory space. Fails with -EINVAL, unmapping
+// nothing, if some page of the range is not a shared mapping.
+
+extern int shm_unmap(void * addr, int npage);
+
+// int shm_destroy(int id)
+// Frees the id of segment /id/. Pages still mapped somewhere stay in use
+// until their last mapping goes away. Fails with -EINVAL for a bad id.
+
+extern int shm_destroy(int id);
+
+#endif // _SHM_H_
@@ -8,6 +8,29 @@
         csrw    medeleg, t0
         li      t0, 0x222
         csrw    mideleg, t0
+
+        # Detect the Sstc extension by trying to set menvcfg.STCE (bit 63). If
+        # menvcfg does not exist, the access traps to 8: below. With Sstc, S
+        # mode programs stimecmp directly instead of asking M mode to program
+        # the CLINT (see timer.c). stimecmp starts at its maximum so no timer
+        # interrupt is pending until the timer is programmed.
+
+        la      t0, 8f
+        csrw    mtvec, t0
+        li      t1, 1
+        slli    t1, t1, 63
+        csrs    0x30a, t1       # menvcfg
+        csrr    t1, 0x30a
+        srli    t1, t1, 63
+        j       9f
+        .balign 4
+8:      li      t1, 0
+9:      la      t0, timer_sstc
+        sb      t1, (t0)
+        beqz    t1, 1f
+        li      t0, -1
+        csrw    0x14d, t0       # stimecmp
+1:
         csrs    mstatus, 4 # MIE
 
         # Give S mode access to the entire physical address space
@@ -16,7 +39,7 @@
         csrw    pmpaddr0, t0
         csrsi   pmpcfg0, 0xf
 
-        # Set trap handler address (defined in trapasm.s)
+        # Set trap handler address (defined in trapasm.S)
 
         la      t0, _mmode_trap_entry
         la      t1, _trap_entry_from_smode
@@ -72,5 +95,15 @@ _main_stack_anchor:
         .dword  main_thread
         .fill   8
 
+        # Set to 1 above if stimecmp is available (used by timer.c)
+
+        .section        .data
+        .global         timer_sstc
+        .type           timer_sstc, @object
+        .size           timer_sstc, 1
+
+timer_sstc:
+        .byte   0
+
         .end
         
\ No newline at end of file
@@ -13,24 +13,49 @@
 #include "memory.h"
 #include "thread.h"
 #include "timer.h"
+#include "futex.h"
+#include "stats.h"
 #include "trap.h"
+#include "syscall.h"
+#include "ioring.h"
+#include "pipe.h"
+#include "shm.h"
+#include "ipc.h"
+#include "limits.h"
 
 #ifndef NPROC
 #define NPROC 16
 #endif
 
+// POLL_MAX is the maximum number of descriptors in one poll call
+
+#ifndef POLL_MAX
+#define POLL_MAX 64
+#endif
+
+// Every handler in syscall_table takes the six argument registers as they
+// are (see syscall_fn) and converts them to the types it needs itself.
+
+#define SYSCALL_PARAMS \
+    uintptr_t a0, uintptr_t a1, uintptr_t a2, \
+    uintptr_t a3, uintptr_t a4, uintptr_t a5
+
 // Internal function definitions
 
-// Exits the currently running process.
+// Exits the currently running process with the given status.
 // call process_exit
-static int sysexit(void) {
-    process_exit();
+static long sysexit(SYSCALL_PARAMS) {
+    int status = (int)a0;
+
+    process_exit(status);
     return 0;
 }
 
 // Prints msg to the console. Check if the pointer passed by user program is valid
 // by calling memory_validate_vstr. 
-static int sysmsgout(const char *msg) {
+static long sysmsgout(SYSCALL_PARAMS) {
+    const char * msg = (const char *)a0;
+
     // validate string
     int result;
     result = memory_validate_vstr(msg, PTE_U);
@@ -42,97 +67,201 @@ static int sysmsgout(const char *msg) {
     return 0;
 }
 
+// Does nothing. Used to measure system call overhead.
+static long sysnop(SYSCALL_PARAMS) {
+    return 0;
+}
+
 // Opens a device at the specified file descriptor and returns error code on failure.
-// Add deviceio to iotab. 
-static int sysdevopen(int fd, const char *name, int instno) {
+// Add deviceio to the descriptor table. 
+static long sysdevopen(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const char * name = (const char *)a1;
+    int instno = (int)a2;
+
     struct process * curproc = current_process();
 
     // boundary checks
     if (curproc == NULL)
         return -ENOENT;
-    if (fd >= MAX_OPEN_FILE_CT)
+    if (fd >= PROCESS_IOMAX)
         return -ENOENT;
 
-    // fd < 0 require the next available file descriptor
-    if (fd < 0) {
-        for (fd = 0; fd < MAX_OPEN_FILE_CT; fd++) {
-            if (curproc->iotab[fd] != NULL)
-                break;
-        }
-        if (fd == MAX_OPEN_FILE_CT)
-            return -ENOENT;
-    }
+    struct io_intf * device_io;
 
-    struct io_intf * device_io = curproc->iotab[fd];
-
-    //open the device
+    //open the device; fd < 0 takes the lowest free descriptor
     int result = device_open(&device_io, name, instno);
-    curproc->iotab[fd] = device_io;
     if (result < 0)
         return -ENODEV;
 
-    return fd;
+    return process_fd_install(curproc, fd, device_io);
 }
 
 // Opens a file at the specified file descriptor and returns error code on failure.
-// Add fsio to iotab. 
-static int sysfsopen(int fd, const char *name) {
+// Add fsio to the descriptor table. 
+static long sysfsopen(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const char * name = (const char *)a1;
+
     struct process * curproc = current_process();
 
     // boundary checks    
     if (curproc == NULL)
         return -ENOENT;
-    if (fd >= MAX_OPEN_FILE_CT)
+    if (fd >= PROCESS_IOMAX)
         return -ENOENT;
 
-    // fd < 0 require the next available file descriptor
-    if (fd < 0) {
-        for (fd = 0; fd < MAX_OPEN_FILE_CT; fd++) {
-            if (curproc->iotab[fd] != NULL)
-                break;
-        }
-        if (fd == MAX_OPEN_FILE_CT)
-            return -ENOENT;
-    }
+    struct io_intf * file_io;
 
-    struct io_intf * file_io = curproc->iotab[fd];
-
-    // open the file
+    // open the file; fd < 0 takes the lowest free descriptor
     int result = fs_open(name, &file_io);
-    curproc->iotab[fd] = file_io;
     if (result < 0)
         return -ENOENT;
 
-    return fd;
+    return process_fd_install(curproc, fd, file_io);
 }
 
 // Closes the device at the specified file descriptor.
-// Set iotab to NULL. 
-static int sysclose(int fd) {
+// Frees the descriptor. 
+static long sysclose(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+
     struct process * curproc = current_process();
 
     // boundary checks
     if (curproc == NULL)
         return -ENOENT;
-    if (fd <0 || fd >= MAX_OPEN_FILE_CT)
+    if (fd <0 || fd >= PROCESS_IOMAX)
         return -ENOENT;
 
-    struct io_intf * io = curproc->iotab[fd];
-
     // close the io
-    if (io == NULL)
+    if (process_fd_close(curproc, fd) != 0)
         return -EIO;
 
-    io->ops->close(io);
-    curproc->iotab[fd] = NULL;
+    return 0;
+}
+
+// Creates a pipe and stores the descriptors of its read and write ends in
+// fds[0] and fds[1], using the two lowest free descriptors.
+
+static long syspipe(SYSCALL_PARAMS) {
+    int * fds = (int *)a0;
 
+    struct process * curproc = current_process();
+    struct io_intf * rdio;
+    struct io_intf * wrio;
+    int rdfd, wrfd;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (memory_validate_vptr_len(fds, 2 * sizeof(int), PTE_U | PTE_W) != 0)
+        return -EINVAL;
+
+    pipe_open(&rdio, &wrio);
+
+    rdfd = process_fd_install(curproc, -1, rdio);
+    if (rdfd < 0) {
+        ioclose(rdio);
+        ioclose(wrio);
+        return rdfd;
+    }
+
+    wrfd = process_fd_install(curproc, -1, wrio);
+    if (wrfd < 0) {
+        process_fd_close(curproc, rdfd);
+        ioclose(wrio);
+        return wrfd;
+    }
+
+    fds[0] = rdfd;
+    fds[1] = wrfd;
     return 0;
 }
 
+// Makes a new descriptor, the lowest free one, for the object open on fd.
+static long sysdup(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+
+    struct process * curproc = current_process();
+    struct io_intf * io;
+    int result;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+
+    // the lookup's reference becomes the new descriptor's
+    io = process_fd_get(curproc, fd);
+    if (io == NULL)
+        return -EBADFD;
+
+    result = process_fd_install(curproc, -1, io);
+    if (result < 0)
+        ioclose(io);
+    return result;
+}
+
+// Makes newfd refer to the object open on oldfd, closing whatever newfd had
+// open first. Returns newfd.
+static long sysdup2(SYSCALL_PARAMS) {
+    int oldfd = (int)a0;
+    int newfd = (int)a1;
+
+    struct process * curproc = current_process();
+    struct io_intf * io;
+    int result;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (newfd < 0)
+        return -EBADFD;
+
+    io = process_fd_get(curproc, oldfd);
+    if (io == NULL)
+        return -EBADFD;
+    if (oldfd == newfd) {
+        ioclose(io);
+        return newfd;
+    }
+
+    result = process_fd_install(curproc, newfd, io);
+    if (result < 0)
+        ioclose(io);
+    return result;
+}
+
+// Gets (F_GETFD) or sets (F_SETFD) the descriptor flags of fd.
+static long sysfcntl(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    int cmd = (int)a1;
+    int arg = (int)a2;
+
+    struct process * curproc = current_process();
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+
+    switch (cmd) {
+    case F_GETFD:
+        return process_fd_getflags(curproc, fd);
+    case F_SETFD:
+        return process_fd_setflags(curproc, fd, arg);
+    default:
+        return -ENOTSUP;
+    }
+}
+
 // Reads from the opened file descriptor and writes bufsz bytes into buf.
 // Check if the pointer passed by the user program is valid by calling
 // memory_validate_vptr_len. 
-static long sysread(int fd, void *buf, size_t bufsz) {
+static long sysread(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    void * buf = (void *)a1;
+    size_t bufsz = (size_t)a2;
+
     // validate buffer
     int validate_result;
     validate_result = memory_validate_vptr_len(buf, bufsz, PTE_U | PTE_W);
@@ -144,94 +273,520 @@ static long sysread(int fd, void *buf, size_t bufsz) {
     // boundary checks
     if (curproc == NULL)
         return -ENOENT;
-    if (fd <0 || fd >= MAX_OPEN_FILE_CT)
+    if (fd <0 || fd >= PROCESS_IOMAX)
         return -ENOENT;
 
-    struct io_intf * io = curproc->iotab[fd];
+    struct io_intf * io = process_fd_get(curproc, fd);
+    long result;
 
     // read the file
     if (io == NULL)
         return -EIO;
 
-    return ioread(io, buf, bufsz);
+    result = ioread(io, buf, bufsz);
+    ioclose(io);
+    return result;
 }
 
 // Reads bufsz bytes from buf and writes it to the opened file descriptor.
-static long syswrite(int fd, const void *buf, size_t len) {        
+static long syswrite(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const void * buf = (const void *)a1;
+    size_t len = (size_t)a2;
+
     struct process * curproc = current_process();
 
     // boundary checks
     if (curproc == NULL)
         return -ENOENT;
-    if (fd < 0 || fd >= MAX_OPEN_FILE_CT)
+    if (fd < 0 || fd >= PROCESS_IOMAX)
         return -ENOENT;
         
-    struct io_intf * io = curproc->iotab[fd];
+    struct io_intf * io = process_fd_get(curproc, fd);
+    long result;
 
     // write to the file
     if (io == NULL)
         return -EIO;
 
-    return iowrite(io, buf, len);
+    result = iowrite(io, buf, len);
+    ioclose(io);
+    return result;
 }
 
-// Performs desired ioctl based on cmd
-// If fd < 0, it should require the next available file descriptor
-static int sysioctl(int fd, int cmd, void *arg) {
+// Copies the I/O vector at uiov into kiov, so user threads cannot change it
+// after it has been checked, and checks every segment against flags in one
+// pass. Returns 0 or a negative error code.
+static int copy_iovec (
+    struct iovec * kiov, const struct iovec * uiov, int iovcnt,
+    uint_fast8_t flags)
+{
+    unsigned long total = 0;
+    int result;
+    int i;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+        return -EINVAL;
+    
+    result = memory_validate_vptr_len(uiov, iovcnt * sizeof(*uiov), PTE_U | PTE_R);
+    if (result != 0)
+        return result;
+
+    memcpy(kiov, uiov, iovcnt * sizeof(*uiov));
+
+    for (i = 0; i < iovcnt; i++) {
+        if (kiov[i].iov_len == 0)
+            continue;
+        if (kiov[i].iov_len > LONG_MAX - total)
+            return -EINVAL;
+        total += kiov[i].iov_len;
+        result = memory_validate_vptr_len(kiov[i].iov_base, kiov[i].iov_len, flags);
+        if (result != 0)
+            return result;
+    }
+
+    return 0;
+}
+
+// Reads from the opened file descriptor into the iovcnt buffers described by
+// iov, in order, as one read.
+static long sysreadv(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const struct iovec * iov = (const struct iovec *)a1;
+    int iovcnt = (int)a2;
+
+    struct process * curproc = current_process();
+    struct iovec kiov[IOV_MAX];
+    long result;
+
+    result = copy_iovec(kiov, iov, iovcnt, PTE_U | PTE_W);
+    if (result != 0)
+        return result;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (fd < 0 || fd >= PROCESS_IOMAX)
+        return -ENOENT;
+
+    struct io_intf * io = process_fd_get(curproc, fd);
+
+    if (io == NULL)
+        return -EIO;
+
+    result = ioreadv(io, kiov, iovcnt);
+    ioclose(io);
+    return result;
+}
+
+// Writes the iovcnt buffers described by iov, in order, to the opened file
+// descriptor as one write.
+static long syswritev(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const struct iovec * iov = (const struct iovec *)a1;
+    int iovcnt = (int)a2;
+
     struct process * curproc = current_process();
+    struct iovec kiov[IOV_MAX];
+    long result;
+
+    result = copy_iovec(kiov, iov, iovcnt, PTE_U | PTE_R);
+    if (result != 0)
+        return result;
 
     // boundary checks
     if (curproc == NULL)
         return -ENOENT;
-    if (fd >= MAX_OPEN_FILE_CT)
+    if (fd < 0 || fd >= PROCESS_IOMAX)
         return -ENOENT;
 
-    // fd < 0 require the next available file descriptor
-    if (fd < 0) {
-        for (fd = 0; fd < MAX_OPEN_FILE_CT; fd++) {
-            if (curproc->iotab[fd] != NULL)
+    struct io_intf * io = process_fd_get(curproc, fd);
+
+    if (io == NULL)
+        return -EIO;
+
+    result = iowritev(io, kiov, iovcnt);
+    ioclose(io);
+    return result;
+}
+
+// Reads up to bufsz bytes at offset pos of the opened file descriptor into
+// buf. The position shared by everything holding the file is not used or
+// changed, so a random access costs one system call instead of two.
+static long syspread(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    void * buf = (void *)a1;
+    size_t bufsz = (size_t)a2;
+    uint64_t pos = (uint64_t)a3;
+
+    int validate_result;
+    validate_result = memory_validate_vptr_len(buf, bufsz, PTE_U | PTE_W);
+    if (validate_result != 0)
+        return validate_result;
+
+    struct process * curproc = current_process();
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (fd < 0 || fd >= PROCESS_IOMAX)
+        return -ENOENT;
+
+    struct io_intf * io = process_fd_get(curproc, fd);
+    long result;
+
+    if (io == NULL)
+        return -EIO;
+
+    result = ioreadat(io, pos, buf, bufsz);
+    ioclose(io);
+    return result;
+}
+
+// Writes len bytes from buf at offset pos of the opened file descriptor,
+// without using or changing its position.
+static long syspwrite(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const void * buf = (const void *)a1;
+    size_t len = (size_t)a2;
+    uint64_t pos = (uint64_t)a3;
+
+    int validate_result;
+    validate_result = memory_validate_vptr_len(buf, len, PTE_U | PTE_R);
+    if (validate_result != 0)
+        return validate_result;
+
+    struct process * curproc = current_process();
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (fd < 0 || fd >= PROCESS_IOMAX)
+        return -ENOENT;
+
+    struct io_intf * io = process_fd_get(curproc, fd);
+    long result;
+
+    if (io == NULL)
+        return -EIO;
+
+    result = iowriteat(io, pos, buf, len);
+    ioclose(io);
+    return result;
+}
+
+// Copies up to count bytes from infd to outfd inside the kernel, a page at a
+// time, so the data never passes through (or is validated in) user memory. If
+// offset is not NULL, reads start at *offset, the position of infd is left
+// alone, and *offset is advanced by the number of bytes copied; otherwise
+// reads use and advance the position of infd. Returns the number of bytes
+// copied, which is short if either side reaches its end. Bytes read from infd
+// but not accepted by outfd are given back by seeking infd, when it can seek.
+static long syssendfile(SYSCALL_PARAMS) {
+    int outfd = (int)a0;
+    int infd = (int)a1;
+    uint64_t * offset = (uint64_t *)a2;
+    size_t count = (size_t)a3;
+
+    struct process * curproc = current_process();
+    struct io_intf * in, * out;
+    long cnt, wcnt, acc = 0;
+    uint64_t pos = 0, ipos = 0; // some objects fill only the low 32 bits
+    void * buf;
+    size_t n;
+
+    if (offset != NULL) {
+        if (memory_validate_vptr_len(offset, sizeof(*offset), PTE_U | PTE_R | PTE_W) != 0)
+            return -EINVAL;
+        pos = *offset;
+    }
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (infd < 0 || infd >= PROCESS_IOMAX || outfd < 0 || outfd >= PROCESS_IOMAX)
+        return -ENOENT;
+
+    in = process_fd_get(curproc, infd);
+    out = process_fd_get(curproc, outfd);
+
+    if (in == NULL || out == NULL) {
+        if (in != NULL)
+            ioclose(in);
+        if (out != NULL)
+            ioclose(out);
+        return -EIO;
+    }
+
+    if (count > LONG_MAX)
+        count = LONG_MAX;
+
+    buf = memory_alloc_page();
+
+    while ((size_t)acc < count) {
+        n = count - (size_t)acc;
+        if (n > PAGE_SIZE)
+            n = PAGE_SIZE;
+
+        if (offset != NULL)
+            cnt = ioreadat(in, pos + acc, buf, n);
+        else
+            cnt = ioread(in, buf, n);
+        
+        if (cnt <= 0) {
+            if (acc == 0)
+                acc = cnt;
+            break;
+        }
+
+        wcnt = iowrite(out, buf, cnt);
+
+        if (offset == NULL && wcnt < cnt &&
+            ioctl(in, IOCTL_GETPOS, &ipos) >= 0)
+            ioseek(in, ipos - (cnt - (wcnt < 0 ? 0 : wcnt)));
+
+        if (wcnt < 0) {
+            if (acc == 0)
+                acc = wcnt;
+            break;
+        }
+
+        acc += wcnt;
+        if (wcnt < cnt)
+            break;
+    }
+
+    memory_free_page(buf);
+    ioclose(in);
+    ioclose(out);
+
+    if (offset != NULL && acc > 0)
+        *offset = pos + acc;
+
+    return acc;
+}
+
+// Waits until at least one of the nfds descriptors in fds is ready for one of
+// the events it asks for, or until timeout_us microseconds have passed (no
+// limit if negative, no waiting if zero). Sets revents of every entry and
+// returns the number of entries with a non-zero revents, or 0 on timeout.
+// Returns -EINTR if the process starts to exit while waiting.
+
+static long syspoll(SYSCALL_PARAMS) {
+    struct pollfd * fds = (struct pollfd *)a0;
+    int nfds = (int)a1;
+    long timeout_us = (long)a2;
+
+    struct process * curproc = current_process();
+    struct io_intf * ios[POLL_MAX];
+    uint64_t deadline = 0;
+    uint64_t now;
+    int saved_intr_state;
+    int nready;
+    int i;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (nfds < 0 || nfds > POLL_MAX)
+        return -EINVAL;
+    if (nfds > 0 && memory_validate_vptr_len(fds,
+        nfds * sizeof(struct pollfd), PTE_U | PTE_R | PTE_W) != 0)
+    {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < nfds; i++) {
+        if (fds[i].fd < 0)
+            ios[i] = NULL;
+        else if ((ios[i] = process_fd_get(curproc, fds[i].fd)) == NULL) {
+            while (i-- > 0) {
+                if (ios[i] != NULL)
+                    ioclose(ios[i]);
+            }
+            return -EBADFD;
+        }
+    }
+
+    if (timeout_us > 0)
+        deadline = csrr_time() + timer_us_to_tcnt(timeout_us);
+
+    // Interrupts stay disabled from checking readiness to waiting, so a
+    // notification cannot slip in between.
+
+    saved_intr_state = intr_disable();
+
+    for (;;) {
+        nready = 0;
+        for (i = 0; i < nfds; i++) {
+            fds[i].revents = (ios[i] == NULL) ? 0 :
+                iopoll(ios[i]) & fds[i].events;
+            if (fds[i].revents != 0)
+                nready += 1;
+        }
+
+        if (nready > 0 || timeout_us == 0)
+            break;
+
+        if (timeout_us < 0) {
+            if (iopoll_wait(0) != 0) {
+                nready = -EINTR;
                 break;
+            }
+        } else {
+            now = csrr_time();
+            if (deadline <= now)
+                break;
+            if (iopoll_wait(deadline - now) == -EINTR) {
+                nready = -EINTR;
+                break;
+            }
         }
+    }
 
-        if (fd == MAX_OPEN_FILE_CT)
-            return -ENOENT;
+    intr_restore(saved_intr_state);
+
+    for (i = 0; i < nfds; i++) {
+        if (ios[i] != NULL)
+            ioclose(ios[i]);
     }
 
-    struct io_intf * io = curproc->iotab[fd];
+    return nready;
+}
+
+// Size of the object each ioctl command takes a pointer to, and whether the
+// command writes it. Commands with size 0 ignore their argument.
+static const struct {
+    uint8_t size;
+    uint8_t out;
+} ioctl_args[] = {
+    [IOCTL_GETLEN]      = { sizeof(uint64_t), 1 },
+    [IOCTL_SETLEN]      = { sizeof(uint64_t), 0 },
+    [IOCTL_GETPOS]      = { sizeof(uint64_t), 1 },
+    [IOCTL_SETPOS]      = { sizeof(uint64_t), 0 },
+    [IOCTL_FLUSH]       = { 0, 0 },
+    [IOCTL_GETBLKSZ]    = { sizeof(uint32_t), 1 },
+    [IOCTL_SETFL]       = { sizeof(int), 0 },
+    [IOCTL_SETPOLL]     = { sizeof(int), 0 },
+    [IOCTL_GETPOLLSTAT] = { sizeof(struct io_pollstat), 1 }
+};
+
+// Performs desired ioctl based on cmd. The argument is checked against the
+// size of the command and copied through a kernel local, so drivers never
+// dereference a user pointer. Unknown commands are refused.
+static long sysioctl(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    int cmd = (int)a1;
+    void * arg = (void *)a2;
+
+    struct process * curproc = current_process();
+    union {
+        uint64_t u64;
+        uint32_t u32;
+        int i;
+        struct io_pollstat pollstat;
+    } karg;
+    size_t size;
+    int result;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (fd < 0 || fd >= PROCESS_IOMAX)
+        return -ENOENT;
+    if (cmd <= 0 || cmd >= sizeof(ioctl_args) / sizeof(ioctl_args[0]))
+        return -ENOTSUP;
+
+    size = ioctl_args[cmd].size;
+    if (size != 0) {
+        result = memory_validate_vptr_len (arg, size,
+            PTE_U | PTE_R | (ioctl_args[cmd].out ? PTE_W : 0));
+        if (result != 0)
+            return result;
+    }
+
+    struct io_intf * io = process_fd_get(curproc, fd);
 
     // call ioctl
     if (io == NULL)
         return -EIO;
 
-    return ioctl(io, cmd, arg);
+    memset(&karg, 0, sizeof(karg));
+    if (size != 0)
+        memcpy(&karg, arg, size);
+    result = ioctl(io, cmd, (size != 0) ? &karg : NULL);
+    ioclose(io);
+    if (ioctl_args[cmd].out && result >= 0)
+        memcpy(arg, &karg, size);
+    return result;
 }
 
 // Halts currently running user program and starts new program based on opened file at file descriptor.
 // Return the value of process_exec. 
-static int sysexec(int fd) {
+static long sysexec(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+
     struct process * curproc = current_process();
 
     // boundary checks
     if (curproc == NULL)
         return -ENOENT;
-    if (fd < 0 || fd >= MAX_OPEN_FILE_CT)
+    if (fd < 0 || fd >= PROCESS_IOMAX)
         return -ENOENT;
 
-    struct io_intf * exeio = curproc->iotab[fd];
+    struct io_intf * exeio = process_fd_get(curproc, fd);
 
-    // call process_exec
+    // call process_exec, which takes over the reference
     if (exeio == NULL)
         return -EIO;
 
     return process_exec(exeio);
 }
 
+// Starts a new process running the executable open on /fd/, without cloning
+// the caller. Descriptor i of the child is a new reference to descriptor
+// fdmap[i] of the caller, for i < nfd; the rest start out closed. Returns the
+// tid of the child's main thread.
+
+static long sysspawn(SYSCALL_PARAMS) {
+    int fd = (int)a0;
+    const int * fdmap = (const int *)a1;
+    int nfd = (int)a2;
+
+    struct process * curproc = current_process();
+    int kfdmap[PROCESS_IOINIT];
+    struct io_intf * exeio;
+    int result;
+    int i;
+
+    // boundary checks
+    if (curproc == NULL)
+        return -ENOENT;
+    if (fd < 0 || fd >= PROCESS_IOMAX)
+        return -ENOENT;
+    if (nfd < 0 || nfd > PROCESS_IOINIT)
+        return -EINVAL;
+    if (nfd > 0 && memory_validate_vptr_len(fdmap, nfd * sizeof(int), PTE_U | PTE_R) != 0)
+        return -EINVAL;
+
+    for (i = 0; i < nfd; i++)
+        kfdmap[i] = fdmap[i];
+
+    exeio = process_fd_get(curproc, fd);
+    if (exeio == NULL)
+        return -EIO;
+
+    result = process_spawn(exeio, kfdmap, nfd);
+    ioclose(exeio);
+    return result;
+}
+
 /* 
  * @brief: creates a new child process from its parent
  * @specific: The fork system call duplicates the currently running process and creates a child process which starts at the
  * same point in the original or parent process. fork returns the pid of the child process to the parent process.
- * It returns 0 to the child process. It starts by allocating a new process and copying all the iotab pointers
- * from the parent to the child process.It also initializes all the reference counts.
+ * It returns 0 to the child process. It starts by allocating a new process and copying the open descriptors
+ * from the parent to the child process. It also updates the reference counts.
  * 
  * @param:
  * const struct trap_frame * tfr: parent's trap frame
@@ -244,6 +799,7 @@ static int sysfork(const struct trap_frame * tfr) {
 
     // add child process to proctab
     size_t child_proc_initialized = 0;
+    preempt_disable();
     for (size_t proc_idx = 0; proc_idx < NPROC; proc_idx++) {
         if (proctab[proc_idx] == NULL) {
             child_proc->id = proc_idx;
@@ -252,93 +808,291 @@ static int sysfork(const struct trap_frame * tfr) {
             break;
         }
     }
+    preempt_enable();
     if (child_proc_initialized == 0) {
-        panic("Too Many Process\n");
+        kfree(child_proc);
+        return -EBUSY;
     }
 
-    // clone the memory space
+    // clone the memory space, which also switches to it, and give the child
+    // its own vdata page (not covered by the clone)
     child_proc->mtag = memory_space_clone(0);
+    process_vdata_init(child_proc);
 
-    // update reference counts
-    for (size_t iotab_idx = 0; iotab_idx < PROCESS_IOMAX; iotab_idx++) {
-        child_proc->iotab[iotab_idx] = parent_proc->iotab[iotab_idx];
-        if (child_proc->iotab[iotab_idx] != NULL) {
-            child_proc->iotab[iotab_idx]->refcnt++;
-        }
-    }
+    // the child starts out with only the forking thread
+    child_proc->nthr = 1;
+    child_proc->exiting = 0;
+    child_proc->exit_status = 0;
+    child_proc->ioring = NULL;
+    condition_init(&child_proc->thr_exit, "thr_exit");
+
+    // the forking thread keeps its user stack slot as the child's main thread
+    child_proc->main_stack = process_stack_slot(parent_proc, running_thread());
+    memset(child_proc->stack_tid, 0, sizeof(child_proc->stack_tid));
+
+    // copy the open descriptors and update reference counts
+    process_fd_copy(child_proc, parent_proc);
 
     return thread_fork_to_user(child_proc, tfr);
 }
 
+// Starts a new thread in the current process. The thread begins at the user
+// trampoline start with arg in a0 and fn in a1; the trampoline calls fn(arg)
+// and then _thread_exit. Returns the thread id of the new thread.
+static long systhrcreate(SYSCALL_PARAMS) {
+    void (*fn)(void *) = (void (*)(void *))a0;
+    void * arg = (void *)a1;
+    uintptr_t start = a2;
+
+    if ((uintptr_t)fn < USER_START_VMA || USER_END_VMA <= (uintptr_t)fn)
+        return -EINVAL;
+
+    return process_thread_create(start, (uintptr_t)arg, (uintptr_t)fn);
+}
+
+// Exits the calling thread. Exiting the main thread exits the process.
+static long systhrexit(SYSCALL_PARAMS) {
+    process_thread_exit();
+    return 0;
+}
+
+// Waits for a thread created by the calling thread to exit.
+static long systhrjoin(SYSCALL_PARAMS) {
+    int tid = (int)a0;
+
+    if (tid <= 0)
+        return -EINVAL;
+
+    return thread_join(tid, NULL);
+}
+
 // Wait for certain child to exit before returning. 
-// If tid is the main thread, wait for any child of current
-// thread to exit.
-static int syswait(int tid) {
+// If tid is 0, wait for any child process of the current
+// thread to exit (-ECHILD if there is none). Stores the
+// child's exit status in status unless it is NULL.
+static long syswait(SYSCALL_PARAMS) {
+    int tid = (int)a0;
+    int * status = (int *)a1;
+
+    int kstatus;
+    int result;
 
     trace("%s(%d)", __func__, tid);
 
+    if (status != NULL && memory_validate_vptr_len(status, sizeof(int), PTE_U | PTE_W) != 0)
+        return -EINVAL;
+
     if (tid == 0)
-        return thread_join_any();
+        result = thread_join_any(&kstatus);
     else
-        return thread_join(tid);
+        result = thread_join(tid, &kstatus);
+
+    if (result > 0 && status != NULL)
+        *status = kstatus;
+    return result;
 }
 
 // Sleep for us number of microseconds
-// Using alarm from timer.c. 
-static int sysusleep(unsigned long us) {
-    struct alarm * al = kmalloc(sizeof(struct alarm));
+// Using the alarm embedded in the calling thread.
+static long sysusleep(SYSCALL_PARAMS) {
+    unsigned long us = (unsigned long)a0;
+
+    struct alarm * al = thread_sleep_alarm();
     alarm_init(al, "alarm_us");
     alarm_sleep_us(al, us);
     return 0;
 }
 
+// Copies the accounting counters of thread tid to the user buffer st.
+static long systhrstat(SYSCALL_PARAMS) {
+    int tid = (int)a0;
+    struct thread_stats * st = (struct thread_stats *)a1;
+
+    struct thread_stats kst;
+    int result;
+
+    result = memory_validate_vptr_len(st, sizeof(*st), PTE_U | PTE_W);
+    if (result != 0)
+        return result;
+
+    result = thread_get_stats(tid, &kst);
+    if (result != 0)
+        return result;
+
+    memcpy(st, &kst, sizeof(kst));
+    return 0;
+}
+
+// Copies the system-wide scheduler counters to the user buffer st.
+static long sysschedstat(SYSCALL_PARAMS) {
+    struct sched_stats * st = (struct sched_stats *)a0;
+
+    int result;
+
+    result = memory_validate_vptr_len(st, sizeof(*st), PTE_U | PTE_W);
+    if (result != 0)
+        return result;
+
+    thread_get_sched_stats(st);
+    return 0;
+}
+
+// Sleeps until woken by sysfutexwake if the user word at uaddr still holds val.
+// Returns -EAGAIN without sleeping if it does not. See futex.h.
+static long sysfutexwait(SYSCALL_PARAMS) {
+    volatile int * uaddr = (volatile int *)a0;
+    int val = (int)a1;
+
+    return futex_wait(uaddr, val);
+}
+
+// Wakes up to n threads sleeping on the user word at uaddr and returns how
+// many were woken.
+static long sysfutexwake(SYSCALL_PARAMS) {
+    volatile int * uaddr = (volatile int *)a0;
+    int n = (int)a1;
+
+    return futex_wake(uaddr, n);
+}
+
+// Registers a submission/completion ring in user memory (see ioring.h).
+static long sysioringsetup(SYSCALL_PARAMS) {
+    struct ioring * ring = (struct ioring *)a0;
+
+    return ioring_setup(ring);
+}
+
+// Submits the pending ring entries and waits for min_complete completions.
+// Returns the number of entries submitted.
+static long sysioringenter(SYSCALL_PARAMS) {
+    unsigned int min_complete = (unsigned int)a0;
+
+    return ioring_enter(min_complete);
+}
+
+// Creates a shared memory segment of npage pages and returns its id.
+static long sysshmcreate(SYSCALL_PARAMS) {
+    int npage = (int)a0;
 
-// Called from the usermode exception handler to handle all syscalls. Jumps to a system call based on
-// the specified system call number
+    return shm_create(npage);
+}
+
+// Maps shared memory segment id at addr with permissions prot (see shm.h).
+static long sysshmmap(SYSCALL_PARAMS) {
+    int id = (int)a0;
+    void * addr = (void *)a1;
+    int prot = (int)a2;
+
+    return shm_map(id, addr, prot);
+}
+
+// Unmaps npage pages of shared memory mappings starting at addr.
+static long sysshmunmap(SYSCALL_PARAMS) {
+    void * addr = (void *)a0;
+    int npage = (int)a1;
+
+    return shm_unmap(addr, npage);
+}
+
+// Frees the id of a shared memory segment; its mappings stay in place.
+static long sysshmdestroy(SYSCALL_PARAMS) {
+    int id = (int)a0;
+
+    return shm_destroy(id);
+}
+
+// Creates an IPC port and returns its id.
+static long sysipcport(SYSCALL_PARAMS) {
+    return ipc_port_create();
+}
+
+// Sends a message to an IPC port and waits for the reply (see ipc.h).
+static long sysipccall(SYSCALL_PARAMS) {
+    int port = (int)a0;
+    struct ipc_msg * msg = (struct ipc_msg *)a1;
+
+    return ipc_call(port, msg);
+}
+
+// Replies to call handle without waiting for another call.
+static long sysipcreply(SYSCALL_PARAMS) {
+    int port = (int)a0;
+    int handle = (int)a1;
+    struct ipc_msg * msg = (struct ipc_msg *)a2;
+
+    return ipc_reply(port, handle, msg);
+}
+
+// Replies to call handle, unless negative, and waits for the next call on
+// port. Returns the handle of the call received.
+static long sysipcreplyrecv(SYSCALL_PARAMS) {
+    int port = (int)a0;
+    int handle = (int)a1;
+    struct ipc_msg * msg = (struct ipc_msg *)a2;
+
+    return ipc_replyrecv(port, handle, msg);
+}
+
+
+// System call table (see syscall.h)
+
+const syscall_fn syscall_table[NSYSCALL] = {
+    [SYSCALL_EXIT] = sysexit,
+    [SYSCALL_MSGOUT] = sysmsgout,
+    [SYSCALL_NOP] = sysnop,
+    [SYSCALL_DEVOPEN] = sysdevopen,
+    [SYSCALL_FSOPEN] = sysfsopen,
+    [SYSCALL_PIPE] = syspipe,
+    [SYSCALL_DUP] = sysdup,
+    [SYSCALL_DUP2] = sysdup2,
+    [SYSCALL_FCNTL] = sysfcntl,
+    [SYSCALL_CLOSE] = sysclose,
+    [SYSCALL_READ] = sysread,
+    [SYSCALL_WRITE] = syswrite,
+    [SYSCALL_IOCTL] = sysioctl,
+    [SYSCALL_READV] = sysreadv,
+    [SYSCALL_WRITEV] = syswritev,
+    [SYSCALL_PREAD] = syspread,
+    [SYSCALL_PWRITE] = syspwrite,
+    [SYSCALL_SENDFILE] = syssendfile,
+    [SYSCALL_POLL] = syspoll,
+    [SYSCALL_EXEC] = sysexec,
+    [SYSCALL_SPAWN] = sysspawn,
+    [SYSCALL_THREAD_CREATE] = systhrcreate,
+    [SYSCALL_THREAD_EXIT] = systhrexit,
+    [SYSCALL_THREAD_JOIN] = systhrjoin,
+    [SYSCALL_USLEEP] = sysusleep,
+    [SYSCALL_WAIT] = syswait,
+    [SYSCALL_THRSTAT] = systhrstat,
+    [SYSCALL_SCHEDSTAT] = sysschedstat,
+    [SYSCALL_FUTEX_WAIT] = sysfutexwait,
+    [SYSCALL_FUTEX_WAKE] = sysfutexwake,
+    [SYSCALL_SHM_CREATE] = sysshmcreate,
+    [SYSCALL_SHM_MAP] = sysshmmap,
+    [SYSCALL_SHM_UNMAP] = sysshmunmap,
+    [SYSCALL_SHM_DESTROY] = sysshmdestroy,
+    [SYSCALL_IPC_PORT] = sysipcport,
+    [SYSCALL_IPC_CALL] = sysipccall,
+    [SYSCALL_IPC_REPLY] = sysipcreply,
+    [SYSCALL_IPC_REPLYRECV] = sysipcreplyrecv,
+    [SYSCALL_IORING_SETUP] = sysioringsetup,
+    [SYSCALL_IORING_ENTER] = sysioringenter
+};
+
+// Called from the usermode exception handler to handle system calls that do
+// not take the fast path in trapasm.S: fork and unknown system call numbers.
 void syscall_handler(struct trap_frame * tfr) {
+    const uintptr_t scnum = tfr->x[TFR_A7];
+
     // update sepc
     tfr->sepc += 4;
-    int scnum = tfr->x[TFR_A7];
 
-    switch (scnum) {
-        case SYSCALL_EXIT:
-            tfr->x[TFR_A0] = sysexit();
-            break;
-        case SYSCALL_MSGOUT:
-            tfr->x[TFR_A0] = sysmsgout((const char *) tfr->x[TFR_A0]);
-            break;
-        case SYSCALL_DEVOPEN:
-            tfr->x[TFR_A0] = sysdevopen(tfr->x[TFR_A0], (const char *) tfr->x[TFR_A1], tfr->x[TFR_A2]);
-            break;
-        case SYSCALL_FSOPEN:
-            tfr->x[TFR_A0] = sysfsopen(tfr->x[TFR_A0], (const char *) tfr->x[TFR_A1]);
-            break;
-        case SYSCALL_CLOSE:
-            tfr->x[TFR_A0] = sysclose(tfr->x[TFR_A0]);
-            break;
-        case SYSCALL_READ:
-            tfr->x[TFR_A0] = sysread(tfr->x[TFR_A0], (void *) tfr->x[TFR_A1], tfr->x[TFR_A2]);
-            break;
-        case SYSCALL_WRITE:
-            tfr->x[TFR_A0] = syswrite(tfr->x[TFR_A0], (const void *) tfr->x[TFR_A1], tfr->x[TFR_A2]);
-            break;
-        case SYSCALL_IOCTL:
-            tfr->x[TFR_A0] = sysioctl(tfr->x[TFR_A0], tfr->x[TFR_A1], (void *) tfr->x[TFR_A2]);
-            break;
-        case SYSCALL_EXEC:
-            tfr->x[TFR_A0] = sysexec(tfr->x[TFR_A0]);
-            break;
-        case SYSCALL_FORK:
-            tfr->x[TFR_A0] = sysfork(tfr);
-            break;
-        case SYSCALL_WAIT:
-            tfr->x[TFR_A0] = syswait(tfr->x[TFR_A0]);
-            break;
-        case SYSCALL_USLEEP:
-            tfr->x[TFR_A0] = sysusleep(tfr->x[TFR_A0]);
-            break;
-        default:
-            tfr->x[TFR_A0] = -1;
-            break;
-    }
+    if (scnum == SYSCALL_FORK)
+        tfr->x[TFR_A0] = sysfork(tfr);
+    else if (scnum < NSYSCALL && syscall_table[scnum] != NULL)
+        tfr->x[TFR_A0] = syscall_table[scnum] (
+            tfr->x[TFR_A0], tfr->x[TFR_A1], tfr->x[TFR_A2],
+            tfr->x[TFR_A3], tfr->x[TFR_A4], tfr->x[TFR_A5]);
+    else
+        tfr->x[TFR_A0] = -1;
 }
\ No newline at end of file
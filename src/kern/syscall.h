@@ -0,0 +1,25 @@
+// syscall.h - System call dispatch
+//
+
+#ifndef _SYSCALL_H_
+#define _SYSCALL_H_
+
+#define NSYSCALL 64 // also bounds the table in _syscall_fast_entry (trapasm.S)
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+// System call table, indexed by system call number. The fast system call path
+// in trapasm.S calls the entries directly with the arguments still in a0 - a5.
+// Every handler has exactly this type and narrows its arguments itself. Fork
+// is handled separately since it needs the full trap frame.
+
+typedef long (*syscall_fn) (
+    uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+
+extern const syscall_fn syscall_table[NSYSCALL];
+
+#endif // __ASSEMBLER__
+
+#endif // _SYSCALL_H_
@@ -96,6 +96,9 @@ _thread_setup:
         la      ra, thread_exit # child will return to thread_exit
         mv      a0, s0          # get arg argument to child from s0
         mv      a1, s1          # get arg argument to child from s0
+        mv      a2, s2          # remaining arguments from s2 - s4
+        mv      a3, s3          #
+        mv      a4, s4          #
         mv      fp, sp          # frame pointer = stack pointer
         jr      s11             # jump to child entry point (in s1)
 
@@ -110,12 +113,13 @@ _thread_setup:
 
 # void __attribute__ ((noreturn)) _thread_finish_jump (
 #      struct thread_stack_anchor * stack_anchor,
-#      uintptr_t usp, uintptr_t upc, ...);
+#      uintptr_t usp, uintptr_t upc, uintptr_t arg0, uintptr_t arg1);
 
 # @brief: This function completes the procesdure of changing to U mode
 # @arg: CURTHR->stack_base: stack base of current thread
 #       usp: user stack pointer
 #       upc: entry point of the process
+#       arg0, arg1: passed to the user code in a0 and a1
 # The work of switching to user mode continues here.
 # We update the sscratch.
 _thread_finish_jump:
@@ -129,6 +133,8 @@ _thread_finish_jump:
         la      a0, _trap_entry_from_umode      # Set stvec to _trap_entry_from_umode
         csrw    stvec, a0                       #
         mv      sp, a1       # update to user stack pointer
+        mv      a0, a3       # user arguments
+        mv      a1, a4       #
         sret    # return to U mode
 
 
@@ -198,6 +204,92 @@ set_child_frame:
 
         ret
 
+        .global _thread_fp_save
+        .type   _thread_fp_save, @function
+
+# void _thread_fp_save(struct thread_fp_context * ctx)
+# void _thread_fp_restore(const struct thread_fp_context * ctx)
+#
+# Save and restore f0 - f31 and fcsr. The caller must make sure sstatus.FS is
+# not Off.
+
+_thread_fp_save:
+        fsd     f0, 0*8(a0)
+        fsd     f1, 1*8(a0)
+        fsd     f2, 2*8(a0)
+        fsd     f3, 3*8(a0)
+        fsd     f4, 4*8(a0)
+        fsd     f5, 5*8(a0)
+        fsd     f6, 6*8(a0)
+        fsd     f7, 7*8(a0)
+        fsd     f8, 8*8(a0)
+        fsd     f9, 9*8(a0)
+        fsd     f10, 10*8(a0)
+        fsd     f11, 11*8(a0)
+        fsd     f12, 12*8(a0)
+        fsd     f13, 13*8(a0)
+        fsd     f14, 14*8(a0)
+        fsd     f15, 15*8(a0)
+        fsd     f16, 16*8(a0)
+        fsd     f17, 17*8(a0)
+        fsd     f18, 18*8(a0)
+        fsd     f19, 19*8(a0)
+        fsd     f20, 20*8(a0)
+        fsd     f21, 21*8(a0)
+        fsd     f22, 22*8(a0)
+        fsd     f23, 23*8(a0)
+        fsd     f24, 24*8(a0)
+        fsd     f25, 25*8(a0)
+        fsd     f26, 26*8(a0)
+        fsd     f27, 27*8(a0)
+        fsd     f28, 28*8(a0)
+        fsd     f29, 29*8(a0)
+        fsd     f30, 30*8(a0)
+        fsd     f31, 31*8(a0)
+        frcsr   t0
+        sd      t0, 32*8(a0)
+        ret
+
+        .global _thread_fp_restore
+        .type   _thread_fp_restore, @function
+
+_thread_fp_restore:
+        fld     f0, 0*8(a0)
+        fld     f1, 1*8(a0)
+        fld     f2, 2*8(a0)
+        fld     f3, 3*8(a0)
+        fld     f4, 4*8(a0)
+        fld     f5, 5*8(a0)
+        fld     f6, 6*8(a0)
+        fld     f7, 7*8(a0)
+        fld     f8, 8*8(a0)
+        fld     f9, 9*8(a0)
+        fld     f10, 10*8(a0)
+        fld     f11, 11*8(a0)
+        fld     f12, 12*8(a0)
+        fld     f13, 13*8(a0)
+        fld     f14, 14*8(a0)
+        fld     f15, 15*8(a0)
+        fld     f16, 16*8(a0)
+        fld     f17, 17*8(a0)
+        fld     f18, 18*8(a0)
+        fld     f19, 19*8(a0)
+        fld     f20, 20*8(a0)
+        fld     f21, 21*8(a0)
+        fld     f22, 22*8(a0)
+        fld     f23, 23*8(a0)
+        fld     f24, 24*8(a0)
+        fld     f25, 25*8(a0)
+        fld     f26, 26*8(a0)
+        fld     f27, 27*8(a0)
+        fld     f28, 28*8(a0)
+        fld     f29, 29*8(a0)
+        fld     f30, 30*8(a0)
+        fld     f31, 31*8(a0)
+        ld      t0, 32*8(a0)
+        fscsr   t0
+        ret
+
 # Statically allocated stack for the idle thread.
 
         .section        .data.stack, "wa", @progbits
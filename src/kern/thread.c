@@ -14,6 +14,9 @@
 #include "intr.h"
 #include "process.h"
 #include "memory.h"
+#include "error.h"
+#include "stats.h"
+#include "timer.h"
 
 // COMPILE-TIME PARAMETERS
 //
@@ -47,6 +50,13 @@ struct thread_context {
     void * sp;
 };
 
+// FP register save area, laid out for _thread_fp_save and _thread_fp_restore.
+
+struct thread_fp_context {
+    uint64_t f[32];
+    uint64_t fcsr;
+};
+
 struct thread {
     struct thread_context context; // must be first member (thrasm.s)
     const char * name;
@@ -59,6 +69,18 @@ struct thread {
     struct thread * list_next;
     struct condition * wait_cond;
     struct condition child_exit;
+    uint64_t tstamp; // time of last state change
+    uint64_t run_time;
+    uint64_t ready_time;
+    uint64_t nvolsw;
+    uint64_t ninvolsw;
+    int woken; // made ready from WAITING, not yet running
+    struct alarm sleep_alarm; // see thread_sleep_alarm
+    int timed_out; // set by condition_wait_expired
+    int interruptible; // see thread_interrupt_process
+    struct thread_fp_context fpctx; // valid unless thread is fp_owner
+    int preempt_count; // see preempt_disable
+    int exit_status; // see thread_set_exit_status
 };
 
 // INTERNAL GLOBAL VARIABLES
@@ -90,16 +112,31 @@ static struct thread * thrtab[NTHR] = {
 
 static struct thread_list ready_list;
 
+// FP registers are switched lazily. The FP registers hold the state of fp_owner
+// (or nothing useful if it is NULL). sstatus.FS is Off whenever the running
+// thread is not fp_owner, so its first FP instruction traps and
+// thread_fp_trap loads its state. The owner's registers are written back only
+// if they were modified, which is recorded in fp_dirty when FS is turned off.
+
+static struct thread * fp_owner;
+static char fp_dirty;
+
+// Histogram of wakeup-to-run latency (see struct sched_stats)
+
+static uint64_t sched_lathist[STATS_LATHIST_NBKT];
+
 // INTERNAL MACRO DEFINITIONS
 // 
 
 // Macro for changing thread state. If compiled for debugging (DEBUG is
-// defined), prints function that changed thread state.
+// defined), prints function that changed thread state. Also charges the time
+// since the last state change to the old state (see account_state_change).
 
 #define set_thread_state(t,s) do { \
     debug("Thread \"%s\" state changed from %s to %s in %s", \
         (t)->name, thread_state_name((t)->state), thread_state_name(s), \
         __func__); \
+    account_state_change((t), (s)); \
     (t)->state = (s); \
 } while (0)
 
@@ -128,9 +165,31 @@ static void set_running_thread(struct thread * thr);
 static const char * thread_state_name(enum thread_state state)
     __attribute__ ((unused));
 
+// struct thread * create_thread(const char * name)
+// Allocates a thread slot, a struct thread and a kernel stack for a new child
+// of the current thread in the current thread's process. The caller must set
+// up the thread context and put the thread on the ready list. Returns NULL if
+// there are no free thread slots.
+
+static struct thread * create_thread(const char * name);
+
+// Entry point of a thread created by thread_spawn_user. Runs in the new
+// thread's kernel stack and jumps to user mode at /upc/ with /arg0/ and /arg1/
+// in a0 and a1.
+
+static void user_thread_entry (
+    uintptr_t usp, uintptr_t upc, uintptr_t arg0, uintptr_t arg1);
+
+// Updates a thread's time accounting for a change from its current state to
+// /next/: adds the time spent RUNNING or READY to the thread's counters and
+// records wakeup-to-run latency when a woken thread starts running.
+
+static void account_state_change(struct thread * thr, enum thread_state next);
+
 // void recycle_thread(int tid)
 // Reclaims a thread's slot in thrtab and makes its parent the parent of its
-// children. Frees the struct thread of the thread.
+// children. Frees the struct thread of the thread, and its stack if that has
+// not been freed when the thread was switched out (see switch_to).
 
 static void recycle_thread(int tid);
 
@@ -144,6 +203,39 @@ static void recycle_thread(int tid);
 
 static void suspend_self(void);
 
+// void switch_to(struct thread * next_thread)
+// Does the work of suspend_self once the next thread has been chosen: marks
+// /next_thread/, which must be READY and on no list, running and switches to
+// it. Must be called with interrupts disabled; returns with interrupts
+// disabled when the current thread is next scheduled for execution.
+
+static void switch_to(struct thread * next_thread);
+
+// Alarm callback for condition_wait_timeout. Moves the thread owning the alarm
+// from the wait list of its condition to the ready-to-run list.
+
+static void condition_wait_expired(struct alarm * al);
+
+// Returns 1 if /thr/ belongs to a process that has started to exit.
+
+static int thread_exiting(const struct thread * thr);
+
+// Returns 1 if /thr/ is a child of the running thread in another process, that
+// is, the main thread of a process it forked or spawned. An exited main thread
+// has dropped its process, so it counts too. Threads created in the same
+// process are left for thread_join and the process's own exit.
+
+static int thread_child_process(const struct thread * thr);
+
+// Called in suspend_self before switching to /next/. Turns FP access off
+// unless /next/ owns the FP registers.
+
+static void fp_switch(struct thread * next);
+
+// Writes the FP registers back to fp_owner's save area if they were modified.
+
+static void fp_save_owner(void);
+
 // The following functions manipulate a thread list (struct thread_list). Note
 // that threads form a linked list via the list_next member of each thread
 // structure. Thread lists are used for the ready-to-run list (ready_list) and
@@ -156,6 +248,7 @@ static int tlempty(const struct thread_list * list);
 static void tlinsert(struct thread_list * list, struct thread * thr);
 static struct thread * tlremove(struct thread_list * list);
 static void tlappend(struct thread_list * l0, struct thread_list * l1);
+static void tldelete(struct thread_list * list, struct thread * thr);
 
 static void idle_thread_func(void * arg);
 
@@ -170,11 +263,14 @@ extern void _thread_setup (
 
 extern void __attribute__ ((noreturn)) _thread_finish_jump (
     const struct thread_stack_anchor * stack_anchor,
-    uintptr_t usp, uintptr_t upc, ...);
+    uintptr_t usp, uintptr_t upc, uintptr_t arg0, uintptr_t arg1);
 
 extern void _thread_finish_fork (
     struct thread * child, const struct trap_frame * parent_tfr);
 
+extern void _thread_fp_save(struct thread_fp_context * ctx);
+extern void _thread_fp_restore(const struct thread_fp_context * ctx);
+
 // EXPORTED FUNCTION DEFINITIONS
 //
 
@@ -186,57 +282,76 @@ void thread_init(void) {
     init_main_thread();
     init_idle_thread();
     set_running_thread(&main_thread);
+    csrc_sstatus(RISCV_SSTATUS_FS); // see fp_owner
     thrmgr_initialized = 1;
 }
 
-// This thread_spawn function should replace youre existing thread_spawn function in thread.c
-
 int thread_spawn(const char * name, void (*start)(void *), void * arg) {
-    struct thread_stack_anchor * stack_anchor;
-    void * stack_page;
     struct thread * child;
     int saved_intr_state;
-    int tid;
 
     trace("%s(name=\"%s\") in %s", __func__, name, CURTHR->name);
 
-    // Find a free thread slot.
+    child = create_thread(name);
+    if (child == NULL)
+        return -EBUSY;
+    _thread_setup(child, child->stack_base, start, arg);
 
-    tid = 0;
-    while (++tid < NTHR)
-        if (thrtab[tid] == NULL)
-            break;
-    
-    if (tid == NTHR)
-        panic("Too many threads");
+    saved_intr_state = intr_disable();
+    tlinsert(&ready_list, child);
+    intr_restore(saved_intr_state);
+    timer_quantum_start();
     
-    // Allocate a struct thread and a stack
+    return child->id;
+}
 
-    child = kmalloc(sizeof(struct thread));
+int thread_spawn_user(const char * name, uintptr_t usp,
+    uintptr_t upc, uintptr_t arg0, uintptr_t arg1)
+{
+    struct thread * child;
+    int saved_intr_state;
 
-    stack_page = memory_alloc_page();
-    stack_anchor = stack_page + PAGE_SIZE;
-    stack_anchor -= 1;
-    stack_anchor->thread = child;
-    stack_anchor->reserved = 0;
+    trace("%s(name=\"%s\",upc=%p) in %s",
+        __func__, name, (void*)upc, CURTHR->name);
 
-    thrtab[tid] = child;
+    assert (CURTHR->proc != NULL);
 
-    child->id = tid;
-    child->name = name;
-    child->parent = CURTHR;
-    child->proc = CURTHR->proc;
-    child->stack_base = stack_anchor;
-    child->stack_size = child->stack_base - stack_page;
-    set_thread_state(child, THREAD_READY);
+    child = create_thread(name);
+    if (child == NULL)
+        return -EBUSY;
+    _thread_setup(child, child->stack_base, (void (*)(void *))user_thread_entry,
+        usp, upc, arg0, arg1);
 
     saved_intr_state = intr_disable();
     tlinsert(&ready_list, child);
     intr_restore(saved_intr_state);
+    timer_quantum_start();
 
-    _thread_setup(child, child->stack_base, start, arg);
-    
-    return tid;
+    return child->id;
+}
+
+int thread_spawn_process(struct process * proc, const char * name,
+    uintptr_t usp, uintptr_t upc)
+{
+    struct thread * child;
+    int saved_intr_state;
+
+    trace("%s(name=\"%s\",upc=%p) in %s",
+        __func__, name, (void*)upc, CURTHR->name);
+
+    child = create_thread(name);
+    if (child == NULL)
+        return -EBUSY;
+    child->proc = proc;
+    _thread_setup(child, child->stack_base, (void (*)(void *))user_thread_entry,
+        usp, upc, 0, 0);
+
+    saved_intr_state = intr_disable();
+    tlinsert(&ready_list, child);
+    intr_restore(saved_intr_state);
+    timer_quantum_start();
+
+    return child->id;
 }
 
 void thread_exit(void) {
@@ -270,7 +385,7 @@ void thread_jump_to_user(uintptr_t usp, uintptr_t upc) {
     csrw_sepc(upc);
     csrs_sstatus(RISCV_SSTATUS_SPIE);
     csrc_sstatus(RISCV_SSTATUS_SPP);
-    _thread_finish_jump(CURTHR->stack_base, usp, upc);
+    _thread_finish_jump(CURTHR->stack_base, usp, upc, 0, 0);
 }
 
 /* 
@@ -291,6 +406,7 @@ int thread_fork_to_user(struct process *child_proc, const struct trap_frame *par
 
     struct thread * parent_thread = (struct thread *)parent_tfr->x[TFR_TP];
     struct thread * child_thread = kmalloc(sizeof(struct thread));
+    memset(child_thread, 0, sizeof(struct thread));
 
     // set up stack anchor
     stack_page = memory_alloc_page();
@@ -300,6 +416,7 @@ int thread_fork_to_user(struct process *child_proc, const struct trap_frame *par
     stack_anchor->reserved = 0;
 
     // add child thread to thread table
+    preempt_disable();
     for (size_t tid_idx = 0; tid_idx < NTHR; tid_idx++) {
         if (thrtab[tid_idx] == NULL) {
             child_proc->tid = tid_idx;
@@ -307,6 +424,7 @@ int thread_fork_to_user(struct process *child_proc, const struct trap_frame *par
             break;
         }
     }
+    preempt_enable();
 
     // set ip child thread
     child_thread->id = child_proc->tid;
@@ -316,12 +434,21 @@ int thread_fork_to_user(struct process *child_proc, const struct trap_frame *par
     child_thread->stack_base = stack_anchor;
     child_thread->stack_size = child_thread->stack_base - stack_page;
 
+    // child starts with a copy of the parent's FP state; the registers still
+    // belong to the parent, so the child must trap on its first FP use
+    saved_intr_state = intr_disable();
+    fp_save_owner();
+    child_thread->fpctx = parent_thread->fpctx;
+    csrc_sstatus(RISCV_SSTATUS_FS);
+    intr_restore(saved_intr_state);
+
     // switch to child thread and set it running
     saved_intr_state = intr_disable();
     tlinsert(&ready_list, parent_thread);
     set_thread_state(parent_thread, THREAD_READY);
     set_thread_state(child_thread, THREAD_RUNNING);
     intr_restore(saved_intr_state);
+    timer_quantum_start();
 
     // thread setup
     _thread_setup(child_thread, child_thread->stack_base, (void *)parent_tfr->x[TFR_S11], 
@@ -342,40 +469,52 @@ void thread_yield(void) {
     suspend_self();
 }
 
-int thread_join_any(void) {
+int thread_join_any(int * statusptr) {
+    int saved_intr_state;
     int childcnt = 0;
     int tid;
 
     trace("%s() in %s", __func__, CURTHR->name);
 
-    // See if there are any children of the current thread, and if they have
-    // already exited. If so, call thread_wait_one() to finish up.
+    // See if there are any child processes of the current thread, and if
+    // they have already exited. If so, call thread_join() to finish up.
+    // Interrupts stay disabled until we wait, so that a child cannot exit (on
+    // another thread preempting us) between the check and condition_wait.
+
+    saved_intr_state = intr_disable();
 
     for (tid = 1; tid < NTHR; tid++) {
-        if (thrtab[tid] != NULL && thrtab[tid]->parent == CURTHR) {
-            if (thrtab[tid]->state == THREAD_EXITED)
-                return thread_join(tid);
+        if (thrtab[tid] != NULL && thread_child_process(thrtab[tid])) {
+            if (thrtab[tid]->state == THREAD_EXITED) {
+                intr_restore(saved_intr_state);
+                return thread_join(tid, statusptr);
+            }
             childcnt++;
         }
     }
 
-    // If the current thread has no children, this is a bug. We could also
-    // return -EINVAL if we want to allow the calling thread to recover.
+    if (childcnt == 0) {
+        intr_restore(saved_intr_state);
+        return -ECHILD;
+    }
 
-    if (childcnt == 0)
-        panic("thread_wait called by childless thread");
-    
 
     // Wait for some child to exit. An exiting thread signals its parent's
     // child_exit condition.
 
-    condition_wait(&CURTHR->child_exit);
+    if (condition_wait_interruptible(&CURTHR->child_exit) != 0) {
+        intr_restore(saved_intr_state);
+        return -EINTR;
+    }
+    intr_restore(saved_intr_state);
 
     for (tid = 1; tid < NTHR; tid++) {
         if (thrtab[tid] != NULL &&
-            thrtab[tid]->parent == CURTHR &&
+            thread_child_process(thrtab[tid]) &&
             thrtab[tid]->state == THREAD_EXITED)
         {
+            if (statusptr != NULL)
+                *statusptr = thrtab[tid]->exit_status;
             recycle_thread(tid);
             return tid;
         }
@@ -386,14 +525,17 @@ int thread_join_any(void) {
 
 // Wait for specific child thread to exit. Returns the thread id of the child.
 
-int thread_join(int tid) {
-    struct thread * const child = thrtab[tid];
+int thread_join(int tid, int * statusptr) {
+    struct thread * child;
+    int saved_intr_state;
 
     trace("%s(tid=%d)", __func__, tid);
 
     if (tid <= 0 || NTHR <= tid)
         return -1;
 
+    child = thrtab[tid];
+
     trace("%s(tid=%d) in %s", __func__, tid, CURTHR->name);
 
     // Can only wait for child if we're the parent
@@ -404,14 +546,26 @@ int thread_join(int tid) {
     // Wait for child to exit. Whenever a child exits, it signals its parent's
     // child_exit condition.
 
-    while (child->state != THREAD_EXITED)
-        condition_wait(&CURTHR->child_exit);
+    saved_intr_state = intr_disable();
+    while (child->state != THREAD_EXITED) {
+        if (condition_wait_interruptible(&CURTHR->child_exit) != 0) {
+            intr_restore(saved_intr_state);
+            return -EINTR;
+        }
+    }
+    intr_restore(saved_intr_state);
     
+    if (statusptr != NULL)
+        *statusptr = child->exit_status;
     recycle_thread(tid);
 
     return tid;
 }
 
+void thread_set_exit_status(int status) {
+    CURTHR->exit_status = status;
+}
+
 struct process * thread_process(int tid) {
     assert (0 <= tid || tid < NTHR);
     assert (thrtab[tid] != NULL);
@@ -424,6 +578,162 @@ void thread_set_process(int tid, struct process * proc) {
     thrtab[tid]->proc = proc;
 }
 
+void thread_reap_process(struct process * proc) {
+    int tid;
+
+    trace("%s() in %s", __func__, CURTHR->name);
+
+    for (tid = 1; tid < NTHR; tid++) {
+        if (thrtab[tid] != NULL && thrtab[tid] != CURTHR &&
+            thrtab[tid]->proc == proc &&
+            thrtab[tid]->state == THREAD_EXITED)
+        {
+            recycle_thread(tid);
+        }
+    }
+}
+
+void thread_interrupt_process(struct process * proc) {
+    struct thread * thr;
+    int saved_intr_state;
+    int tid;
+
+    trace("%s() in %s", __func__, CURTHR->name);
+
+    saved_intr_state = intr_disable();
+
+    for (tid = 0; tid < NTHR; tid++) {
+        thr = thrtab[tid];
+        if (thr == NULL || thr == CURTHR || thr->proc != proc)
+            continue;
+        if (thr->state != THREAD_WAITING || !thr->interruptible)
+            continue;
+
+        tldelete(&thr->wait_cond->wait_list, thr);
+        thr->wait_cond = NULL;
+        set_thread_state(thr, THREAD_READY);
+        tlinsert(&ready_list, thr);
+    }
+
+    intr_restore(saved_intr_state);
+}
+
+int thread_get_stats(int tid, struct thread_stats * st) {
+    static const int state_map[] = {
+        [THREAD_STOPPED] = STATS_THREAD_STOPPED,
+        [THREAD_WAITING] = STATS_THREAD_WAITING,
+        [THREAD_RUNNING] = STATS_THREAD_RUNNING,
+        [THREAD_READY] = STATS_THREAD_READY,
+        [THREAD_EXITED] = STATS_THREAD_EXITED
+    };
+
+    struct thread * thr;
+    int saved_intr_state;
+    uint64_t elapsed;
+
+    if (tid < 0 || NTHR <= tid)
+        return -EINVAL;
+    
+    saved_intr_state = intr_disable();
+
+    thr = thrtab[tid];
+    if (thr == NULL) {
+        intr_restore(saved_intr_state);
+        return -ENOENT;
+    }
+
+    st->tid = tid;
+    st->pid = (thr->proc != NULL) ? thr->proc->id : -1;
+    st->state = state_map[thr->state];
+    strncpy(st->name, thr->name ? thr->name : "", STATS_NAMELEN);
+    st->name[STATS_NAMELEN-1] = '\0';
+    st->run_time = thr->run_time;
+    st->ready_time = thr->ready_time;
+    st->nvolsw = thr->nvolsw;
+    st->ninvolsw = thr->ninvolsw;
+
+    // Include the time in the current state up to now
+
+    elapsed = csrr_time() - thr->tstamp;
+    if (thr->state == THREAD_RUNNING)
+        st->run_time += elapsed;
+    else if (thr->state == THREAD_READY)
+        st->ready_time += elapsed;
+
+    intr_restore(saved_intr_state);
+    return 0;
+}
+
+void thread_get_sched_stats(struct sched_stats * st) {
+    int saved_intr_state;
+
+    saved_intr_state = intr_disable();
+    st->timebase = TIMER_FREQ;
+    st->now = csrr_time();
+    memcpy(st->lathist, sched_lathist, sizeof(sched_lathist));
+    intr_restore(saved_intr_state);
+}
+
+int thread_others_ready(void) {
+    const struct thread * thr;
+
+    for (thr = ready_list.head; thr != NULL; thr = thr->list_next)
+        if (thr != &idle_thread)
+            return 1;
+    
+    return 0;
+}
+
+int thread_fp_trap(void) {
+    int saved_intr_state;
+
+    // If FP access is on, the instruction is illegal for some other reason
+
+    if ((csrr_sstatus() & RISCV_SSTATUS_FS) != RISCV_SSTATUS_FS_OFF)
+        return 0;
+    
+    saved_intr_state = intr_disable();
+
+    if (fp_owner != CURTHR) {
+        fp_save_owner();
+        csrs_sstatus(RISCV_SSTATUS_FS_CLEAN);
+        _thread_fp_restore(&CURTHR->fpctx);
+        fp_owner = CURTHR;
+    }
+
+    csrc_sstatus(RISCV_SSTATUS_FS);
+    csrs_sstatus(fp_dirty ? RISCV_SSTATUS_FS_DIRTY : RISCV_SSTATUS_FS_CLEAN);
+    intr_restore(saved_intr_state);
+    return 1;
+}
+
+void preempt_disable(void) {
+    if (thrmgr_initialized)
+        CURTHR->preempt_count += 1;
+}
+
+void preempt_enable(void) {
+    if (thrmgr_initialized) {
+        assert (CURTHR->preempt_count > 0);
+        CURTHR->preempt_count -= 1;
+    }
+}
+
+int thread_preemptible(void) {
+    // A thread that is not RUNNING is in the middle of suspend_self (or of
+    // thread_fork_to_user) and must not be switched out again.
+
+    return (thrmgr_initialized &&
+        CURTHR != &idle_thread &&
+        CURTHR->state == THREAD_RUNNING &&
+        CURTHR->preempt_count == 0 &&
+        thread_others_ready());
+}
+
+struct alarm * thread_sleep_alarm(void) {
+    return &CURTHR->sleep_alarm;
+}
+
 const char * thread_name(int tid) {
     assert (0 <= tid || tid < NTHR);
     assert (thrtab[tid] != NULL);
@@ -455,6 +765,112 @@ void condition_wait(struct condition * cond) {
     suspend_self();
 }
 
+int condition_wait_interruptible(struct condition * cond) {
+    int saved_intr_state;
+    int result = 0;
+
+    // The exit flag is set and the waiters woken with interrupts disabled, so
+    // checking it with interrupts disabled up to the wait loses no wakeup.
+
+    saved_intr_state = intr_disable();
+
+    if (!thread_exiting(CURTHR)) {
+        CURTHR->interruptible = 1;
+        condition_wait(cond);
+        CURTHR->interruptible = 0;
+    }
+
+    if (thread_exiting(CURTHR))
+        result = -EINTR;
+
+    intr_restore(saved_intr_state);
+    return result;
+}
+
+int condition_wait_timeout(struct condition * cond, uint64_t tcnt) {
+    struct alarm * const al = &CURTHR->sleep_alarm;
+    int saved_intr_state;
+    int result;
+
+    // Interrupts stay disabled from arming the alarm until we are on the wait
+    // list, so the alarm cannot expire in between. If it is already due,
+    // alarm_start calls condition_wait_expired right away.
+
+    saved_intr_state = intr_disable();
+    CURTHR->timed_out = 0;
+    alarm_init(al, cond->name);
+    alarm_start(al, tcnt, condition_wait_expired);
+
+    if (!CURTHR->timed_out)
+        condition_wait(cond);
+    
+    alarm_cancel(al);
+    result = CURTHR->timed_out ? -ETIMEDOUT : 0;
+    intr_restore(saved_intr_state);
+
+    return result;
+}
+
+int condition_wait_timeout_interruptible (
+    struct condition * cond, uint64_t tcnt)
+{
+    int saved_intr_state;
+    int result = -EINTR;
+
+    saved_intr_state = intr_disable();
+
+    if (!thread_exiting(CURTHR)) {
+        CURTHR->interruptible = 1;
+        result = condition_wait_timeout(cond, tcnt);
+        CURTHR->interruptible = 0;
+    }
+
+    if (thread_exiting(CURTHR))
+        result = -EINTR;
+
+    intr_restore(saved_intr_state);
+    return result;
+}
+
+void condition_wait_handoff (
+    struct condition * cond, struct condition * target)
+{
+    struct thread * next_thread;
+    int saved_intr_state;
+
+    trace("%s(cond=<%s>,target=<%s>) in %s",
+        __func__, cond->name, target->name, CURTHR->name);
+
+    assert(CURTHR->state == THREAD_RUNNING);
+
+    saved_intr_state = intr_disable();
+
+    if (tlempty(&target->wait_list) || thread_exiting(CURTHR)) {
+        condition_broadcast(target);
+        condition_wait_interruptible(cond);
+        intr_restore(saved_intr_state);
+        return;
+    }
+
+    // Take the first waiter off /target/ and make it ready, but keep it off
+    // the ready-to-run list: we switch to it ourselves.
+
+    next_thread = tlremove(&target->wait_list);
+    assert (next_thread->state == THREAD_WAITING);
+    assert (next_thread->wait_cond == target);
+    set_thread_state(next_thread, THREAD_READY);
+    next_thread->wait_cond = NULL;
+
+    set_thread_state(CURTHR, THREAD_WAITING);
+    CURTHR->wait_cond = cond;
+    tlinsert(&cond->wait_list, CURTHR);
+
+    CURTHR->interruptible = 1;
+    switch_to(next_thread);
+    CURTHR->interruptible = 0;
+    intr_restore(saved_intr_state);
+}
+
 void condition_broadcast(struct condition * cond) {
     int saved_intr_state;
     struct thread * thr;
@@ -482,6 +898,12 @@ void condition_broadcast(struct condition * cond) {
     tlappend(&ready_list, &cond->wait_list);
     tlclear(&cond->wait_list);
 
+    // The woken threads need a time slice unless the CPU is idle, in which
+    // case the idle thread just switches to them.
+
+    if (CURTHR != &idle_thread)
+        timer_quantum_start();
+
     intr_restore(saved_intr_state);
 }
 
@@ -530,13 +952,105 @@ const char * thread_state_name(enum thread_state state) {
         return "UNDEFINED";
 };
 
+struct thread * create_thread(const char * name) {
+    struct thread_stack_anchor * stack_anchor;
+    void * stack_page;
+    struct thread * child;
+    int tid;
+
+    // Allocate a struct thread and a stack
+
+    child = kmalloc(sizeof(struct thread));
+    memset(child, 0, sizeof(struct thread));
+
+    // Find a free thread slot and claim it before anyone else can.
+
+    preempt_disable();
+
+    tid = 0;
+    while (++tid < NTHR)
+        if (thrtab[tid] == NULL)
+            break;
+    
+    if (tid == NTHR) {
+        preempt_enable();
+        kfree(child);
+        return NULL;
+    }
+
+    thrtab[tid] = child;
+    preempt_enable();
+
+    stack_page = memory_alloc_page();
+    stack_anchor = stack_page + PAGE_SIZE;
+    stack_anchor -= 1;
+    stack_anchor->thread = child;
+    stack_anchor->reserved = 0;
+
+    child->id = tid;
+    child->name = name;
+    child->parent = CURTHR;
+    child->proc = CURTHR->proc;
+    child->stack_base = stack_anchor;
+    child->stack_size = child->stack_base - stack_page;
+    set_thread_state(child, THREAD_READY);
+
+    return child;
+}
+
+void user_thread_entry (
+    uintptr_t usp, uintptr_t upc, uintptr_t arg0, uintptr_t arg1)
+{
+    intr_disable();
+    csrw_sepc(upc);
+    csrs_sstatus(RISCV_SSTATUS_SPIE);
+    csrc_sstatus(RISCV_SSTATUS_SPP);
+    _thread_finish_jump(CURTHR->stack_base, usp, upc, arg0, arg1);
+}
+
+void account_state_change(struct thread * thr, enum thread_state next) {
+    const uint64_t now = csrr_time();
+    const uint64_t elapsed = now - thr->tstamp;
+    int bkt;
+
+    switch (thr->state) {
+    case THREAD_RUNNING:
+        thr->run_time += elapsed;
+        break;
+    case THREAD_READY:
+        thr->ready_time += elapsed;
+
+        if (next == THREAD_RUNNING && thr->woken) {
+            bkt = (elapsed == 0) ? 0 : 63 - __builtin_clzl(elapsed);
+            if (STATS_LATHIST_NBKT <= bkt)
+                bkt = STATS_LATHIST_NBKT-1;
+            sched_lathist[bkt] += 1;
+            thr->woken = 0;
+        }
+        break;
+    case THREAD_WAITING:
+        thr->woken = (next == THREAD_READY);
+        break;
+    default:
+        break;
+    }
+
+    thr->tstamp = now;
+}
+
 void recycle_thread(int tid) {
     struct thread * const thr = thrtab[tid];
+    int saved_intr_state;
     int ctid;
 
     assert (0 < tid && tid < NTHR && thr != NULL);
     assert (thr->state == THREAD_EXITED);
 
+    // Callers run with interrupts enabled; keep other threads out of thrtab
+    // and fp_owner while they change
+
+    saved_intr_state = intr_disable();
+
     // Make our parent the parent of our children
 
     for (ctid = 1; ctid < NTHR; ctid++) {
@@ -544,14 +1058,24 @@ void recycle_thread(int tid) {
             thrtab[ctid]->parent = thr->parent;
     }
 
+    // A thread that exited into a thread starting for the first time was not
+    // cleaned up in switch_to
+
+    if (thr->stack_base != NULL) {
+        if (fp_owner == thr) {
+            fp_owner = NULL;
+            fp_dirty = 0;
+        }
+        memory_free_page(thr->stack_base - thr->stack_size);
+    }
+
     thrtab[tid] = NULL;
+    intr_restore(saved_intr_state);
     kfree(thr);
 }
 
 void suspend_self(void) {
-    struct thread * susp_thread; // suspending thread
     struct thread * next_thread; // resuming thread
-    struct thread * prev_thread; // previously thread
     int saved_intr_state;
 
     trace("%s() in %s", __func__, CURTHR->name);
@@ -561,13 +1085,18 @@ void suspend_self(void) {
 
     assert (!tlempty(&ready_list));
 
-    susp_thread = CURTHR;
-
-    // Get a READY thread from the ready list and mark it running
+    // Get a READY thread from the ready list and switch to it
 
     saved_intr_state = intr_disable();
-
     next_thread = tlremove(&ready_list);
+    switch_to(next_thread);
+    intr_restore(saved_intr_state);
+}
+
+void switch_to(struct thread * next_thread) {
+    struct thread * const susp_thread = CURTHR; // suspending thread
+    struct thread * prev_thread; // previously running thread
+
     assert(next_thread->state == THREAD_READY);
     set_thread_state(next_thread, THREAD_RUNNING);
     
@@ -575,14 +1104,19 @@ void suspend_self(void) {
     // in the back of the ready-to-run list.
 
     if (susp_thread->state == THREAD_RUNNING) {
+        susp_thread->ninvolsw += 1;
         set_thread_state(susp_thread, THREAD_READY);
         tlinsert(&ready_list, susp_thread);
-    }
+    } else
+        susp_thread->nvolsw += 1;
 
+    fp_switch(next_thread);
     intr_enable();
 
-    if (next_thread->proc != NULL)
+    if (next_thread->proc != NULL) {
         memory_space_switch(next_thread->proc->mtag);
+        process_vdata_set_tid(next_thread->proc, next_thread->id);
+    }
 
     trace("Thread <%s> calling _thread_swtch(<%s>)",
         CURTHR->name, next_thread->name);
@@ -592,12 +1126,78 @@ void suspend_self(void) {
     trace("_thread_swtch() returned in %s", CURTHR->name);
 
     if (prev_thread->state == THREAD_EXITED) {
-        memory_free_page(prev_thread->stack_base - PAGE_SIZE);
+        if (fp_owner == prev_thread) {
+            fp_owner = NULL;
+            fp_dirty = 0;
+        }
+        memory_free_page(prev_thread->stack_base - prev_thread->stack_size);
         prev_thread->stack_base = NULL;
         prev_thread->stack_size = 0;
     }
 
-    intr_restore(saved_intr_state);
+    intr_disable();
+}
+
+void fp_switch(struct thread * next) {
+    const uintptr_t fs = csrr_sstatus() & RISCV_SSTATUS_FS;
+
+    if (fs == RISCV_SSTATUS_FS_DIRTY)
+        fp_dirty = 1;
+    
+    csrc_sstatus(RISCV_SSTATUS_FS);
+
+    if (next == fp_owner)
+        csrs_sstatus(fp_dirty ? RISCV_SSTATUS_FS_DIRTY : RISCV_SSTATUS_FS_CLEAN);
+}
+
+void fp_save_owner(void) {
+    const uintptr_t fs = csrr_sstatus() & RISCV_SSTATUS_FS;
+
+    if (fs == RISCV_SSTATUS_FS_DIRTY)
+        fp_dirty = 1;
+    
+    if (fp_owner == NULL || !fp_dirty)
+        return;
+
+    // FS must be on to access the FP registers
+
+    if (fs == RISCV_SSTATUS_FS_OFF)
+        csrs_sstatus(RISCV_SSTATUS_FS_CLEAN);
+    
+    _thread_fp_save(&fp_owner->fpctx);
+    fp_dirty = 0;
+
+    csrc_sstatus(RISCV_SSTATUS_FS);
+    csrs_sstatus((fs == RISCV_SSTATUS_FS_OFF) ?
+        RISCV_SSTATUS_FS_OFF : RISCV_SSTATUS_FS_CLEAN);
+}
+
+void condition_wait_expired(struct alarm * al) {
+    struct thread * const thr =
+        (void*)al - offsetof(struct thread, sleep_alarm);
+    
+    thr->timed_out = 1;
+
+    // Not waiting yet (called from alarm_start) or already woken
+
+    if (thr->state != THREAD_WAITING || thr->wait_cond == NULL)
+        return;
+
+    tldelete(&thr->wait_cond->wait_list, thr);
+    thr->wait_cond = NULL;
+    set_thread_state(thr, THREAD_READY);
+    tlinsert(&ready_list, thr);
+
+    if (CURTHR != &idle_thread)
+        timer_quantum_start();
+}
+
+int thread_exiting(const struct thread * thr) {
+    return (thr->proc != NULL && thr->proc->exiting);
+}
+
+int thread_child_process(const struct thread * thr) {
+    return (thr->parent == CURTHR && thr->proc != CURTHR->proc);
 }
 
 void tlclear(struct thread_list * list) {
@@ -688,4 +1288,26 @@ void idle_thread_func(void * arg __attribute__ ((unused))) {
             asm ("wfi");
         intr_enable();
     }
-}
\ No newline at end of file
+}
+
+// Removes /thr/ from /list/, wherever it is in the list. Does nothing if /thr/
+// is not on the list.
+
+void tldelete(struct thread_list * list, struct thread * thr) {
+    struct thread * prev;
+
+    if (list->head == thr) {
+        tlremove(list);
+        return;
+    }
+
+    for (prev = list->head; prev != NULL; prev = prev->list_next) {
+        if (prev->list_next == thr) {
+            prev->list_next = thr->list_next;
+            if (list->tail == thr)
+                list->tail = prev;
+            thr->list_next = NULL;
+            return;
+        }
+    }
+}
@@ -8,6 +8,10 @@
 #include <stddef.h>
 
 struct thread; // forward decl.
+struct thread_stats; // stats.h
+struct sched_stats; // stats.h
+struct alarm; // timer.h
+struct process; // process.h
 
 struct thread_stack_anchor {
     struct thread * thread;
@@ -50,19 +54,58 @@ int running_thread(void);
 
 extern int thread_spawn(const char * name, void (*start)(void *), void * arg);
 
+// int thread_spawn_user (const char * name, uintptr_t usp,
+//     uintptr_t upc, uintptr_t arg0, uintptr_t arg1)
+// Creates a new thread in the current thread's process and memory space. The
+// new thread starts in U mode at /upc/ with stack pointer /usp/, with /arg0/
+// and /arg1/ in a0 and a1. The current thread becomes its parent. Returns the
+// thread id of the new thread, or -EBUSY if there is no free thread slot.
+
+extern int thread_spawn_user(const char * name, uintptr_t usp,
+    uintptr_t upc, uintptr_t arg0, uintptr_t arg1);
+
+// int thread_spawn_process (struct process * proc, const char * name,
+//     uintptr_t usp, uintptr_t upc)
+// Creates the first thread of a new process /proc/, whose memory space must
+// already be set up. The thread starts in U mode at /upc/ with stack pointer
+// /usp/. The current thread becomes its parent. Returns the thread id, or
+// -EBUSY if there is no free thread slot.
+
+extern int thread_spawn_process(struct process * proc, const char * name,
+    uintptr_t usp, uintptr_t upc);
+
 // void thread_yield(void)
 // Yields the CPU to another thread and returns when the current thread is next
 // scheduled to run.
 
 extern void thread_yield(void);
 
-// int thread_join_any(void) int thread_join(int tid) Waits for a child thread
-// of the current thread to exit. The thread_join_any function waits for any of
-// the current thread's children to exit, while thread_join waits for a specific
-// thread, given by /tid/, to exit.
+// int thread_others_ready(void)
+// Returns 1 if some thread other than the idle thread is waiting in the
+// ready-to-run list, 0 otherwise. Used by the timer to decide whether the
+// periodic scheduling tick is needed.
+
+extern int thread_others_ready(void);
+
+// int thread_join_any(int * statusptr) int thread_join(int tid, int * statusptr)
+// Waits for a child thread of the current thread to exit. The thread_join_any
+// function waits for any of the current thread's child processes, that is, the
+// main threads of processes it forked or spawned, and returns -ECHILD if there
+// are none; threads it created in its own process are joined by thread_join
+// only. The thread_join function waits for a specific thread, given by /tid/,
+// to exit. The child's exit status is stored in /*statusptr/ unless
+// /statusptr/ is NULL. The child is recycled, and its thread id returned. Both
+// return -EINTR if the process of the current thread starts to exit while
+// they wait.
 
-extern int thread_join_any(void);
-extern int thread_join(int tid);
+extern int thread_join_any(int * statusptr);
+extern int thread_join(int tid, int * statusptr);
+
+// void thread_set_exit_status(int status)
+// Sets the exit status of the running thread, reported to its parent by
+// thread_join. The status is 0 unless set.
+
+extern void thread_set_exit_status(int status);
 
 // void thread_exit(void)
 // Terminates the currently running thread and does not return.
@@ -82,6 +125,65 @@ extern struct process * thread_process(int tid);
 
 extern void thread_set_process(int tid, struct process * proc);
 
+// Recycles every exited thread that belongs to /proc/, regardless of which
+// thread created it. Called during process teardown once all other threads of
+// the process have exited.
+
+extern void thread_reap_process(struct process * proc);
+
+// void thread_interrupt_process(struct process * proc)
+// Wakes every thread of /proc/ other than the current one that is blocked in
+// condition_wait_interruptible or condition_wait_handoff, so that it can give
+// up its wait. Called once /proc/ is flagged as exiting.
+
+extern void thread_interrupt_process(struct process * proc);
+
+// int thread_get_stats(int tid, struct thread_stats * st)
+// Fills /st/ with the accounting counters of thread /tid/. Returns 0 on
+// success, -EINVAL if /tid/ is out of range, or -ENOENT if the slot is free.
+
+extern int thread_get_stats(int tid, struct thread_stats * st);
+
+// void thread_get_sched_stats(struct sched_stats * st)
+// Fills /st/ with system-wide scheduler counters.
+
+extern void thread_get_sched_stats(struct sched_stats * st);
+
+// int thread_fp_trap(void)
+// Called on an illegal instruction exception from U mode. If FP access is off
+// (see sstatus.FS), loads the running thread's FP state, turns FP access on
+// and returns 1 so the instruction is retried. Returns 0 otherwise.
+
+extern int thread_fp_trap(void);
+
+// void preempt_disable(void)
+// void preempt_enable(void)
+// The kernel may switch threads when an interrupt arrives in S mode, unless the
+// running thread's preemption count is non-zero. System calls taking the fast
+// path in trapasm.S and U mode page faults run with interrupts enabled. preempt_disable increments
+// the count and preempt_enable decrements it; calls nest. Use them around short
+// sections that touch shared state without holding a lock. Sections with
+// interrupts disabled are never preempted and need not use them. Paths that
+// may block hold a struct lock instead (kfs keeps flk for every access to its
+// open-file table). Tables written only during boot, before interrupts are
+// enabled, such as the device table, are read without either.
+
+extern void preempt_disable(void);
+extern void preempt_enable(void);
+
+// int thread_preemptible(void)
+// Returns 1 if the running thread may be switched out at the end of an
+// interrupt taken in S mode: its preemption count is zero, it is not the idle
+// thread, and some other thread is ready to run. Called from intr.c.
+
+extern int thread_preemptible(void);
+
+// struct alarm * thread_sleep_alarm(void)
+// Returns the alarm embedded in the running thread, for use by sleep system
+// calls so that they need not allocate one. The caller must alarm_init it.
+
+extern struct alarm * thread_sleep_alarm(void);
+
 // Returns the name of a thread.
 
 extern const char * thread_name(int tid);
@@ -104,6 +206,42 @@ extern void condition_init(struct condition * cond, const char * name);
 
 extern void condition_wait(struct condition * cond);
 
+// int condition_wait_interruptible(struct condition * cond)
+// Like condition_wait, but also returns if the process of the current thread
+// starts to exit (see thread_interrupt_process), or at once if it already
+// has. Returns -EINTR in that case and 0 otherwise. Used for waits that may
+// last forever, so that a blocked thread does not hold up its process's exit.
+
+extern int condition_wait_interruptible(struct condition * cond);
+
+// int condition_wait_timeout(struct condition * cond, uint64_t tcnt)
+// Like condition_wait, but gives up after /tcnt/ timer ticks. Returns 0 if the
+// condition was signalled or -ETIMEDOUT if the time ran out first. Uses the
+// alarm embedded in the calling thread (see thread_sleep_alarm).
+
+extern int condition_wait_timeout(struct condition * cond, uint64_t tcnt);
+
+// int condition_wait_timeout_interruptible (
+//     struct condition * cond, uint64_t tcnt)
+// Like condition_wait_timeout, but also interruptible as with
+// condition_wait_interruptible. Returns -EINTR, -ETIMEDOUT or 0.
+
+extern int condition_wait_timeout_interruptible (
+    struct condition * cond, uint64_t tcnt);
+
+// void condition_wait_handoff (
+//     struct condition * cond, struct condition * target)
+// Like condition_wait(cond), but if some thread is waiting on /target/, the
+// first such thread is woken and switched to directly, without going through
+// the ready-to-run list, so it runs on the rest of the current time slice. If
+// no thread is waiting on /target/, this is just condition_wait(cond). Used
+// for synchronous IPC, where the woken thread is the one the current thread
+// waits for. The wait is interruptible, as with condition_wait_interruptible,
+// so callers must check what they wait for again on return.
+
+extern void condition_wait_handoff (
+    struct condition * cond, struct condition * target);
+
 // void condition_broadcast(struct condition * cond)
 
 // Wakes up all threads waiting on a condition. This function may be called from
@@ -19,116 +19,194 @@
 
 #define TICK_PERIOD (TIMER_FREQ/TICK_FREQ)
 
+// Maximum number of armed alarms
+
+#ifndef NALARM
+#define NALARM 512
+#endif /* NALARM */
+
 
 
 // EXPORTED GLOBAL VARIABLE DEFINITIONS
 // 
 
 char timer_initialized = 0;
+uint64_t timer_boot_wall_ns;
 
 // INTERNVAL GLOBAL VARIABLE DEFINITIONS
 //
 
-static struct alarm * sleep_list;
+// Armed alarms are kept in a binary min-heap ordered by twake, so arming and
+// expiring an alarm take O(log n) time with interrupts disabled. Each alarm
+// records its position in the heap in heapidx (-1 if not armed).
+
+static struct alarm * alarm_heap[NALARM];
+static int alarm_cnt;
 static uint64_t next_tick;
 
+// The periodic tick only runs while there is another thread to switch to. With
+// nothing else ready, the timer is programmed for the earliest alarm only (or
+// not at all), so an idle or lone thread is left alone.
+
+static char tick_running;
+
+// Set by start.s if the Sstc extension is present. Then the timer is armed by
+// writing stimecmp from S mode; otherwise we ecall into M mode, which enables
+// the M mode timer interrupt for the CLINT mtimecmp (see trapasm.S).
+
+extern char timer_sstc;
+
 // INTERNAL FUNCTION DECLARATIONS
 //
 
 static void enable_mmode_timer_intr(void);
 
+// Sets the wake-up time of an alarm to /tcnt/ ticks after its last event.
+// Returns 0 if that time has already passed, 1 otherwise.
+
+static int alarm_advance(struct alarm * al, uint64_t tcnt);
+
+// Inserts an alarm into the alarm heap and reprograms the timer if it is the
+// new earliest alarm. Must be called with interrupts disabled.
+
+static void alarm_insert(struct alarm * al);
+
+// Removes the alarm at position /idx/ from the alarm heap. Must be called with
+// interrupts disabled.
+
+static void alarm_heap_remove(int idx);
+
+// Move the alarm at position /idx/ toward the root or toward the leaves until
+// the heap property is restored.
+
+static void alarm_heap_up(int idx);
+static void alarm_heap_down(int idx);
+
+// Programs the timer for the earlier of the next tick (if the tick is
+// running) and the earliest armed alarm. Must be called with interrupts
+// disabled.
+
+static void program_timer(void);
+
+// Arms the timer to interrupt when mtime reaches /deadline/.
+
+static void set_timer_deadline(uint64_t deadline);
+
 static inline uint64_t get_mtime(void);
 static inline void set_mtime(uint64_t val);
 static inline uint64_t get_mtcmp(void);
 static inline void set_mtcmp(uint64_t val);
+static inline uint64_t get_rtc_ns(void);
 
 // EXPORTED FUNCTION DEFINITIONS
 //
 
 void timer_init(void) {
+    timer_boot_wall_ns = get_rtc_ns();
     set_mtime(0);
-    set_mtcmp(TICK_PERIOD);
-    csrs_sie(RISCV_SIE_STIE);
-    enable_mmode_timer_intr();
+    next_tick = TICK_PERIOD;
+    tick_running = 1;
+    set_timer_deadline(next_tick);
 
     timer_initialized = 1;
 }
 
+void timer_quantum_start(void) {
+    int saved_intr_state;
+
+    if (!timer_initialized || tick_running)
+        return;
+    
+    saved_intr_state = intr_disable();
+    next_tick = get_mtime() + TICK_PERIOD;
+    tick_running = 1;
+    program_timer();
+    intr_restore(saved_intr_state);
+}
+
 void alarm_init(struct alarm * al, const char * name) {
     condition_init(&al->cond, name ? name : "alarm");
     al->twake = get_mtime();
-    al->next = NULL;
+    al->heapidx = -1;
+    al->fn = NULL;
+    al->period = 0;
 }
 
 void alarm_sleep(struct alarm * al, uint64_t tcnt) {
-    struct alarm * prev;
     int saved_intr_state;
-    uint64_t now;
-
-    now = get_mtime();
-
-    // If the tcnt is so large it wraps around, set it to UINT64_MAX
 
-    if (UINT64_MAX - al->twake < tcnt)
-        al->twake = UINT64_MAX;
-    else
-        al->twake += tcnt;
-    
     // If the wake-up time has already passed, return
 
-    if (al->twake < now)
+    if (!alarm_advance(al, tcnt))
         return;
     
     saved_intr_state = intr_disable();
 
-    if (sleep_list == NULL || al->twake <= sleep_list->twake) {
-        debug("[%lu] Inserting alarm %s at head of list", now, al->cond.name);
-        // Insert alarm at head of sleep list
-        al->next = sleep_list;
-        sleep_list = al;
-        // If current alarm occurs before next tick, update mtcmp
-
-        if (al->twake < next_tick) {
-            set_mtcmp(al->twake);
-            csrs_sie(RISCV_SIE_STIE);
-            enable_mmode_timer_intr();
-        }
+    al->fn = NULL;
+    al->period = 0;
+    alarm_insert(al);
 
+    // Note: condition_wait must be *inside* intr_disable/intr_restore block to
+    // prevent a race condition where an alarm is signalled before we call
+    // condition_wait.
 
-    } else {
-        // Insert current alarm in list in order of wake-up time. Ideally, we
-        // should not keep interrupts disabled while we iterate through the
-        // list. The right way would be to restore interrupt state, find the
-        // place on the list where we want to insert, the disable interrupts and
-        // re-check the insert point.
-
-        for (prev = sleep_list; prev->next != NULL; prev = prev->next) {
-            if (al->twake <= prev->next->twake) {
-                debug("[%lu] Inserting alarm %s after %s",
-                    now, al->cond.name, prev->cond.name);
-                al->next = prev->next;
-                prev->next = al;
-                break;
-            }
-        }
+    condition_wait(&al->cond);
 
-        // End of list, insert at tail
-        if (prev->next == NULL) {
-            debug("%[lu] Inserting alarm %s at tail", al->cond.name);
-            al->next = NULL;
-            prev->next = al;
-        }
+    intr_restore(saved_intr_state);
+}
+
+void alarm_start (
+    struct alarm * al, uint64_t tcnt, void (*fn)(struct alarm * al))
+{
+    int saved_intr_state;
+
+    alarm_cancel(al);
+
+    if (!alarm_advance(al, tcnt)) {
+        fn(al);
+        return;
     }
 
-    debug("[%lu] Next timer interrupt set for %lu ticks", now, get_mtcmp());
+    saved_intr_state = intr_disable();
+    al->fn = fn;
+    alarm_insert(al);
+    intr_restore(saved_intr_state);
+}
 
-    // Note: condition_wait must be *inside* intr_disable/intr_restore block to
-    // prevent a race condition where an alarm is signalled before we call
-    // condition_wait.
+void alarm_start_periodic (
+    struct alarm * al, uint64_t tcnt, void (*fn)(struct alarm * al))
+{
+    int saved_intr_state;
 
-    condition_wait(&al->cond);
+    assert (tcnt != 0);
+    alarm_cancel(al);
 
+    // Unlike alarm_start, the first expiry is always delivered from
+    // timer_intr_handler, even if it is already due.
+
+    saved_intr_state = intr_disable();
+    alarm_advance(al, tcnt);
+    al->fn = fn;
+    al->period = tcnt;
+    alarm_insert(al);
+    intr_restore(saved_intr_state);
+}
+
+int alarm_cancel(struct alarm * al) {
+    int saved_intr_state;
+    int armed;
+
+    saved_intr_state = intr_disable();
+    al->period = 0;
+    armed = (al->heapidx >= 0);
+    if (armed)
+        alarm_heap_remove(al->heapidx);
     intr_restore(saved_intr_state);
+
+    // If the canceled alarm was the earliest, the timer may fire early; the
+    // handler then finds nothing to do and reprograms it.
+
+    return armed;
 }
 
 // Resets the alarm so that the next sleep increment is relative to the time
@@ -141,8 +219,7 @@ void alarm_reset(struct alarm * al) {
 // timer_handle_interrupt() is dispatched from intr_handler in intr.c
 
 void timer_intr_handler(struct trap_frame * tfr) {
-    struct alarm * head = sleep_list;
-    struct alarm * next;
+    struct alarm * head;
     uint64_t now;
 
     now = get_mtime();
@@ -150,32 +227,155 @@ void timer_intr_handler(struct trap_frame * tfr) {
     trace("[%lu] %s()", now, __func__);
     debug("[%lu] mtcmp = %lu", now, get_mtcmp());
 
-    while (head != NULL && head->twake <= now) {
-        debug("[%lu] Broadcasting alarm for %s", now, head->cond.name);
-        condition_broadcast(&head->cond);
-        next = head->next;
-        head->next = NULL;
-        head = next;
+    // Remove each expired alarm before firing it, since a callback may re-arm
+    // its alarm (or another one) and insert it into the heap.
+
+    while (alarm_cnt != 0 && alarm_heap[0]->twake <= now) {
+        head = alarm_heap[0];
+        alarm_heap_remove(0);
+
+        if (head->fn != NULL) {
+            debug("[%lu] Calling alarm callback for %s", now, head->cond.name);
+            head->fn(head);
+
+            // Re-arm a periodic alarm unless the callback canceled or
+            // re-armed it.
+
+            if (head->period != 0 && head->heapidx < 0) {
+                if (!alarm_advance(head, head->period))
+                    head->twake = now + head->period;
+                alarm_insert(head);
+            }
+        } else {
+            debug("[%lu] Broadcasting alarm for %s", now, head->cond.name);
+            condition_broadcast(&head->cond);
+        }
     }
 
-    if (next_tick < now)
-        next_tick += TICK_PERIOD;
+    // Keep ticking only if the running thread has competition. A stopped
+    // tick is restarted by timer_quantum_start when a thread becomes ready.
 
-    sleep_list = head;
+    if (thread_others_ready()) {
+        if (!tick_running || next_tick <= now)
+            next_tick = now + TICK_PERIOD;
+        tick_running = 1;
+    } else
+        tick_running = 0;
 
-    if (head != NULL && head->twake < next_tick)
-        set_mtcmp(head->twake);
+    program_timer();
+
+    debug("[%lu] Next timer interrupt set for %lu ticks", now, get_mtcmp());
+}
+
+int alarm_advance(struct alarm * al, uint64_t tcnt) {
+    // If the tcnt is so large it wraps around, set it to UINT64_MAX
+
+    if (UINT64_MAX - al->twake < tcnt)
+        al->twake = UINT64_MAX;
     else
-        set_mtcmp(next_tick);
+        al->twake += tcnt;
+    
+    return (get_mtime() <= al->twake);
+}
 
+void alarm_insert(struct alarm * al) {
+    if (alarm_cnt == NALARM)
+        panic("Too many alarms");
 
-    debug("[%lu] Next timer interrupt set for %lu ticks", now, get_mtcmp());
-    enable_mmode_timer_intr();
+    debug("Inserting alarm %s", al->cond.name);
+    al->heapidx = alarm_cnt++;
+    alarm_heap[al->heapidx] = al;
+    alarm_heap_up(al->heapidx);
 
+    // The new alarm may come before whatever the timer is set for
+
+    if (al->heapidx == 0)
+        program_timer();
+}
+
+void alarm_heap_remove(int idx) {
+    struct alarm * al;
+
+    alarm_heap[idx]->heapidx = -1;
+    alarm_cnt -= 1;
+
+    if (idx == alarm_cnt)
+        return;
+
+    // Move the last alarm into the hole and restore the heap property in
+    // whichever direction it is violated.
+
+    al = alarm_heap[alarm_cnt];
+    alarm_heap[idx] = al;
+    al->heapidx = idx;
+    alarm_heap_up(idx);
+    alarm_heap_down(al->heapidx);
+}
+
+void alarm_heap_up(int idx) {
+    struct alarm * al = alarm_heap[idx];
+    int parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (alarm_heap[parent]->twake <= al->twake)
+            break;
+        alarm_heap[idx] = alarm_heap[parent];
+        alarm_heap[idx]->heapidx = idx;
+        idx = parent;
+    }
+
+    alarm_heap[idx] = al;
+    al->heapidx = idx;
+}
+
+void alarm_heap_down(int idx) {
+    struct alarm * al = alarm_heap[idx];
+    int child;
+
+    while ((child = 2 * idx + 1) < alarm_cnt) {
+        if (child + 1 < alarm_cnt &&
+            alarm_heap[child + 1]->twake < alarm_heap[child]->twake)
+        {
+            child += 1;
+        }
+
+        if (al->twake <= alarm_heap[child]->twake)
+            break;
+
+        alarm_heap[idx] = alarm_heap[child];
+        alarm_heap[idx]->heapidx = idx;
+        idx = child;
+    }
+
+    alarm_heap[idx] = al;
+    al->heapidx = idx;
+}
+
+void program_timer(void) {
+    uint64_t deadline;
+
+    deadline = tick_running ? next_tick : UINT64_MAX;
+    if (alarm_cnt != 0 && alarm_heap[0]->twake < deadline)
+        deadline = alarm_heap[0]->twake;
+    
+    set_timer_deadline(deadline);
+}
+
+void set_timer_deadline(uint64_t deadline) {
+    if (timer_sstc) {
+        // Writing stimecmp also clears STIP if the deadline is in the future
+        csrw_stimecmp(deadline);
+        csrs_sie(RISCV_SIE_STIE);
+    } else {
+        set_mtcmp(deadline);
+        csrs_sie(RISCV_SIE_STIE);
+        enable_mmode_timer_intr();
+    }
 }
 
 void enable_mmode_timer_intr(void) {
-    // see _mmode_trap_handler in trapasm.s
+    // see _mmode_trap_handler in trapasm.S
     asm ("ecall" ::: "memory");
 }
 
@@ -197,3 +397,15 @@ static inline uint64_t get_mtcmp(void) {
 static inline void set_mtcmp(uint64_t val) {
     *(volatile uint64_t*)MTCMP_ADDR = val;
 }
+
+// Reading the low word of the Goldfish RTC latches the high word.
+
+#define RTC_TIME_LOW    (RTC_IOBASE + 0x00)
+#define RTC_TIME_HIGH   (RTC_IOBASE + 0x04)
+
+static inline uint64_t get_rtc_ns(void) {
+    uint64_t lo;
+
+    lo = *(volatile uint32_t*)RTC_TIME_LOW;
+    return ((uint64_t)*(volatile uint32_t*)RTC_TIME_HIGH << 32) | lo;
+}
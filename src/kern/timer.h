@@ -12,8 +12,10 @@
 
 struct alarm {
     struct condition cond;
-    struct alarm * next;
+    int heapidx; // position in the alarm heap, -1 if not armed
     uint64_t twake;
+    void (*fn)(struct alarm * al); // callback for alarm_start, or NULL
+    uint64_t period; // re-arm interval for alarm_start_periodic, or 0
 };
 
 // EXPORTED FUNCTION DECLARATIONS
@@ -22,6 +24,11 @@ struct alarm {
 extern char timer_initialized;
 extern void timer_init(void);
 
+// Wall-clock time when mtime was zeroed by timer_init, in nanoseconds since
+// 1970, as read from the real-time clock.
+
+extern uint64_t timer_boot_wall_ns;
+
 // Initializes an alarm. The /name/ argument is optional.
 
 extern void alarm_init(struct alarm * al, const char * name);
@@ -32,6 +39,29 @@ extern void alarm_init(struct alarm * al, const char * name);
 
 extern void alarm_sleep(struct alarm * al, uint64_t tcnt);
 
+// Arms the alarm to expire /tcnt/ ticks after the most recent alarm event,
+// like alarm_sleep, but returns immediately. When the alarm expires, /fn/ is
+// called from timer_intr_handler with interrupts disabled, so it must not
+// block. If the expiry time has already passed, /fn/ is called right away. The
+// alarm is already armed, it is canceled first, so alarm_start can also be used
+// to re-arm an alarm (typically after alarm_reset).
+
+extern void alarm_start (
+    struct alarm * al, uint64_t tcnt, void (*fn)(struct alarm * al));
+
+// Like alarm_start, but after each expiry the alarm is re-armed to expire
+// /tcnt/ ticks later, until it is canceled. Expiries that were missed (for
+// example, because interrupts were disabled) are skipped, not made up.
+
+extern void alarm_start_periodic (
+    struct alarm * al, uint64_t tcnt, void (*fn)(struct alarm * al));
+
+// Disarms an alarm started with alarm_start or alarm_start_periodic. Returns 1
+// if the alarm was armed, 0 if it had already expired or was never started.
+// May be called from an alarm callback, including that of the alarm itself.
+
+extern int alarm_cancel(struct alarm * al);
+
 // Resets the alarm so that the next sleep increment is relative to the time
 // of this function call.
 
@@ -39,10 +69,19 @@ extern void alarm_reset(struct alarm * al);
 
 extern void timer_intr_handler(struct trap_frame * tfr); // called from intr.c
 
+// Restarts the periodic scheduling tick if it is stopped. Called from thread.c
+// when a thread is made ready while another thread is running. May be called
+// from an ISR.
+
+extern void timer_quantum_start(void);
+
 static inline void alarm_sleep_sec(struct alarm * al, unsigned int sec);
 static inline void alarm_sleep_ms(struct alarm * al, unsigned long ms);
 static inline void alarm_sleep_us(struct alarm * al, unsigned long us);
 
+static inline uint64_t timer_ms_to_tcnt(unsigned long ms);
+static inline uint64_t timer_us_to_tcnt(unsigned long us);
+
 // INLINE FUNCTION DEFINITIONS
 //
 
@@ -58,5 +97,12 @@ static inline void alarm_sleep_us(struct alarm * al, unsigned long us) {
     alarm_sleep(al, us * (TIMER_FREQ / 1000 / 1000));
 }
 
+static inline uint64_t timer_ms_to_tcnt(unsigned long ms) {
+    return ms * (TIMER_FREQ / 1000);
+}
+
+static inline uint64_t timer_us_to_tcnt(unsigned long us) {
+    return us * (TIMER_FREQ / 1000 / 1000);
+}
 
 #endif // _TIMER_H_
@@ -50,7 +50,7 @@ struct trap_frame {
     uint64_t sepc;
 };
 
-// _trap_entry_from_Xmode in trapasm.s dispatches to:
+// _trap_entry_from_Xmode in trapasm.S dispatches to:
 // 
 //   Xmode_excp_handler defined in excp.c or
 //   Xmode_intr_handler defined in intr.c
@@ -12,6 +12,7 @@
 #include "halt.h"
 #include "intr.h"
 #include "limits.h"
+#include "workq.h"
 
 // COMPILE-TIME CONSTANT DEFINITIONS
 //
@@ -79,6 +80,8 @@ struct uart_device {
 	struct condition rxbnotempty;
 	struct condition txbnotfull;	
 
+	struct work wakeup_work; // queued by ISR to signal the conditions above
+
 	struct ringbuf rxbuf;
 	struct ringbuf txbuf;
 };
@@ -90,8 +93,12 @@ static int uart_open(struct io_intf ** ioptr, void * aux);
 static void uart_close(struct io_intf * io);
 static long uart_read(struct io_intf * io, void * buf, unsigned long bufsz);
 static long uart_write(struct io_intf * io, const void * buf, unsigned long n);
+static long uart_writev (
+	struct io_intf * io, const struct iovec * iov, int iovcnt);
+static int uart_poll(struct io_intf * io);
 
 static void uart_isr(int irqno, void * driver_private);
+static void uart_wakeup_work(struct work * wk);
 
 static int uart_open_ebusy(struct io_intf ** ioptr, void * aux);
 
@@ -108,7 +115,9 @@ void uart_attach(void * mmio_base, int irqno) {
 	static const struct io_ops uart_ops = {
 		.close = uart_close,
 		.read = uart_read,
-		.write = uart_write
+		.write = uart_write,
+		.writev = uart_writev,
+		.poll = uart_poll
 	};
 
 	struct uart_device * dev;
@@ -128,6 +137,7 @@ void uart_attach(void * mmio_base, int irqno) {
 
 	condition_init(&dev->rxbnotempty, "rxnotempty");
 	condition_init(&dev->txbnotfull, "txnotfull");
+	work_init(&dev->wakeup_work, uart_wakeup_work);
 
 	rbuf_init(&dev->rxbuf);
 	rbuf_init(&dev->txbuf);
@@ -149,8 +159,14 @@ int uart_open(struct io_intf ** ioptr, void * aux) {
 
 	assert (ioptr != NULL);
 
-	if (dev->io_intf.refcnt)
+	// Opens come from system calls, which run with interrupts enabled
+
+	preempt_disable();
+
+	if (dev->io_intf.refcnt) {
+		preempt_enable();
 		return -EBUSY;
+	}
 	
 	// Reset receive and transmit buffers
 	
@@ -166,6 +182,8 @@ int uart_open(struct io_intf ** ioptr, void * aux) {
 
 	*ioptr = &dev->io_intf;
 	dev->io_intf.refcnt = 1;
+	dev->io_intf.flags = 0;
+	preempt_enable();
 	return 0;
 }
 
@@ -175,6 +193,11 @@ void uart_close(struct io_intf * io) {
 
 	trace("%s()", __func__);
 	assert (io != NULL);
+
+	// Only the last reference closes the device
+
+	if (__atomic_sub_fetch(&io->refcnt, 1, __ATOMIC_RELAXED) > 0)
+		return;
 	
 	// Disable all interrupts from device
 
@@ -210,15 +233,29 @@ long uart_read(struct io_intf * io, void * buf, unsigned long bufsz) {
 
 	intr_disable();
 
-	while (rbuf_empty(&dev->rxbuf))
-		condition_wait(&dev->rxbnotempty);
+	while (rbuf_empty(&dev->rxbuf)) {
+		if (io->flags & O_NONBLOCK) {
+			intr_enable();
+			return -EAGAIN;
+		}
+		if (condition_wait_interruptible(&dev->rxbnotempty) != 0) {
+			intr_enable();
+			return -EINTR;
+		}
+	}
 
 	intr_enable();
 
+	// The ring buffers have one consumer (or producer) besides the ISR, so
+	// keep other threads out while we use them.
+
+	preempt_disable();
+
 	while (!rbuf_empty(&dev->rxbuf) && p - (char*)buf < bufsz)
 		*p++ = rbuf_get(&dev->rxbuf);
 	
 	dev->regs->ier |= IER_DREIE; // enable receive interrupts
+	preempt_enable();
 	
 	return p - (char*)buf;
 }
@@ -240,19 +277,93 @@ long uart_write(struct io_intf * io, const void * buf, unsigned long n) {
 
 	while (p - (char*)buf < n) {
 		intr_disable();
-		while (rbuf_full(&dev->txbuf))
+		while (rbuf_full(&dev->txbuf)) {
+			if (io->flags & O_NONBLOCK) {
+				intr_enable();
+				return (p == buf) ? -EAGAIN : p - (char*)buf;
+			}
 			condition_wait(&dev->txbnotfull);
+		}
 		intr_enable();
 
+		preempt_disable();
 		while (!rbuf_full(&dev->txbuf) && p - (char*)buf < n)
 			rbuf_put(&dev->txbuf, *p++);
 		
 		dev->regs->ier |= IER_THREIE;
+		preempt_enable();
 	}
 
 	return p - (char*)buf;
 }
 
+// Like uart_write, but fills the transmit ring from all segments at once, so a
+// header and payload go out with one wait and one interrupt enable instead of
+// one per segment.
+
+long uart_writev(struct io_intf * io, const struct iovec * iov, int iovcnt) {
+	struct uart_device * const dev =
+		(void*)io - offsetof(struct uart_device, io_intf);
+	unsigned long off = 0; // position in iov[i]
+	long acc = 0;
+	int i = 0;
+
+	trace("%s(iovcnt=%d)", __func__, iovcnt);
+	assert (io != NULL);
+
+	for (;;) {
+		while (i < iovcnt && off == iov[i].iov_len) {
+			i += 1;
+			off = 0;
+		}
+
+		if (i == iovcnt || acc == LONG_MAX)
+			break;
+
+		intr_disable();
+		while (rbuf_full(&dev->txbuf)) {
+			if (io->flags & O_NONBLOCK) {
+				intr_enable();
+				return (acc == 0) ? -EAGAIN : acc;
+			}
+			condition_wait(&dev->txbnotfull);
+		}
+		intr_enable();
+
+		preempt_disable();
+		while (!rbuf_full(&dev->txbuf) && i < iovcnt && acc < LONG_MAX) {
+			if (off == iov[i].iov_len) {
+				i += 1;
+				off = 0;
+				continue;
+			}
+			rbuf_put(&dev->txbuf, ((const char*)iov[i].iov_base)[off++]);
+			acc += 1;
+		}
+
+		dev->regs->ier |= IER_THREIE;
+		preempt_enable();
+	}
+
+	return acc;
+}
+
+// A read would not block if the receive ring has data, and a write would not
+// block if the transmit ring has room.
+
+int uart_poll(struct io_intf * io) {
+	struct uart_device * const dev =
+		(void*)io - offsetof(struct uart_device, io_intf);
+	int events = 0;
+
+	if (!rbuf_empty(&dev->rxbuf))
+		events |= POLLIN;
+	if (!rbuf_full(&dev->txbuf))
+		events |= POLLOUT;
+	
+	return events;
+}
+
 void uart_isr(int irqno, void * aux) {
 	struct uart_device * const dev = aux;
 	const uint_fast8_t line_status = dev->regs->lsr;
@@ -260,10 +371,14 @@ void uart_isr(int irqno, void * aux) {
 	if (line_status & LSR_OE)
 		dev->rxovrcnt += 1;
 	
+	// Moving bytes between the FIFO and the ring buffers is what acknowledges
+	// the interrupt, so it stays here. Waking readers and writers is left to
+	// a worker thread.
+
 	if (line_status & LSR_DR) {
 		if (!rbuf_full(&dev->rxbuf)) {
 			if (rbuf_empty(&dev->rxbuf))
-				condition_broadcast(&dev->rxbnotempty);
+				work_queue(&dev->wakeup_work);
 			rbuf_put(&dev->rxbuf, dev->regs->rbr);
 		} else
 			dev->regs->ier &= ~IER_DREIE;
@@ -272,13 +387,26 @@ void uart_isr(int irqno, void * aux) {
 	if (line_status & LSR_THRE) {
 		if (!rbuf_empty(&dev->txbuf)) {
 			if (rbuf_full(&dev->txbuf))
-				condition_broadcast(&dev->txbnotfull);
+				work_queue(&dev->wakeup_work);
 			dev->regs->thr = rbuf_get(&dev->txbuf);
 		} else
 			dev->regs->ier &= ~IER_THREIE;
 	}
 }
 
+// Queued by uart_isr when the receive buffer becomes non-empty or the
+// transmit buffer becomes non-full. Broadcasting a condition nobody waits on
+// is cheap, so both are signalled, and pollers are told to look again.
+
+void uart_wakeup_work(struct work * wk) {
+	struct uart_device * const dev =
+		(void*)wk - offsetof(struct uart_device, wakeup_work);
+
+	condition_broadcast(&dev->rxbnotempty);
+	condition_broadcast(&dev->txbnotfull);
+	iopoll_notify();
+}
+
 int uart_open_ebusy (
 	struct io_intf ** __attribute__ ((unused)) ioptr,
 	void * __attribute__ ((unused)) aux)
@@ -0,0 +1,28 @@
+// vdata.h - Kernel-maintained data page (shared with user programs)
+//
+
+#ifndef _VDATA_H_
+#define _VDATA_H_
+
+#include <stdint.h>
+
+// Every process has a read-only page at VDATA_VMA, just above the user stack,
+// that the kernel keeps up to date. User programs read it instead of making a
+// system call for the time base or their own pid and tid.
+
+#define VDATA_VMA 0xD0000000UL
+
+// The kernel increments gen before and after every update, so gen is odd while
+// an update is in progress. A reader that sees the same even gen before and
+// after reading the other fields has a consistent snapshot.
+
+struct vdata {
+    volatile uint32_t gen;
+    int32_t pid;
+    int32_t tid;        // thread currently running in this process
+    uint32_t reserved;
+    uint64_t timebase;  // frequency of the time CSR in Hz
+    uint64_t boot_offset; // wall-clock time at time CSR zero, ns since 1970
+};
+
+#endif // _VDATA_H_
@@ -11,6 +11,8 @@
 #include "string.h"
 #include "thread.h"
 #include "limits.h"
+#include "workq.h"
+#include "timer.h"
 
 
 //           COMPILE-TIME PARAMETERS
@@ -18,6 +20,22 @@
 
 #define VIOBLK_IRQ_PRIO 1
 
+//           Time to wait for the device to complete a request before giving up
+
+#ifndef VIOBLK_REQ_TIMEOUT_MS
+#define VIOBLK_REQ_TIMEOUT_MS 1000
+#endif
+
+//           Bounds on the spin time in IOCTL_POLL_HYBRID mode (microseconds)
+
+#ifndef VIOBLK_POLL_MIN_US
+#define VIOBLK_POLL_MIN_US 5
+#endif
+
+#ifndef VIOBLK_POLL_MAX_US
+#define VIOBLK_POLL_MAX_US 200
+#endif
+
 //           INTERNAL CONSTANT DEFINITIONS
 //          
 
@@ -78,6 +96,7 @@ struct vioblk_device {
     uint16_t irqno;
     int8_t opened;
     int8_t readonly;
+    int8_t failed; // queue could not be reset after a timeout
 
     //           optimal block size
     uint32_t blksz;
@@ -88,8 +107,17 @@ struct vioblk_device {
     //           size of device in blksz blocks
     uint64_t blkcnt;
 
+    //           queued by the ISR to signal used_updated
+    struct work used_work;
+
+    //           completion mode (IOCTL_SETPOLL) and counters (IOCTL_GETPOLLSTAT)
+    int8_t poll_mode;
+    uint64_t npolled;
+    uint64_t nintr;
+    uint64_t lat_avg; // average completion time in timer ticks
+
     struct {
-        //           signaled from ISR
+        //           signaled from used_work
         struct condition used_updated;
 
         //           We use a simple scheme of one transaction at a time.
@@ -136,16 +164,50 @@ static long vioblk_write (
     const void * restrict buf,
     unsigned long n);
 
+static long vioblk_readat (
+    struct io_intf * io, uint64_t pos, void * buf, unsigned long bufsz);
+
+static long vioblk_writeat (
+    struct io_intf * io, uint64_t pos, const void * buf, unsigned long n);
+
+static long vioblk_readv (
+    struct io_intf * io, const struct iovec * iov, int iovcnt);
+
+static long vioblk_writev (
+    struct io_intf * io, const struct iovec * iov, int iovcnt);
+
 static int vioblk_ioctl (
     struct io_intf * restrict io, int cmd, void * restrict arg);
 
+static int vioblk_poll(struct io_intf * io);
+
+static int vioblk_lock(struct vioblk_device * dev);
+static void vioblk_unlock(void);
+static int vioblk_submit_and_wait(struct vioblk_device * dev);
+static void vioblk_reset_queue(struct vioblk_device * dev);
+static int vioblk_rw_block (
+    struct vioblk_device * dev, uint64_t blkno, uint32_t type);
+static long vioblk_readat_locked (
+    struct vioblk_device * dev, uint64_t pos, void * buf, unsigned long n);
+static long vioblk_writeat_locked (
+    struct vioblk_device * dev, uint64_t pos,
+    const void * buf, unsigned long n);
+static void vioblk_iov_copy (
+    const struct iovec * iov, int * idx, unsigned long * off,
+    char * blk, unsigned long n, int to_blk);
+static unsigned long vioblk_iov_len(const struct iovec * iov, int iovcnt);
+
 static void vioblk_isr(int irqno, void * aux);
+static void vioblk_used_work(struct work * wk);
 
 //           IOCTLs
 
 static int vioblk_getlen(const struct vioblk_device * dev, uint64_t * lenptr);
 static int vioblk_getpos(const struct vioblk_device * dev, uint64_t * posptr);
 static int vioblk_setpos(struct vioblk_device * dev, const uint64_t * posptr);
+static int vioblk_setpoll(struct vioblk_device * dev, const int * modeptr);
+static int vioblk_getpollstat (
+    const struct vioblk_device * dev, struct io_pollstat * statptr);
 static int vioblk_getblksz (
     const struct vioblk_device * dev, uint32_t * blkszptr);
 
@@ -166,7 +228,12 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
         .write = vioblk_write,
         .read = vioblk_read,
         .ctl = vioblk_ioctl,
-        .close = vioblk_close
+        .close = vioblk_close,
+        .readv = vioblk_readv,
+        .writev = vioblk_writev,
+        .readat = vioblk_readat,
+        .writeat = vioblk_writeat,
+        .poll = vioblk_poll
     };
     
     virtio_featset_t enabled_features, wanted_features, needed_features;
@@ -231,6 +298,7 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
     dev->blkbuf = (void*)dev + sizeof(struct vioblk_device);
     dev->io_intf.ops = &ops;
     condition_init(&dev->vq.used_updated, "vioblk_used_updated");
+    work_init(&dev->used_work, vioblk_used_work);
 
     // fill out the descriptors in the virtq struct
     dev->vq.desc[0].addr = (uint64_t)&dev->vq.desc[1];
@@ -277,12 +345,18 @@ int vioblk_open(struct io_intf ** ioptr, void * aux) {
     //           FIXME your code here
 
     struct vioblk_device * dev = aux;
+
+    // Opens may come from system calls running with interrupts enabled
+    preempt_disable();
     *ioptr = &dev->io_intf;
     (*ioptr)->refcnt = 1; // setting refcnt for new io
+    (*ioptr)->flags = 0;
 
     // check if opened
-    if (dev->opened) 
+    if (dev->opened) {
+        preempt_enable();
         return 0;
+    }
 
     // set the virtq avail and virtq used queues
     dev->vq.avail.flags = 0;
@@ -296,6 +370,7 @@ int vioblk_open(struct io_intf ** ioptr, void * aux) {
 
     // set necessary flags in vioblk device
     dev->opened = 1;
+    preempt_enable();
 
     return 0;
 }
@@ -311,10 +386,8 @@ void vioblk_close(struct io_intf * io) {
     struct vioblk_device * dev = (void*)io -
         offsetof(struct vioblk_device, io_intf);
 
-    // decrease refcnt by 1
-    io->refcnt -= 1;
-
-    if (io->refcnt <= 0) {
+    // decrease refcnt by 1, atomically as in ioref
+    if (__atomic_sub_fetch(&io->refcnt, 1, __ATOMIC_RELAXED) == 0) {
         // reset the virtq avail and virtq used queues
         intr_disable_irq(dev->irqno);
         virtio_reset_virtq(dev->regs, 0);
@@ -327,146 +400,218 @@ void vioblk_close(struct io_intf * io) {
 /*  Reads bufsz number of bytes from the disk and writes them to buf. Achieves this by repeatedly
     setting the appropriate registers to request a block from the disk, waiting until the data has been
     populated in block buffer cache, and then writes that data out to buf. Thread sleeps while waiting for
-    the disk to service the request. Returns the number of bytes successfully read from the disk.
+    the disk to service the request. Returns the number of bytes successfully read from the disk and
+    advances the position.
 */
 long vioblk_read (
     struct io_intf * restrict io,
     void * restrict buf,
     unsigned long bufsz)
 {
-    //           FIXME your code here
     struct vioblk_device * dev = (void*)io -
         offsetof(struct vioblk_device, io_intf);
+    long cnt;
 
     if (dev->opened == 0)
         return -EBADFMT;
 
-    // boundary check
-    if (LONG_MAX < bufsz)
-        bufsz = LONG_MAX;
-
-    if (bufsz == 0)
-        return 0;
-
-    if (dev->pos + bufsz > dev->size)
-        bufsz = dev->size - dev->pos;
-    uint64_t old_pos = dev->pos;
-
-    // Acquire the lock
-    lock_acquire(&vlk);
-
-    // read the block
-    while (bufsz > 0) {
-        int sector = dev->pos / dev->blksz;
-        dev->vq.req_header.type = VIRTIO_BLK_T_IN;
-        dev->vq.req_header.sector = sector;
-        dev->vq.desc[2].flags |= VIRTQ_DESC_F_WRITE;
-        dev->vq.avail.idx++;
-        __sync_synchronize();
-
-        // wait for the device to service the request
-        int s = intr_disable();
-        virtio_notify_avail(dev->regs, 0);
-        condition_wait(&dev->vq.used_updated);
-        intr_restore(s);
-
-        // copy the data to the buffer
-        int count = bufsz;
-        int boundary = (sector + 1) * dev->blksz;
-        if (dev->pos + count > boundary)
-            count = boundary - dev->pos;
-        memcpy(buf, dev->blkbuf + (dev->pos % dev->blksz), count);
-
-        dev->pos += count;
-        bufsz -= count;
-        buf += count;
-    }
+    cnt = vioblk_lock(dev);
+    if (cnt != 0)
+        return cnt;
 
-    // Release the lock
-    lock_release(&vlk);
+    cnt = vioblk_readat_locked(dev, dev->pos, buf, bufsz);
+    if (cnt > 0)
+        dev->pos += cnt;
+    vioblk_unlock();
 
-    return dev->pos - old_pos;
+    return cnt;
 }
 
 /*  Writes n number of bytes from the parameter buf to the disk. The size of the virtio device should
     not change. You should only overwrite existing data. Write should also not create any new files.
-    Achieves this by filling up the block buffer cache and then setting the appropriate registers to request
-    the disk write the contents of the cache to the specified block location. Thread sleeps while waiting
-    for the disk to service the request. Returns the number of bytes successfully written to the disk.
+    Returns the number of bytes successfully written to the disk and advances the position.
 */
 long vioblk_write (
     struct io_intf * restrict io,
     const void * restrict buf,
     unsigned long n)
 {
-    //           FIXME your code here
+    struct vioblk_device * dev = (void*)io -
+        offsetof(struct vioblk_device, io_intf);
+    long cnt;
+
+    if (dev->opened == 0)
+        return -EBADFMT;
+    
+    cnt = vioblk_lock(dev);
+    if (cnt != 0)
+        return cnt;
+
+    cnt = vioblk_writeat_locked(dev, dev->pos, buf, n);
+    if (cnt > 0)
+        dev->pos += cnt;
+    vioblk_unlock();
+
+    return cnt;
+}
 
+/*  Positional read and write. Same as vioblk_read and vioblk_write, but at
+    byte offset pos; the current position is neither used nor changed.
+*/
+long vioblk_readat (
+    struct io_intf * io, uint64_t pos, void * buf, unsigned long bufsz)
+{
+    struct vioblk_device * dev = (void*)io -
+        offsetof(struct vioblk_device, io_intf);
+    long cnt;
+
+    if (dev->opened == 0)
+        return -EBADFMT;
+
+    cnt = vioblk_lock(dev);
+    if (cnt != 0)
+        return cnt;
+
+    cnt = vioblk_readat_locked(dev, pos, buf, bufsz);
+    vioblk_unlock();
+
+    return cnt;
+}
+
+long vioblk_writeat (
+    struct io_intf * io, uint64_t pos, const void * buf, unsigned long n)
+{
     struct vioblk_device * dev = (void*)io -
         offsetof(struct vioblk_device, io_intf);
+    long cnt;
 
     if (dev->opened == 0)
         return -EBADFMT;
+
+    cnt = vioblk_lock(dev);
+    if (cnt != 0)
+        return cnt;
+
+    cnt = vioblk_writeat_locked(dev, pos, buf, n);
+    vioblk_unlock();
+
+    return cnt;
+}
+
+/*  Vectored read. Each block is read once and scattered directly from the
+    block buffer into the segments, so the segments cost no extra requests.
+*/
+long vioblk_readv (
+    struct io_intf * io, const struct iovec * iov, int iovcnt)
+{
+    struct vioblk_device * dev = (void*)io -
+        offsetof(struct vioblk_device, io_intf);
+    unsigned long n, count, off = 0;
+    uint64_t old_pos, blkno;
+    int idx = 0;
+    int result;
+
+    if (dev->opened == 0)
+        return -EBADFMT;
+
+    n = vioblk_iov_len(iov, iovcnt);
+    if (dev->pos + n > dev->size)
+        n = dev->size - dev->pos;
+
+    result = vioblk_lock(dev);
+    if (result != 0)
+        return result;
+
+    old_pos = dev->pos;
+
+    while (n > 0) {
+        blkno = dev->pos / dev->blksz;
+        count = (blkno + 1) * dev->blksz - dev->pos;
+        if (count > n)
+            count = n;
+
+        if (vioblk_rw_block(dev, blkno, VIRTIO_BLK_T_IN) != 0)
+            break;
+
+        vioblk_iov_copy(iov, &idx, &off,
+            dev->blkbuf + (dev->pos % dev->blksz), count, 0);
+        dev->pos += count;
+        n -= count;
+    }
+
+    vioblk_unlock();
     
-    // boundary check
-    if (LONG_MAX < n)
-        n = LONG_MAX;
+    if (n > 0 && dev->pos == old_pos)
+        return -EIO;
+    return dev->pos - old_pos;
+}
 
-    if (n == 0)
-        return 0;
+/*  Vectored write. The segments are gathered into the block buffer and each
+    block is written with one request. Only a block that is partly covered is
+    read first, and into the block buffer itself, unlike vioblk_write, which
+    reads every block through a separate buffer.
+*/
+long vioblk_writev (
+    struct io_intf * io, const struct iovec * iov, int iovcnt)
+{
+    struct vioblk_device * dev = (void*)io -
+        offsetof(struct vioblk_device, io_intf);
+    unsigned long n, count, off = 0;
+    uint64_t old_pos, blkno;
+    int idx = 0;
+    int result;
 
+    if (dev->opened == 0)
+        return -EBADFMT;
+
+    n = vioblk_iov_len(iov, iovcnt);
     if (dev->pos + n > dev->size)
         n = dev->size - dev->pos;
-    uint64_t old_pos = dev->pos;
 
-    // Acquire the lock
-    lock_acquire(&vlk);
+    result = vioblk_lock(dev);
+    if (result != 0)
+        return result;
+
+    old_pos = dev->pos;
 
-    // write the block
     while (n > 0) {
-        int sector = dev->pos / dev->blksz;
-        int count = n;
-        int boundary = (sector + 1) * dev->blksz;
-        if (dev->pos + count > boundary)
-            count = boundary - dev->pos;
-
-        // read the block to be written
-        // prevent overwriting
-        uint64_t pos_pre = dev->pos;
-        uint64_t pos_new = sector * dev->blksz;
-        lock_release(&vlk);
-        vioblk_ioctl(io, IOCTL_SETPOS, &pos_new);
-        char * read_blk = kmalloc(dev->blksz);
-        vioblk_read(io, read_blk, dev->blksz);
-        vioblk_ioctl(io, IOCTL_SETPOS, &pos_pre);
-        lock_acquire(&vlk);
-        memcpy(read_blk+ (dev->pos % dev->blksz), buf, count);
-
-        // write read_blk
-        memcpy(dev->blkbuf, read_blk, dev->blksz);
-        dev->vq.req_header.type = VIRTIO_BLK_T_OUT;
-        dev->vq.req_header.sector = sector;
-        dev->vq.avail.idx++;
-        dev->vq.desc[2].flags &= ~VIRTQ_DESC_F_WRITE;
-        __sync_synchronize();
+        blkno = dev->pos / dev->blksz;
+        count = (blkno + 1) * dev->blksz - dev->pos;
+        if (count > n)
+            count = n;
 
-        // wait for the device to service the request
-        int s = intr_disable();
-        virtio_notify_avail(dev->regs, 0);
-        condition_wait(&dev->vq.used_updated);
-        intr_restore(s);
+        if (count < dev->blksz &&
+            vioblk_rw_block(dev, blkno, VIRTIO_BLK_T_IN) != 0)
+        {
+            break;
+        }
+
+        vioblk_iov_copy(iov, &idx, &off,
+            dev->blkbuf + (dev->pos % dev->blksz), count, 1);
+
+        if (vioblk_rw_block(dev, blkno, VIRTIO_BLK_T_OUT) != 0)
+            break;
 
-        // update the position
         dev->pos += count;
         n -= count;
-        buf += count;
     }
 
-    // Release the lock
-    lock_release(&vlk);
+    vioblk_unlock();
     
+    if (n > 0 && dev->pos == old_pos)
+        return -EIO;
     return dev->pos - old_pos;
 }
 
+/*  The device serves one request at a time, so a transfer would block exactly
+    when another thread holds the device lock.
+*/
+int vioblk_poll(struct io_intf * io) {
+    if (vlk.tid != -1)
+        return 0;
+    return POLLIN | POLLOUT;
+}
+
 int vioblk_ioctl(struct io_intf * restrict io, int cmd, void * restrict arg) {
     struct vioblk_device * const dev = (void*)io -
         offsetof(struct vioblk_device, io_intf);
@@ -488,16 +633,293 @@ int vioblk_ioctl(struct io_intf * restrict io, int cmd, void * restrict arg) {
     case IOCTL_GETBLKSZ:
         ret = vioblk_getblksz(dev, arg);
         break;
+    case IOCTL_SETPOLL:
+        ret = vioblk_setpoll(dev, arg);
+        break;
+    case IOCTL_GETPOLLSTAT:
+        ret = vioblk_getpollstat(dev, arg);
+        break;
     default:
         ret = -ENOTSUP;
         break;
     }
-    lock_release(&vlk);
+    vioblk_unlock();
     return ret;
 }
 
-/*  Sets the appropriate device registers and wakes the thread up
-    after waiting for the disk to finish servicing a request.
+/*  Takes the device lock for a transfer. In non-blocking mode, fails with
+    -EAGAIN instead of waiting behind another thread's request.
+*/
+int vioblk_lock(struct vioblk_device * dev) {
+    int saved_intr_state;
+
+    saved_intr_state = intr_disable();
+    if (vlk.tid != -1 && (dev->io_intf.flags & O_NONBLOCK)) {
+        intr_restore(saved_intr_state);
+        return -EAGAIN;
+    }
+    lock_acquire(&vlk);
+    intr_restore(saved_intr_state);
+    return 0;
+}
+
+/*  Releases the device lock. The device is ready again, so pollers are told.
+*/
+void vioblk_unlock(void) {
+    lock_release(&vlk);
+    iopoll_notify();
+}
+
+/*  Notifies the device of the request just placed in the avail ring and waits
+    until it shows up in the used ring. In hybrid polling mode, first spins on
+    the used ring index for up to twice the average completion time, with the
+    completion interrupt suppressed, and only sleeps if that is not enough.
+    Returns 0 on completion or -ETIMEDOUT if the device does not respond.
+*/
+int vioblk_submit_and_wait(struct vioblk_device * dev) {
+    const uint64_t tstart = csrr_time();
+    uint64_t spin;
+    int result = 0;
+    int s;
+
+    if (dev->poll_mode == IOCTL_POLL_HYBRID) {
+        spin = 2 * dev->lat_avg;
+        if (spin < timer_us_to_tcnt(VIOBLK_POLL_MIN_US))
+            spin = timer_us_to_tcnt(VIOBLK_POLL_MIN_US);
+        if (spin > timer_us_to_tcnt(VIOBLK_POLL_MAX_US))
+            spin = timer_us_to_tcnt(VIOBLK_POLL_MAX_US);
+
+        dev->vq.avail.flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+        __sync_synchronize();
+        virtio_notify_avail(dev->regs, 0);
+
+        while (dev->vq.used.idx != dev->vq.avail.idx &&
+            csrr_time() - tstart < spin)
+        {
+            continue;
+        }
+
+        dev->vq.avail.flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+        __sync_synchronize();
+
+        if (dev->vq.used.idx == dev->vq.avail.idx) {
+            dev->npolled += 1;
+            goto done;
+        }
+
+        s = intr_disable();
+    } else {
+        s = intr_disable();
+        virtio_notify_avail(dev->regs, 0);
+    }
+
+    // Checking the index (not just waiting once) also guards against a late
+    // wakeup from an earlier request that completed while we were spinning.
+
+    while (dev->vq.used.idx != dev->vq.avail.idx && result == 0) {
+        result = condition_wait_timeout(&dev->vq.used_updated,
+            timer_ms_to_tcnt(VIOBLK_REQ_TIMEOUT_MS));
+    }
+
+    intr_restore(s);
+
+    // The device may complete without interrupting if it saw the
+    // NO_INTERRUPT hint just before we cleared it, so a timeout only counts
+    // if the request is really still outstanding.
+
+    if (dev->vq.used.idx != dev->vq.avail.idx) {
+        vioblk_reset_queue(dev);
+        return result;
+    }
+    
+    dev->nintr += 1;
+
+done:
+    // Keep a running average of completion time (weight 1/8 for new samples)
+    dev->lat_avg = (7 * dev->lat_avg + (csrr_time() - tstart)) / 8;
+    return 0;
+}
+
+/*  Takes back a request the device did not complete in time. The request is
+    still in the avail ring, and the device could complete it later into a
+    block buffer that has been reused. Resetting the queue (VIRTIO_F_RING_RESET)
+    makes the device drop it; the queue is then set up again from scratch. If
+    the device does not acknowledge the reset, it is marked failed and every
+    later request fails with -EIO. Called with vlk held.
+*/
+void vioblk_reset_queue(struct vioblk_device * dev) {
+    const uint64_t tstart = csrr_time();
+
+    kprintf("%p: vioblk request timed out, resetting queue\n", dev->regs);
+
+    virtio_reset_virtq(dev->regs, 0);
+    while (dev->regs->queue_reset != 1) {
+        if (csrr_time() - tstart > timer_ms_to_tcnt(VIOBLK_REQ_TIMEOUT_MS)) {
+            kprintf("%p: vioblk queue reset failed\n", dev->regs);
+            dev->failed = 1;
+            return;
+        }
+    }
+
+    // Both ring indices start over from zero
+
+    dev->vq.avail.idx = 0;
+    dev->vq.used.idx = 0;
+    virtio_attach_virtq(dev->regs, 0, 1, (uint64_t)(void*)&dev->vq.desc,
+        (uint64_t)(void*)&dev->vq.used, (uint64_t)(void*)&dev->vq.avail);
+    virtio_enable_virtq(dev->regs, 0);
+    __sync_synchronize();
+}
+
+/*  Transfers block /blkno/ between the device and the block buffer, in the
+    direction given by /type/ (VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT). Must be
+    called with vlk held. Returns 0 on success, -ETIMEDOUT if the device did
+    not respond (the request has been cancelled), or -EIO if the device has
+    failed.
+*/
+int vioblk_rw_block(struct vioblk_device * dev, uint64_t blkno, uint32_t type) {
+    if (dev->failed)
+        return -EIO;
+
+    dev->vq.req_header.type = type;
+    dev->vq.req_header.sector = blkno;
+    if (type == VIRTIO_BLK_T_IN)
+        dev->vq.desc[2].flags |= VIRTQ_DESC_F_WRITE;
+    else
+        dev->vq.desc[2].flags &= ~VIRTQ_DESC_F_WRITE;
+    dev->vq.avail.idx++;
+    __sync_synchronize();
+
+    return vioblk_submit_and_wait(dev);
+}
+
+/*  Reads up to /n/ bytes at byte offset /pos/ into /buf/, one block request
+    at a time, stopping at the end of the device. Must be called with vlk
+    held. If the device stops responding, returns the number of bytes read so
+    far, or -EIO if there are none.
+*/
+long vioblk_readat_locked (
+    struct vioblk_device * dev, uint64_t pos, void * buf, unsigned long n)
+{
+    unsigned long count;
+    uint64_t blkno;
+    char * p = buf;
+
+    if (LONG_MAX < n)
+        n = LONG_MAX;
+    if (pos >= dev->size)
+        return 0;
+    if (n > dev->size - pos)
+        n = dev->size - pos;
+
+    while (n > 0) {
+        blkno = pos / dev->blksz;
+        count = (blkno + 1) * dev->blksz - pos;
+        if (count > n)
+            count = n;
+
+        if (vioblk_rw_block(dev, blkno, VIRTIO_BLK_T_IN) != 0)
+            return (p != (char*)buf) ? p - (char*)buf : -EIO;
+
+        memcpy(p, dev->blkbuf + (pos % dev->blksz), count);
+        pos += count;
+        p += count;
+        n -= count;
+    }
+
+    return p - (char*)buf;
+}
+
+/*  Writes up to /n/ bytes from /buf/ at byte offset /pos/. The device does
+    not grow, so the write stops at its end. A block that is only partly
+    overwritten is read into the block buffer first. Must be called with vlk
+    held. Errors are reported as for vioblk_readat_locked.
+*/
+long vioblk_writeat_locked (
+    struct vioblk_device * dev, uint64_t pos,
+    const void * buf, unsigned long n)
+{
+    unsigned long count;
+    uint64_t blkno;
+    const char * p = buf;
+
+    if (LONG_MAX < n)
+        n = LONG_MAX;
+    if (pos >= dev->size)
+        return 0;
+    if (n > dev->size - pos)
+        n = dev->size - pos;
+
+    while (n > 0) {
+        blkno = pos / dev->blksz;
+        count = (blkno + 1) * dev->blksz - pos;
+        if (count > n)
+            count = n;
+
+        if (count < dev->blksz &&
+            vioblk_rw_block(dev, blkno, VIRTIO_BLK_T_IN) != 0)
+        {
+            break;
+        }
+
+        memcpy(dev->blkbuf + (pos % dev->blksz), p, count);
+
+        if (vioblk_rw_block(dev, blkno, VIRTIO_BLK_T_OUT) != 0)
+            break;
+
+        pos += count;
+        p += count;
+        n -= count;
+    }
+
+    if (n > 0 && p == (const char*)buf)
+        return -EIO;
+    return p - (const char*)buf;
+}
+
+/*  Copies /n/ bytes between /blk/ and the I/O vector, starting at segment
+    *idx, offset *off, and advances both past the copied bytes. Copies into
+    the block buffer if /to_blk/ is nonzero, out of it otherwise.
+*/
+void vioblk_iov_copy (
+    const struct iovec * iov, int * idx, unsigned long * off,
+    char * blk, unsigned long n, int to_blk)
+{
+    unsigned long count;
+
+    while (n > 0) {
+        count = iov[*idx].iov_len - *off;
+        if (count > n)
+            count = n;
+
+        if (to_blk)
+            memcpy(blk, iov[*idx].iov_base + *off, count);
+        else
+            memcpy(iov[*idx].iov_base + *off, blk, count);
+
+        blk += count;
+        n -= count;
+        *off += count;
+
+        if (*off == iov[*idx].iov_len) {
+            *idx += 1;
+            *off = 0;
+        }
+    }
+}
+
+unsigned long vioblk_iov_len(const struct iovec * iov, int iovcnt) {
+    unsigned long len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    
+    return (len > LONG_MAX) ? LONG_MAX : len;
+}
+
+/*  Acknowledges the interrupt and defers waking the thread that is waiting
+    for the disk to finish servicing a request to a worker thread.
 */
 void vioblk_isr(int irqno, void * aux) {
     //           FIXME your code here
@@ -505,16 +927,46 @@ void vioblk_isr(int irqno, void * aux) {
     struct vioblk_device * dev = aux;
     __sync_synchronize();
 
-    // wake up the thread
     if (dev->regs->interrupt_status & VIOBLK_USED_NOTF) {
-        condition_broadcast(&dev->vq.used_updated);
-
         // acknowledge the interrupt
         dev->regs->interrupt_ack = dev->regs->interrupt_status;
         __sync_synchronize();
+
+        // wake up the thread from the workqueue
+        work_queue(&dev->used_work);
     }
 }
 
+/*  Work item queued by vioblk_isr. Wakes up the thread waiting for the
+    request to complete.
+*/
+void vioblk_used_work(struct work * wk) {
+    struct vioblk_device * dev = (void*)wk -
+        offsetof(struct vioblk_device, used_work);
+
+    condition_broadcast(&dev->vq.used_updated);
+}
+
+/*  Ioctl helper function which selects the completion mode.
+*/
+int vioblk_setpoll(struct vioblk_device * dev, const int * modeptr) {
+    if (*modeptr != IOCTL_POLL_OFF && *modeptr != IOCTL_POLL_HYBRID)
+        return -EINVAL;
+    dev->poll_mode = *modeptr;
+    return 0;
+}
+
+/*  Ioctl helper function which provides the completion counters.
+*/
+int vioblk_getpollstat (
+    const struct vioblk_device * dev, struct io_pollstat * statptr)
+{
+    statptr->npolled = dev->npolled;
+    statptr->nintr = dev->nintr;
+    statptr->spin_us = 2 * dev->lat_avg / timer_us_to_tcnt(1);
+    return 0;
+}
+
 /*  Ioctl helper function which provides the device size in bytes.
 */
 int vioblk_getlen(const struct vioblk_device * dev, uint64_t * lenptr) {
@@ -6,6 +6,7 @@
 #include "device.h"
 #include "uart.h"
 #include "timer.h"
+#include "workq.h"
 #include "intr.h"
 #include "heap.h"
 #include "virtio.h"
@@ -36,6 +37,7 @@ void main(void) {
     thread_init();
 
     heap_init(_kimg_end, (void*)USER_START);
+    workq_init();
 
     //           Attach virtio devices
 
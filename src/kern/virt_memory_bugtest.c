@@ -16,6 +16,7 @@
 #include "device.h"
 #include "uart.h"
 #include "timer.h"
+#include "workq.h"
 #include "intr.h"
 #include "memory.h"
 #include "heap.h"
@@ -40,6 +41,7 @@ void main(void) {
     devmgr_init();
     thread_init();
     procmgr_init();
+    workq_init();
 
     // Attach NS16550a serial devices
 
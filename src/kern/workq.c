@@ -0,0 +1,178 @@
+// workq.c - Deferred work run by kernel worker threads
+//
+
+#ifdef WORKQ_TRACE
+#define TRACE
+#endif
+
+#ifdef WORKQ_DEBUG
+#define DEBUG
+#endif
+
+#include "workq.h"
+
+#include <stddef.h>
+
+#include "console.h"
+#include "halt.h"
+#include "intr.h"
+#include "thread.h"
+#include "timer.h"
+
+// COMPILE-TIME PARAMETERS
+//
+
+// NWORKER is the number of worker threads serving the work queue
+
+#ifndef NWORKER
+#define NWORKER 2
+#endif
+
+// EXPORTED GLOBAL VARIABLES
+//
+
+char workq_initialized = 0;
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+// The system work queue, a FIFO of pending work items. Work queues are
+// modified from ISRs, so only touched with interrupts disabled.
+
+static struct workqueue workq;
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static void worker_thread_func(void * arg);
+static void delayed_work_expired(struct alarm * al);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+void workq_init(void) {
+    trace("%s()", __func__);
+
+    workqueue_init(&workq, "worker", NWORKER);
+    workq_initialized = 1;
+}
+
+void workqueue_init(struct workqueue * wq, const char * name, int nworker) {
+    int tid;
+    int i;
+
+    trace("%s(name=\"%s\")", __func__, name);
+
+    wq->head = NULL;
+    wq->tail = NULL;
+    condition_init(&wq->not_empty, name);
+
+    // Workers are kernel threads; they do not belong to the process of the
+    // thread that started them.
+
+    for (i = 0; i < nworker; i++) {
+        tid = thread_spawn(name, worker_thread_func, wq);
+        if (tid < 0)
+            panic("Too many threads");
+        thread_set_process(tid, NULL);
+    }
+}
+
+void work_init(struct work * wk, void (*fn)(struct work * wk)) {
+    wk->next = NULL;
+    wk->fn = fn;
+    wk->pending = 0;
+}
+
+int work_queue(struct work * wk) {
+    return work_queue_on(&workq, wk);
+}
+
+int work_queue_on(struct workqueue * wq, struct work * wk) {
+    int saved_intr_state;
+
+    saved_intr_state = intr_disable();
+
+    if (wk->pending) {
+        intr_restore(saved_intr_state);
+        return 0;
+    }
+
+    wk->pending = 1;
+    wk->next = NULL;
+
+    if (wq->tail != NULL)
+        wq->tail->next = wk;
+    else
+        wq->head = wk;
+    
+    wq->tail = wk;
+
+    condition_broadcast(&wq->not_empty);
+    intr_restore(saved_intr_state);
+    return 1;
+}
+
+void delayed_work_init (
+    struct delayed_work * dw, void (*fn)(struct work * wk))
+{
+    work_init(&dw->work, fn);
+    alarm_init(&dw->alarm, "delayed_work");
+    dw->armed = 0;
+}
+
+int work_queue_delayed(struct delayed_work * dw, uint64_t tcnt) {
+    int saved_intr_state;
+
+    saved_intr_state = intr_disable();
+
+    if (dw->armed || dw->work.pending) {
+        intr_restore(saved_intr_state);
+        return 0;
+    }
+
+    dw->armed = 1;
+    alarm_reset(&dw->alarm);
+    alarm_start(&dw->alarm, tcnt, delayed_work_expired);
+
+    intr_restore(saved_intr_state);
+    return 1;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+void worker_thread_func(void * arg) {
+    struct workqueue * const wq = arg;
+    struct work * wk;
+
+    for (;;) {
+        intr_disable();
+
+        while (wq->head == NULL)
+            condition_wait(&wq->not_empty);
+        
+        wk = wq->head;
+        wq->head = wk->next;
+        if (wq->head == NULL)
+            wq->tail = NULL;
+        
+        wk->next = NULL;
+        wk->pending = 0; // may be requeued from here on
+
+        intr_enable();
+
+        debug("worker running work item %p", wk);
+        wk->fn(wk);
+    }
+}
+
+// Alarm callback for delayed work. Runs in timer_intr_handler.
+
+void delayed_work_expired(struct alarm * al) {
+    struct delayed_work * const dw =
+        (void*)al - offsetof(struct delayed_work, alarm);
+    
+    dw->armed = 0;
+    work_queue(&dw->work);
+}
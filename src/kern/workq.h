@@ -0,0 +1,105 @@
+// workq.h - Deferred work run by kernel worker threads
+//
+
+#ifndef _WORKQ_H_
+#define _WORKQ_H_
+
+#include <stdint.h>
+#include "thread.h" // for struct condition
+#include "timer.h" // for struct alarm
+
+// EXPORTED TYPE DEFINITIONS
+//
+
+// A work item. Embed it in the structure the work operates on and recover the
+// enclosing structure in /fn/ with offsetof, the same way drivers recover their
+// device from a struct io_intf.
+
+struct work {
+    struct work * next;
+    void (*fn)(struct work * wk);
+    int pending; // queued and not yet started
+};
+
+// A queue of work items with its own worker threads. Drivers use the system
+// work queue through work_queue. A subsystem whose work items may block for a
+// long time sets up a queue of its own with workqueue_init, so that it cannot
+// hold up driver work.
+
+struct workqueue {
+    struct work * head;
+    struct work * tail;
+    struct condition not_empty;
+};
+
+// A work item that is queued after a delay, using a timer alarm.
+
+struct delayed_work {
+    struct work work;
+    struct alarm alarm;
+    int armed; // alarm running, work not yet queued
+};
+
+// EXPORTED VARIABLE DECLARATIONS
+//
+
+extern char workq_initialized;
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// void workq_init(void)
+// Starts the worker threads. Must be called after thread_init and timer_init.
+
+extern void workq_init(void);
+
+// void workqueue_init(struct workqueue * wq, const char * name, int nworker)
+// Initializes the work queue /wq/ and starts /nworker/ worker threads named
+// /name/ to serve it. Must be called during boot, like workq_init.
+
+extern void workqueue_init(struct workqueue * wq, const char * name, int nworker);
+
+// void work_init(struct work * wk, void (*fn)(struct work * wk))
+// Initializes a work item. /fn/ is called from a worker thread, so it may
+// block, but it has no associated process.
+
+extern void work_init(struct work * wk, void (*fn)(struct work * wk));
+
+// int work_queue(struct work * wk)
+// Queues a work item to be run by a worker thread. May be called from an ISR.
+// A work item that is already pending is not queued twice; it runs once. A
+// work item may requeue itself while running. Returns 1 if the work item was
+// queued and 0 if it was already pending.
+
+extern int work_queue(struct work * wk);
+
+// int work_queue_on(struct workqueue * wq, struct work * wk)
+// Like work_queue, but queues /wk/ on /wq/. A work item must always be queued
+// on the same queue.
+
+extern int work_queue_on(struct workqueue * wq, struct work * wk);
+
+// void delayed_work_init (
+//     struct delayed_work * dw, void (*fn)(struct work * wk))
+// Initializes a delayed work item. /fn/ receives &dw->work.
+
+extern void delayed_work_init (
+    struct delayed_work * dw, void (*fn)(struct work * wk));
+
+// int work_queue_delayed(struct delayed_work * dw, uint64_t tcnt)
+// Queues a delayed work item after /tcnt/ timer ticks from now. May be called
+// from an ISR. Returns 1 if the work item was armed and 0 if it was already
+// armed or pending.
+
+extern int work_queue_delayed(struct delayed_work * dw, uint64_t tcnt);
+
+static inline int work_queue_delayed_us(struct delayed_work * dw, unsigned long us);
+
+// INLINE FUNCTION DEFINITIONS
+//
+
+static inline int work_queue_delayed_us(struct delayed_work * dw, unsigned long us) {
+    return work_queue_delayed(dw, us * (TIMER_FREQ / 1000 / 1000));
+}
+
+#endif // _WORKQ_H_
@@ -17,7 +17,7 @@ void main(void) {
     result = _devopen(0, "ser", 1);
     if (result < 0) {
         _msgout("_devopen failed");
-        _exit();
+        _exit(0);
     }
 
     // open the file to be read
@@ -58,21 +58,17 @@ void main(void) {
     result = _fsopen(1, filename);
     if (result < 0) {
         _msgout("_fsopen failed");
-        _exit();
+        _exit(0);
     }
 
-    // read the file and print it to the terminal
+    // copy the file to the terminal in the kernel
     size_t size = 0;
     _ioctl(1, IOCTL_GETLEN, &size);
-    char buf[4096];
-    result = _read(1, buf, 4096);
-    if (result < 0) {
-        _msgout("_read failed");
-        _exit();
+    long cnt = _sendfile(0, 1, NULL, size);
+    if (cnt < 0) {
+        _msgout("_sendfile failed");
+        _exit(0);
     }
-    slen = strlen(buf);
-    _write(0, buf, slen);
-    _msgout(buf);
 
     // end the program
     message = "\n\rHit any key to end the program: ";
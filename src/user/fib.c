@@ -12,7 +12,7 @@ void main(void) {
         _msgout(linebuf);
     }
 
-    _exit();
+    _exit(0);
 }
 
 unsigned int fib(unsigned int n) {
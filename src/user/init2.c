@@ -11,7 +11,7 @@ void main(void) {
 
     if (result < 0) {
         _msgout("_devopen failed");
-        _exit();
+        _exit(0);
     }
 
     // ... run trek
@@ -20,7 +20,7 @@ void main(void) {
 
     if (result < 0) {
         _msgout("_fsopen failed");
-        _exit();
+        _exit(0);
     }
 
     _exec(1);
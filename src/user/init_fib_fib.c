@@ -10,7 +10,7 @@ void main(void) {
 
     if (result < 0) {
         _msgout("_fsopen failed");
-        _exit();
+        _exit(0);
     }
 
     _exec(0);
@@ -0,0 +1,53 @@
+// init_spawn.c - Starts trek and rule30 with _spawn instead of _fork/_exec
+//
+// Same setup as init_trek_rule30, but each child is built directly from its
+// executable, so the parent's address space is never copied. The child's fd 0
+// is the serial device the parent opened for it.
+//
+
+#include "syscall.h"
+#include "string.h"
+
+static int spawn_on_serial(int instno, const char * name, int devfd, int exefd) {
+    int fdmap[1];
+    int result;
+
+    result = _devopen(devfd, "ser", instno);
+
+    if (result < 0) {
+        _msgout("_devopen failed");
+        return result;
+    }
+
+    result = _fsopen(exefd, name);
+
+    if (result < 0) {
+        _msgout("_fsopen failed");
+        return result;
+    }
+
+    fdmap[0] = devfd;
+    result = _spawn(exefd, fdmap, 1);
+
+    if (result < 0)
+        _msgout("_spawn failed");
+
+    // the child holds its own references
+    _close(exefd);
+    _close(devfd);
+    return result;
+}
+
+void main(void) {
+    int trek, rule30;
+
+    trek = spawn_on_serial(1, "trek", 0, 1);
+    rule30 = spawn_on_serial(2, "rule30", 2, 3);
+
+    if (trek >= 0)
+        _wait(trek, NULL);
+    if (rule30 >= 0)
+        _wait(rule30, NULL);
+
+    _exit(0);
+}
@@ -11,7 +11,7 @@ void main(void) {
 
         if (result < 0) {
             _msgout("_devopen failed");
-            _exit();
+            _exit(0);
         }
 
         // exec trek
@@ -20,12 +20,12 @@ void main(void) {
 
         if (result < 0) {
             _msgout("_fsopen failed");
-            _exit();
+            _exit(0);
         }
 
         _exec(1);
 #else
-        _wait(0);
+        _wait(0, NULL);
 #endif
     } else {
 #if 1
@@ -34,7 +34,7 @@ void main(void) {
 
         if (result < 0) {
             _msgout("_devopen failed");
-            _exit();
+            _exit(0);
         }
 
         // exec trek
@@ -43,7 +43,7 @@ void main(void) {
 
         if (result < 0) {
             _msgout("_fsopen failed");
-            _exit();
+            _exit(0);
         }
 
         _exec(1);
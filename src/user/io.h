@@ -15,6 +15,15 @@
 
 struct io_intf; // forward decl.
 
+// A segment of a scatter/gather list, for vectored reads and writes.
+
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
+
+#define IOV_MAX 16 // maximum number of segments in one vectored call
+
 // I/O operations provided by the interface. Do not call these directly, use the
 // function below instead (e.g. ioread). The /read/ function is allowed to read
 // fewer than /bufsz/ bytes, but must read at least one. A return value of 0
@@ -22,12 +31,34 @@ struct io_intf; // forward decl.
 // allowed to write fewer than /n/ bytes, but must write at least one. A return
 // value of 0 from /write/ indicates an end-of-file condition (for files that
 // cannot grow).
+//
+// The /readv/ and /writev/ functions are optional. They transfer to or from
+// /iovcnt/ segments in order, as if the segments were one buffer, and have the
+// same short-count rules as /read/ and /write/. Interfaces that do not provide
+// them get a loop over /read/ or /write/ (see ioreadv and iowritev).
+//
+// The /readat/ and /writeat/ functions are optional. They are like /read/ and
+// /write/, but transfer at byte offset /pos/ and neither use nor change the
+// current position, so threads and processes sharing the object do not race
+// on it. Objects without a position (e.g. a UART) do not provide them.
+//
+// The /poll/ function is optional. It returns the subset of POLLIN and POLLOUT
+// for which a read or write would not block right now, without waiting. An
+// object whose readiness changes must call iopoll_notify afterwards, so that
+// threads waiting in poll look again. Objects without it are always ready.
 
 struct io_ops {
 	void (*close)(struct io_intf * io);
 	long (*read)(struct io_intf * io, void * buf, unsigned long bufsz);
 	long (*write)(struct io_intf * io, const void * buf, unsigned long n);
 	int (*ctl)(struct io_intf * io, int cmd, void * arg);
+	long (*readv)(struct io_intf * io, const struct iovec * iov, int iovcnt);
+	long (*writev)(struct io_intf * io, const struct iovec * iov, int iovcnt);
+	long (*readat)(struct io_intf * io, uint64_t pos,
+		void * buf, unsigned long bufsz);
+	long (*writeat)(struct io_intf * io, uint64_t pos,
+		const void * buf, unsigned long n);
+	int (*poll)(struct io_intf * io);
 };
 
 struct io_intf {
@@ -69,6 +100,15 @@ struct io_term {
 //   IOCTL_FLUSH - Current not supported (do not need to implement).
 //
 //   IOCTL_GETBLKSZ - Returns the block size. Optional.
+//
+//   IOCTL_SETFL - Sets the O_* flags of the object, e.g. O_NONBLOCK. Handled
+//   by the I/O layer for every object.
+//
+//   IOCTL_SETPOLL - Selects how a block device waits for request completion:
+//   IOCTL_POLL_OFF sleeps until the interrupt, IOCTL_POLL_HYBRID first spins on
+//   the used ring for a short, adaptively chosen time. Optional.
+//
+//   IOCTL_GETPOLLSTAT - Returns completion counters for IOCTL_SETPOLL.
 
 #define IOCTL_GETLEN        1   // arg is pointer to uint64_t
 #define IOCTL_SETLEN        2   // arg is pointer to uint64_t
@@ -76,6 +116,52 @@ struct io_term {
 #define IOCTL_SETPOS        4   // arg is pointer to uint64_t
 #define IOCTL_FLUSH         5   // arg is ignored
 #define IOCTL_GETBLKSZ      6   // arg is pointer to uint32_t
+#define IOCTL_SETFL         7   // arg is pointer to int (O_* flags)
+
+// Device-specific IOCTL numbers (block devices)
+
+#define IOCTL_SETPOLL       8   // arg is pointer to int (IOCTL_POLL_*)
+#define IOCTL_GETPOLLSTAT   9   // arg is pointer to struct io_pollstat
+
+#define IOCTL_POLL_OFF      0   // always sleep until the completion interrupt
+#define IOCTL_POLL_HYBRID   1   // spin for a while, then sleep
+
+// Completion counters reported by IOCTL_GETPOLLSTAT
+
+struct io_pollstat {
+    uint64_t npolled;   // requests found complete while spinning
+    uint64_t nintr;     // requests completed by the interrupt
+    uint64_t spin_us;   // current spin budget in microseconds
+};
+
+// Flags set by IOCTL_SETFL. With O_NONBLOCK, a read or write that would have
+// to wait fails with -EAGAIN instead (or returns a short count, if some data
+// was already transferred).
+
+#define O_NONBLOCK          0x1
+
+// Descriptor flags, read and set with the F_GETFD and F_SETFD commands of the
+// fcntl system call. Unlike O_* flags, they belong to the descriptor, not to
+// the object. Descriptors made by dup and dup2 start without them; fork
+// copies them.
+
+#define F_GETFD             1
+#define F_SETFD             2
+
+#define FD_CLOEXEC          0x1 // close the descriptor on exec
+
+// An entry of the descriptor array passed to the poll system call. The caller
+// sets /fd/ and /events/; poll sets /revents/ to the events that are ready.
+// Entries with a negative /fd/ are ignored.
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+#define POLLIN              0x1 // read would not block
+#define POLLOUT             0x4 // write would not block
 
 // EXPORTED FUNCTION DECLARATIONS
 //
@@ -0,0 +1,38 @@
+// ipc.h - Synchronous message passing (shared with user programs)
+//
+
+#ifndef _IPC_H_
+#define _IPC_H_
+
+#include <stdint.h>
+
+// A server creates a port with _ipc_port and serves it with _ipc_replyrecv,
+// which replies to the previous call (if any) and waits for the next one. A
+// client calls the port with _ipc_call, which delivers its message and waits
+// for the reply. Both calls are synchronous and nothing is buffered: when the
+// server is already waiting, the client switches straight to it, and the
+// server's reply switches straight back. Calls made while no server is
+// waiting are queued in order. _ipc_reply replies without waiting for the
+// next call, e.g. before the server exits.
+//
+// A message is IPC_NWORD words plus, optionally, one page. The page at the
+// sender's page-aligned address /grant/ moves to the receiver: it is replaced
+// by a zeroed page in the sender and mapped at the receiver's page-aligned
+// address /rcvwin/, replacing whatever was mapped there. On return, /grant/
+// holds the address the received page was mapped at, or NULL if no page was
+// received. A page sent to a receiver with a NULL /rcvwin/ is dropped.
+//
+// A port lasts until the process that created it exits. Calls outstanding
+// then fail with -EPIPE, as do calls whose server exits without replying,
+// and servers waiting on the port return -EPIPE.
+
+#define NIPC 16
+#define IPC_NWORD 4
+
+struct ipc_msg {
+    uint64_t word[IPC_NWORD];
+    void * grant; // page to send, or NULL
+    void * rcvwin; // where to map a received page, or NULL
+};
+
+#endif // _IPC_H_
@@ -29,7 +29,7 @@ void main(void) {
     result = _devopen(0, "blk", 0);
     if (result < 0) {
         _msgout("_devopen failed");
-        _exit();
+        _exit(0);
     }
 
     // read the boot block
@@ -0,0 +1,58 @@
+// nullsys.c - Measures the cost of a null system call
+//
+// Times SYSCALL_NOP, which takes the fast system call path, against an
+// unassigned system call number, which the kernel handles on the general
+// exception path with a full trap frame (and fails with -1). The difference
+// is the saving of the fast path.
+//
+
+#include "syscall.h"
+#include "string.h"
+
+#include <stdint.h>
+
+#define NITER 10000
+#define UNASSIGNED_SCNUM 63
+
+static inline uint64_t rdcycle(void) {
+    uint64_t val;
+
+    asm volatile ("rdcycle %0" : "=r" (val));
+    return val;
+}
+
+// System call with an unassigned number. The general path restores every
+// register except a0, so no clobbers beyond a0 and memory.
+
+static inline long slow_nop(void) {
+    register long a0 asm ("a0");
+    register long a7 asm ("a7") = UNASSIGNED_SCNUM;
+
+    asm volatile ("ecall" : "=r" (a0) : "r" (a7) : "memory");
+    return a0;
+}
+
+void main(void) {
+    uint64_t t0, fast, slow;
+    char buf[96];
+    int i;
+
+    t0 = rdcycle();
+    for (i = 0; i < NITER; i++)
+        _nop();
+    fast = (rdcycle() - t0) / NITER;
+
+    t0 = rdcycle();
+    for (i = 0; i < NITER; i++)
+        slow_nop();
+    slow = (rdcycle() - t0) / NITER;
+
+    snprintf(buf, sizeof(buf), "fast path: %lu cycles/call", fast);
+    _msgout(buf);
+    snprintf(buf, sizeof(buf), "full trap frame: %lu cycles/call", slow);
+    _msgout(buf);
+    snprintf(buf, sizeof(buf), "saved: %ld cycles/call", (long)(slow - fast));
+    _msgout(buf);
+
+    _exit(0);
+}
@@ -6,20 +6,52 @@
 
 #define SYSCALL_EXIT    0
 #define SYSCALL_MSGOUT  1
+#define SYSCALL_NOP     2
 
 #define SYSCALL_DEVOPEN 10
 #define SYSCALL_FSOPEN  11
+#define SYSCALL_PIPE    12
+#define SYSCALL_DUP     13
+#define SYSCALL_DUP2    14
+#define SYSCALL_FCNTL   15
 
 #define SYSCALL_CLOSE   20
 #define SYSCALL_READ    21
 #define SYSCALL_WRITE   22
 #define SYSCALL_IOCTL   23
+#define SYSCALL_READV   24
+#define SYSCALL_WRITEV  25
+#define SYSCALL_PREAD   26
+#define SYSCALL_PWRITE  27
+#define SYSCALL_SENDFILE    28
+#define SYSCALL_POLL    29
 
 #define SYSCALL_EXEC    30
 #define SYSCALL_FORK    31
+#define SYSCALL_SPAWN   35
+
+#define SYSCALL_THREAD_CREATE   32
+#define SYSCALL_THREAD_EXIT     33
+#define SYSCALL_THREAD_JOIN     34
 
 #define SYSCALL_USLEEP  40
 #define SYSCALL_WAIT    41
+#define SYSCALL_THRSTAT     42
+#define SYSCALL_SCHEDSTAT   43
+
+#define SYSCALL_FUTEX_WAIT  50
+#define SYSCALL_FUTEX_WAKE  51
+#define SYSCALL_SHM_CREATE  52
+#define SYSCALL_SHM_MAP     53
+#define SYSCALL_SHM_UNMAP   54
+#define SYSCALL_SHM_DESTROY 55
+#define SYSCALL_IPC_PORT    56
+#define SYSCALL_IPC_CALL    57
+#define SYSCALL_IPC_REPLY   58
+#define SYSCALL_IPC_REPLYRECV   59
+
+#define SYSCALL_IORING_SETUP    60
+#define SYSCALL_IORING_ENTER    61
 
 
 #endif // _SCNUM_H_
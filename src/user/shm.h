@@ -0,0 +1,25 @@
+// shm.h - Shared memory segments (shared with user programs)
+//
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+// A shared memory segment is a run of zeroed physical pages, named by a small
+// integer id. Any process that knows the id can map the segment into its user
+// range with _shm_map, and every mapping of it sees the same pages. Mappings
+// stay shared across _fork. _shm_destroy frees the id; the pages themselves
+// live on until the last mapping is removed, with _shm_unmap or when the
+// process exits.
+
+// NSHM is the number of segments that can exist at once and SHM_MAXPAGE the
+// size limit of a segment in pages.
+
+#define NSHM 16
+#define SHM_MAXPAGE 64
+
+// Permissions of a mapping, passed to _shm_map
+
+#define SHM_READ    0x1
+#define SHM_WRITE   0x2
+
+#endif // _SHM_H_
@@ -6,6 +6,15 @@
         .global _start
         .type   _start, @function
 _start:
-        la      ra, _exit
+        la      ra, _exit       # the value returned by main is the exit status
         j       main
+
+# Threads created with _thread_create start here with arg in a0 and the thread
+# function in a1. Returning from the thread function exits the thread.
+
+        .global _thread_start
+        .type   _thread_start, @function
+_thread_start:
+        la      ra, _thread_exit
+        jr      a1
         .end
@@ -0,0 +1,44 @@
+// stats.h - Scheduler statistics (shared with user programs)
+//
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+#define STATS_NAMELEN       16
+#define STATS_LATHIST_NBKT  16
+
+// Thread states as reported in struct thread_stats
+
+#define STATS_THREAD_STOPPED    1
+#define STATS_THREAD_WAITING    2
+#define STATS_THREAD_RUNNING    3
+#define STATS_THREAD_READY      4
+#define STATS_THREAD_EXITED     5
+
+// Per-thread counters. Times are in ticks of the time CSR, whose frequency is
+// given by struct sched_stats.timebase.
+
+struct thread_stats {
+    int tid;
+    int pid;            // -1 for kernel threads
+    int state;          // one of STATS_THREAD_*
+    char name[STATS_NAMELEN];
+    uint64_t run_time;  // time spent running
+    uint64_t ready_time; // time spent waiting in the ready list
+    uint64_t nvolsw;    // switches away while blocking or exiting
+    uint64_t ninvolsw;  // switches away while still runnable
+};
+
+// System-wide scheduler counters. Bucket i of lathist counts wakeups that
+// took [2^i, 2^(i+1)) ticks from being made ready to running (bucket 0 also
+// counts 0 ticks, the last bucket also counts everything longer).
+
+struct sched_stats {
+    uint64_t timebase;  // time CSR frequency in Hz
+    uint64_t now;       // time CSR when the stats were taken
+    uint64_t lathist[STATS_LATHIST_NBKT];
+};
+
+#endif // _STATS_H_
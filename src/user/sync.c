@@ -0,0 +1,88 @@
+// sync.c - User-space mutexes and condition variables
+//
+
+#include "sync.h"
+#include "syscall.h"
+
+#include <limits.h>
+
+// INTERNAL CONSTANTS
+//
+
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+void mutex_init(struct mutex * mtx) {
+    mtx->state = MUTEX_UNLOCKED;
+}
+
+void mutex_lock(struct mutex * mtx) {
+    int c = MUTEX_UNLOCKED;
+
+    // Fast path: unlocked -> locked with a single compare-and-swap
+
+    if (__atomic_compare_exchange_n(&mtx->state, &c, MUTEX_LOCKED,
+        0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    
+    // Slow path: mark the mutex contended so the holder knows to wake us, and
+    // sleep until we are the one that swaps it out of the unlocked state.
+
+    if (c != MUTEX_CONTENDED)
+        c = __atomic_exchange_n(&mtx->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    
+    while (c != MUTEX_UNLOCKED) {
+        _futex_wait(&mtx->state, MUTEX_CONTENDED);
+        c = __atomic_exchange_n(&mtx->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+}
+
+int mutex_trylock(struct mutex * mtx) {
+    int c = MUTEX_UNLOCKED;
+
+    return __atomic_compare_exchange_n(&mtx->state, &c, MUTEX_LOCKED,
+        0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(struct mutex * mtx) {
+    // If the mutex was only locked (no waiters), the decrement releases it and
+    // we are done. Otherwise release it outright and wake one waiter.
+
+    if (__atomic_fetch_sub(&mtx->state, 1, __ATOMIC_RELEASE) != MUTEX_LOCKED) {
+        __atomic_store_n(&mtx->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE);
+        _futex_wake(&mtx->state, 1);
+    }
+}
+
+void condvar_init(struct condvar * cv) {
+    cv->seq = 0;
+}
+
+void condvar_wait(struct condvar * cv, struct mutex * mtx) {
+    int seq;
+
+    seq = __atomic_load_n(&cv->seq, __ATOMIC_RELAXED);
+    mutex_unlock(mtx);
+    _futex_wait(&cv->seq, seq); // returns at once if signalled in between
+
+    // We may be racing other woken waiters for the mutex, so take it in the
+    // contended state to make sure the next unlock wakes the rest.
+
+    while (__atomic_exchange_n(&mtx->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE)
+        != MUTEX_UNLOCKED)
+        _futex_wait(&mtx->state, MUTEX_CONTENDED);
+}
+
+void condvar_signal(struct condvar * cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+    _futex_wake(&cv->seq, 1);
+}
+
+void condvar_broadcast(struct condvar * cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_RELEASE);
+    _futex_wake(&cv->seq, INT_MAX);
+}
@@ -0,0 +1,37 @@
+// sync.h - User-space mutexes and condition variables
+//
+
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+// A mutex is a single word: 0 = unlocked, 1 = locked, 2 = locked with
+// (possible) waiters. Locking and unlocking an uncontended mutex is one atomic
+// instruction and never enters the kernel; only contended operations call
+// _futex_wait or _futex_wake.
+
+struct mutex {
+    volatile int state;
+};
+
+// A condition variable is a sequence number bumped by every signal. Waiters
+// sleep on the sequence number they observed before releasing the mutex, so a
+// signal between the unlock and the futex wait is not lost.
+
+struct condvar {
+    volatile int seq;
+};
+
+#define MUTEX_INITIALIZER { .state = 0 }
+#define CONDVAR_INITIALIZER { .seq = 0 }
+
+extern void mutex_init(struct mutex * mtx);
+extern void mutex_lock(struct mutex * mtx);
+extern int mutex_trylock(struct mutex * mtx); // returns 1 if acquired
+extern void mutex_unlock(struct mutex * mtx);
+
+extern void condvar_init(struct condvar * cv);
+extern void condvar_wait(struct condvar * cv, struct mutex * mtx);
+extern void condvar_signal(struct condvar * cv);
+extern void condvar_broadcast(struct condvar * cv);
+
+#endif // _SYNC_H_
@@ -5,18 +5,55 @@
 #define _SYSCALL_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
-extern void __attribute__ ((noreturn)) _exit(void);
+struct thread_stats; // stats.h
+struct sched_stats; // stats.h
+struct ioring; // ioring.h
+struct iovec; // io.h
+struct pollfd; // io.h
+struct ipc_msg; // ipc.h
+
+extern void __attribute__ ((noreturn)) _exit(int status);
 extern void _msgout(const char * msg);
+extern int _nop(void);
 extern int _close(int fd);
 extern long _read(int fd, void * buf, size_t bufsz);
 extern long _write(int fd, const void * buf, size_t len);
+extern long _readv(int fd, const struct iovec * iov, int iovcnt);
+extern long _writev(int fd, const struct iovec * iov, int iovcnt);
+extern long _pread(int fd, void * buf, size_t bufsz, uint64_t pos);
+extern long _pwrite(int fd, const void * buf, size_t len, uint64_t pos);
+extern long _sendfile(int outfd, int infd, uint64_t * offset, size_t count);
 extern int _ioctl(int fd, const int cmd, void * arg);
+extern int _poll(struct pollfd * fds, int nfds, long timeout_us);
 extern int _devopen(int fd, const char * name, int instno);
 extern int _fsopen(int fd, const char * name);
+extern int _pipe(int * fds);
+extern int _dup(int fd);
+extern int _dup2(int oldfd, int newfd);
+extern int _fcntl(int fd, int cmd, int arg);
 extern int _exec(int fd);
 extern int _fork(void);
-extern int _wait(int tid);
+extern int _spawn(int fd, const int * fdmap, int nfd);
+extern int _thread_create(void (*fn)(void * arg), void * arg);
+extern void __attribute__ ((noreturn)) _thread_exit(void);
+extern int _thread_join(int tid);
+extern int _wait(int tid, int * status);
 extern int _usleep(unsigned long us);
+extern int _thrstat(int tid, struct thread_stats * st);
+extern int _schedstat(struct sched_stats * st);
+extern int _futex_wait(volatile int * uaddr, int val);
+extern int _futex_wake(volatile int * uaddr, int n);
+extern int _ioring_setup(struct ioring * ring);
+extern long _ioring_enter(unsigned int min_complete);
+extern int _shm_create(int npage);
+extern int _shm_map(int id, void * addr, int prot);
+extern int _shm_unmap(void * addr, int npage);
+extern int _shm_destroy(int id);
+extern int _ipc_port(void);
+extern int _ipc_call(int port, struct ipc_msg * msg);
+extern int _ipc_reply(int port, int handle, struct ipc_msg * msg);
+extern int _ipc_replyrecv(int port, int handle, struct ipc_msg * msg);
 
 #endif // _SYSCALL_H_
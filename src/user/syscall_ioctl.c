@@ -14,7 +14,7 @@ void main(void) {
     result = _devopen(0, "ser", 1);
     if (result < 0) {
         _msgout("_devopen failed");
-        _exit();
+        _exit(0);
     }
 
     // get username
@@ -0,0 +1,65 @@
+// test_fdtab.c - Descriptor allocation, dup, dup2 and close-on-exec flags
+//
+// Checks that descriptors are allocated lowest first, that the table grows
+// past its initial 64 entries, that dup2 replaces the target descriptor, and
+// that F_SETFD flags belong to one descriptor only.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "io.h"
+
+#define FILENAME "test_lock_file.txt"
+#define NDUP 100
+
+static int nbad = 0;
+
+static void check(int cond, const char * what) {
+    if (!cond) {
+        _msgout(what);
+        nbad += 1;
+    }
+}
+
+void main(void) {
+    uint64_t len0, len;
+    int fd, i;
+
+    fd = _fsopen(-1, FILENAME);
+    check(fd == 0, "first descriptor is not 0");
+
+    // dup fills the lowest free descriptors, past the initial table size
+
+    for (i = 1; i <= NDUP; i++)
+        check(_dup(0) == i, "dup did not return the lowest descriptor");
+
+    _close(10);
+    check(_dup(0) == 10, "freed descriptor was not reused");
+
+    // all descriptors share the object
+
+    _ioctl(0, IOCTL_GETLEN, &len0);
+    _ioctl(NDUP, IOCTL_GETLEN, &len);
+    check(len == len0, "dup refers to another object");
+
+    // dup2 onto an open descriptor replaces it
+
+    check(_dup2(NDUP, 5) == 5, "dup2 failed");
+    check(_dup2(5, 5) == 5, "dup2 onto itself failed");
+
+    // the close-on-exec flag is per descriptor
+
+    check(_fcntl(3, F_SETFD, FD_CLOEXEC) == 0, "F_SETFD failed");
+    check(_fcntl(3, F_GETFD, 0) == FD_CLOEXEC, "flag not set");
+    check(_fcntl(4, F_GETFD, 0) == 0, "flag leaked to another descriptor");
+    check(_dup2(3, 6) == 6 && _fcntl(6, F_GETFD, 0) == 0,
+        "dup2 copied the flag");
+
+    for (i = NDUP; i >= 0; i--)
+        _close(i);
+
+    check(_fcntl(0, F_GETFD, 0) < 0, "closed descriptor still open");
+
+    _msgout(nbad ? "FAIL" : "PASS");
+    _exit(0);
+}
@@ -0,0 +1,60 @@
+// test_ioring.c - Submits a batch of file operations through an ioring
+//
+// Opens a file, reads two chunks of it and closes it with a single
+// _ioring_enter, then prints each completion.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "scnum.h"
+#include "ioring.h"
+
+#include <stdint.h>
+
+#define CHUNK 64
+
+static struct ioring ring;
+static char buf[2][CHUNK+1];
+
+static void prep(int op, int fd, uint64_t arg0, uint64_t arg1) {
+    struct ioring_sqe * const sqe = &ring.sq[ring.sq_tail % IORING_NENT];
+
+    sqe->op = op;
+    sqe->fd = fd;
+    sqe->arg[0] = arg0;
+    sqe->arg[1] = arg1;
+    sqe->user_data = ring.sq_tail;
+    __atomic_store_n(&ring.sq_tail, ring.sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+void main(void) {
+    const struct ioring_cqe * cqe;
+    char msg[96];
+    long nsub;
+
+    if (_ioring_setup(&ring) < 0) {
+        _msgout("_ioring_setup failed");
+        _exit(0);
+    }
+
+    prep(SYSCALL_FSOPEN, 0, (uintptr_t)"test_lock_file.txt", 0);
+    prep(SYSCALL_READ, 0, (uintptr_t)buf[0], CHUNK);
+    prep(SYSCALL_READ, 0, (uintptr_t)buf[1], CHUNK);
+    prep(SYSCALL_CLOSE, 0, 0, 0);
+
+    nsub = _ioring_enter(4);
+    snprintf(msg, sizeof(msg), "submitted %ld entries", nsub);
+    _msgout(msg);
+
+    while (ring.cq_head != __atomic_load_n(&ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring.cq[ring.cq_head % IORING_NENT];
+        snprintf(msg, sizeof(msg), "entry %lu: %ld",
+            (unsigned long)cqe->user_data, (long)cqe->res);
+        _msgout(msg);
+        ring.cq_head += 1;
+    }
+
+    _msgout(buf[0]);
+    _msgout(buf[1]);
+    _exit(0);
+}
@@ -0,0 +1,115 @@
+// test_ipc.c - Round trips through a synchronous IPC port
+//
+// The parent creates a port and forks a server that answers each call with
+// the first message word plus one. The parent times NITER calls, then grants
+// the server a page of a known pattern, which the server sums, and finally
+// tells the server to exit.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "ipc.h"
+
+#include <stdint.h>
+
+#define PAGE_SIZE 4096
+#define NITER 10000
+#define STOP (~0UL)
+
+#define SRV_WIN ((void *)0xC8000000UL)
+
+static char page[PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+static inline uint64_t rdcycle(void) {
+    uint64_t val;
+
+    asm volatile ("rdcycle %0" : "=r" (val));
+    return val;
+}
+
+static void server(int port) {
+    struct ipc_msg msg;
+    uint64_t sum;
+    int handle = -1;
+    int i;
+
+    memset(&msg, 0, sizeof(msg));
+
+    for (;;) {
+        msg.rcvwin = SRV_WIN;
+        handle = _ipc_replyrecv(port, handle, &msg);
+        if (handle < 0) {
+            _msgout("_ipc_replyrecv failed");
+            _exit(0);
+        }
+
+        if (msg.word[0] == STOP) {
+            _ipc_reply(port, handle, &msg);
+            _exit(0);
+        }
+
+        if (msg.grant != NULL) {
+            sum = 0;
+            for (i = 0; i < PAGE_SIZE; i++)
+                sum += ((unsigned char *)msg.grant)[i];
+            msg.word[1] = sum;
+            msg.grant = NULL;
+        }
+
+        msg.word[0] += 1;
+    }
+}
+
+void main(void) {
+    struct ipc_msg msg;
+    uint64_t t0, cycles;
+    uint64_t sum = 0;
+    int nbad = 0;
+    char buf[80];
+    int port;
+    long i;
+
+    port = _ipc_port();
+    if (port < 0) {
+        _msgout("_ipc_port failed");
+        _exit(0);
+    }
+
+    if (_fork() == 0)
+        server(port);
+
+    memset(&msg, 0, sizeof(msg));
+    t0 = rdcycle();
+
+    for (i = 0; i < NITER; i++) {
+        msg.word[0] = i;
+        if (_ipc_call(port, &msg) != 0 || msg.word[0] != i + 1)
+            nbad += 1;
+    }
+
+    cycles = (rdcycle() - t0) / NITER;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        page[i] = (char)i;
+        sum += (unsigned char)i;
+    }
+
+    msg.word[0] = 0;
+    msg.grant = page;
+    if (_ipc_call(port, &msg) != 0 || msg.word[1] != sum || page[1] != 0)
+        nbad += 1;
+
+    msg.word[0] = STOP;
+    msg.grant = NULL;
+    _ipc_call(port, &msg);
+
+    if (nbad != 0) {
+        snprintf(buf, sizeof(buf), "FAIL: %d bad calls", nbad);
+        _msgout(buf);
+    } else {
+        snprintf(buf, sizeof(buf), "PASS: %lu cycles per round trip", cycles);
+        _msgout(buf);
+    }
+
+    _exit(0);
+}
@@ -14,14 +14,14 @@ void main(void) {
     result = _fsopen(0, "test_lock_file.txt");
     if (result < 0) {
         _msgout("_fsopen failed");
-        _exit();
+        _exit(0);
     }
 
     // // Open ser device as fd=0
     // result = _devopen(0, "ser", 1);
     // if (result < 0) {
     //     _msgout("_devopen failed");
-    //     _exit();
+    //     _exit(0);
     // }
 
     _msgout("ready to enter fork");
@@ -46,7 +46,7 @@ void main(void) {
 
         // wait for child to exit
         _msgout("parent waiting");
-        _wait(1);
+        _wait(1, NULL);
 
         // print to console, close the file, exit
         size = 0;
@@ -59,7 +59,7 @@ void main(void) {
 
         _close(0);
         _msgout("parent close file");
-        _exit();
+        _exit(0);
     } else {
         _msgout("enter child");
         // exec child program
@@ -83,6 +83,6 @@ void main(void) {
         // close open file and exit
         _close(0);
         _msgout("child close file");
-        _exit();
+        _exit(0);
     }
 }
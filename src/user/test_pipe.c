@@ -0,0 +1,87 @@
+// test_pipe.c - Streams data through a pipe between two processes
+//
+// The child writes NPAGE pages of a known pattern from a page-aligned buffer,
+// which the parent reads into a page-aligned buffer, so the pages are handed
+// over rather than copied a second time. The parent checks the data, the end
+// of file after the child closes its end, and reports the throughput.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "error.h"
+
+#include <stdint.h>
+
+#define PAGE_SIZE 4096
+#define NPAGE 256
+#define CHUNK (4 * PAGE_SIZE)
+
+static char buf[CHUNK] __attribute__ ((aligned (PAGE_SIZE)));
+
+static inline uint64_t rdcycle(void) {
+    uint64_t val;
+
+    asm volatile ("rdcycle %0" : "=r" (val));
+    return val;
+}
+
+static void writer(int fd) {
+    long i, k;
+
+    for (i = 0; i < NPAGE * PAGE_SIZE; i += CHUNK) {
+        for (k = 0; k < CHUNK; k++)
+            buf[k] = (char)((i + k) / PAGE_SIZE);
+        if (_write(fd, buf, CHUNK) != CHUNK) {
+            _msgout("_write failed");
+            break;
+        }
+    }
+
+    _close(fd);
+    _exit(0);
+}
+
+void main(void) {
+    uint64_t t0, cycles;
+    long total = 0;
+    long cnt, k;
+    int nbad = 0;
+    char msg[80];
+    int fds[2];
+
+    if (_pipe(fds) < 0) {
+        _msgout("_pipe failed");
+        _exit(0);
+    }
+
+    if (_fork() == 0) {
+        _close(fds[0]);
+        writer(fds[1]);
+    }
+
+    _close(fds[1]);
+    t0 = rdcycle();
+
+    while ((cnt = _read(fds[0], buf, CHUNK)) > 0) {
+        for (k = 0; k < cnt; k++) {
+            if (buf[k] != (char)((total + k) / PAGE_SIZE))
+                nbad += 1;
+        }
+        total += cnt;
+    }
+
+    cycles = rdcycle() - t0;
+
+    if (cnt < 0 || total != NPAGE * PAGE_SIZE || nbad != 0) {
+        snprintf(msg, sizeof(msg), "FAIL: %ld bytes, %d bad, last read %ld",
+            total, nbad, cnt);
+        _msgout(msg);
+    } else {
+        snprintf(msg, sizeof(msg), "PASS: %ld bytes in %lu cycles",
+            total, cycles);
+        _msgout(msg);
+    }
+
+    _close(fds[0]);
+    _exit(0);
+}
@@ -0,0 +1,48 @@
+// test_poll.c - One thread serving two serial ports
+//
+// Opens ser1 and ser2 in non-blocking mode and echoes whatever arrives on
+// either port back to the same port, waiting in _poll instead of blocking in
+// _read. Gives up after ten seconds without input.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "io.h"
+
+#define NPORT 2
+#define TIMEOUT_US 10000000L
+
+void main(void) {
+    struct pollfd fds[NPORT];
+    int flags = O_NONBLOCK;
+    char buf[64];
+    long cnt;
+    int i;
+
+    for (i = 0; i < NPORT; i++) {
+        if (_devopen(i, "ser", i+1) < 0) {
+            _msgout("_devopen failed");
+            _exit(0);
+        }
+
+        _ioctl(i, IOCTL_SETFL, &flags);
+        fds[i].fd = i;
+        fds[i].events = POLLIN;
+    }
+
+    while (_poll(fds, NPORT, TIMEOUT_US) > 0) {
+        for (i = 0; i < NPORT; i++) {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+
+            // the port was ready, so this read does not wait; a second read
+            // would fail with -EAGAIN once the port is drained
+            cnt = _read(fds[i].fd, buf, sizeof(buf));
+            if (cnt > 0)
+                _write(fds[i].fd, buf, cnt);
+        }
+    }
+
+    _msgout("no input for ten seconds");
+    _exit(0);
+}
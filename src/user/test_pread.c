@@ -0,0 +1,112 @@
+// test_pread.c - Positional reads do not disturb the file position
+//
+// Reads the file sequentially, then reads pieces of it back with _pread at
+// scattered offsets, and checks that the contents match and that the shared
+// position is still at the end of the sequential read. Then sends the file
+// into a non-blocking pipe with room for only half of it, and checks that
+// _sendfile reports the short write and leaves the position after the bytes
+// that went out.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "io.h"
+
+#include <stdint.h>
+
+#define FILENAME "test_lock_file.txt"
+#define MAXLEN 1024
+#define PIECE 16
+#define PAGE_SIZE 4096
+
+static char whole[MAXLEN];
+static char fill[PAGE_SIZE + 1];
+static char page[PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+// Sends the file into a pipe with room for /room/ bytes and returns the
+// count _sendfile reports. The file position is left for the caller to check.
+
+static long short_sendfile(uint64_t len, long room) {
+    int fds[2];
+    int fl = O_NONBLOCK;
+    uint64_t pos = 0;
+    long cnt, acc;
+
+    if (_pipe(fds) < 0) {
+        _msgout("_pipe failed");
+        _exit(0);
+    }
+
+    // Fill the pipe from an unaligned buffer so the pages are packed, free
+    // its first page, then leave exactly /room/ bytes
+
+    _ioctl(fds[1], IOCTL_SETFL, &fl);
+    while (_write(fds[1], fill + 1, PAGE_SIZE) > 0)
+        continue;
+    for (acc = 0; acc < PAGE_SIZE; acc += cnt) {
+        cnt = _read(fds[0], page, PAGE_SIZE - acc);
+        if (cnt <= 0)
+            break;
+    }
+    _write(fds[1], fill + 1, PAGE_SIZE - room);
+
+    _ioctl(0, IOCTL_SETPOS, &pos);
+    cnt = _sendfile(fds[1], 0, NULL, len);
+
+    _close(fds[0]);
+    _close(fds[1]);
+    return cnt;
+}
+
+void main(void) {
+    uint64_t len, pos;
+    char piece[PIECE];
+    char msg[80];
+    long cnt, i;
+    int nbad = 0;
+
+    if (_fsopen(0, FILENAME) < 0) {
+        _msgout("_fsopen failed");
+        _exit(0);
+    }
+
+    len = 0; // files only fill in the low 32 bits
+    _ioctl(0, IOCTL_GETLEN, &len);
+    if (len > MAXLEN)
+        len = MAXLEN;
+
+    cnt = _read(0, whole, len);
+    if (cnt != len) {
+        _msgout("_read failed");
+        _exit(0);
+    }
+
+    // Walk the file backwards in PIECE-sized steps
+
+    for (pos = (len - 1) / PIECE * PIECE; ; pos -= PIECE) {
+        cnt = _pread(0, piece, PIECE, pos);
+        if (cnt < 0 || (cnt < PIECE && pos + cnt != len))
+            nbad += 1;
+        for (i = 0; i < cnt; i++)
+            if (piece[i] != whole[pos+i])
+                nbad += 1;
+        if (pos == 0)
+            break;
+    }
+
+    pos = 0;
+    _ioctl(0, IOCTL_GETPOS, &pos);
+    snprintf(msg, sizeof(msg), "pread: %d mismatches, position %lu (expected %lu)",
+        nbad, (unsigned long)pos, (unsigned long)len);
+    _msgout(msg);
+
+    cnt = short_sendfile(len, len / 2);
+    pos = 0;
+    _ioctl(0, IOCTL_GETPOS, &pos);
+    snprintf(msg, sizeof(msg), "sendfile: sent %ld, position %lu (expected %lu)",
+        cnt, (unsigned long)pos, (unsigned long)(len / 2));
+    _msgout(msg);
+
+    _close(0);
+    _exit(0);
+}
@@ -0,0 +1,46 @@
+// test_reap.c - Restarts short-lived workers many times over
+//
+// Forks NROUND workers one after another, far more than there are process
+// and thread slots, each exiting at once with a status derived from its round
+// number. Every worker is collected with _wait, which must report its status.
+// With processes fully recycled, the loop runs in constant memory.
+//
+
+#include "syscall.h"
+#include "string.h"
+
+#define NROUND 2000
+
+void main(void) {
+    int status;
+    int nbad = 0;
+    char msg[80];
+    int tid;
+    int i;
+
+    for (i = 0; i < NROUND; i++) {
+        tid = _fork();
+
+        if (tid == 0)
+            _exit(i % 128);
+
+        if (tid < 0) {
+            snprintf(msg, sizeof(msg), "FAIL: _fork returned %d in round %d",
+                tid, i);
+            _msgout(msg);
+            _exit(1);
+        }
+
+        if (_wait(tid, &status) != tid || status != i % 128)
+            nbad += 1;
+    }
+
+    if (nbad != 0) {
+        snprintf(msg, sizeof(msg), "FAIL: %d bad exit statuses", nbad);
+        _msgout(msg);
+        _exit(1);
+    }
+
+    _msgout("PASS");
+    _exit(0);
+}
@@ -14,7 +14,7 @@ void main(void) {
     result = _fsopen(0, "test_lock_file.txt");
     if (result < 0) {
         _msgout("_fsopen failed");
-        _exit();
+        _exit(0);
     }
 
     if (_fork()) {
@@ -25,9 +25,9 @@ void main(void) {
         _msgout("parent close file");
 
         _msgout("parent waiting");
-        _wait(1);
+        _wait(1, NULL);
 
-        _exit();
+        _exit(0);
     } else {
         // exec child program
         _ioctl(0, IOCTL_GETLEN, &size);
@@ -58,6 +58,6 @@ void main(void) {
         _close(0);
         _msgout("child close file");
 
-        _exit();
+        _exit(0);
     }
 }
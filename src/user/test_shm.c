@@ -0,0 +1,85 @@
+// test_shm.c - Shares a memory segment between two processes
+//
+// The parent creates a segment, maps it twice at different addresses and
+// forks. The child fills the segment through one mapping and raises a flag;
+// the parent waits for the flag and checks the data through the other
+// mapping. The segment is then destroyed, which must leave the mappings
+// usable, and unmapped.
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "error.h"
+#include "shm.h"
+
+#include <stdint.h>
+
+#define PAGE_SIZE 4096
+#define NPAGE 2
+
+#define MAP1 ((char *)0xC8000000UL)
+#define MAP2 ((char *)0xC8100000UL)
+
+#define NWORD (NPAGE * PAGE_SIZE / sizeof(long) - 1)
+
+void main(void) {
+    volatile long * const flag = (volatile long *)MAP1;
+    long * const data1 = (long *)MAP1 + 1;
+    long * const data2 = (long *)MAP2 + 1;
+    int nbad = 0;
+    char msg[80];
+    long i;
+    int id;
+
+    id = _shm_create(NPAGE);
+    if (id < 0) {
+        _msgout("_shm_create failed");
+        _exit(0);
+    }
+
+    if (_shm_map(id, MAP1, SHM_READ | SHM_WRITE) != 0
+        || _shm_map(id, MAP2, SHM_READ) != 0)
+    {
+        _msgout("_shm_map failed");
+        _exit(0);
+    }
+
+    if (_shm_map(id, MAP1, SHM_READ) != -EBUSY)
+        _msgout("FAIL: mapped twice at the same address");
+
+    if (_fork() == 0) {
+        for (i = 0; i < NWORD; i++)
+            data1[i] = i * 3;
+        *flag = 1;
+        _exit(0);
+    }
+
+    while (*flag == 0)
+        _usleep(1000);
+
+    for (i = 0; i < NWORD; i++) {
+        if (data2[i] != i * 3)
+            nbad += 1;
+    }
+
+    if (_shm_destroy(id) != 0)
+        _msgout("FAIL: _shm_destroy");
+
+    if (data1[NWORD - 1] != (NWORD - 1) * 3)
+        nbad += 1;
+
+    if (_shm_unmap(MAP1, NPAGE) != 0 || _shm_unmap(MAP2, NPAGE) != 0)
+        _msgout("FAIL: _shm_unmap");
+
+    if (_shm_unmap(MAP1, NPAGE) != -EINVAL)
+        _msgout("FAIL: unmapped twice");
+
+    if (nbad != 0) {
+        snprintf(msg, sizeof(msg), "FAIL: %d bad words", nbad);
+        _msgout(msg);
+    } else {
+        _msgout("PASS");
+    }
+
+    _exit(0);
+}
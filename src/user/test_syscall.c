@@ -17,7 +17,7 @@ void main(void) {
     result = _devopen(0, "ser", 1);
     if (result < 0) {
         _msgout("_devopen failed");
-        _exit();
+        _exit(0);
     }
     _msgout("devopen passed");
 
@@ -25,7 +25,7 @@ void main(void) {
     result = _fsopen(1, "trek");
     if (result < 0) {
         _msgout("_fsopen failed");
-        _exit();
+        _exit(0);
     }
     _msgout("fsopen passed");
 
@@ -33,7 +33,7 @@ void main(void) {
     result = _ioctl(1, IOCTL_GETLEN, &slen);
     if (result < 0) {
         _msgout("_ioctl failed");
-        _exit();
+        _exit(0);
     }
     _msgout("ioctl passed");
 
@@ -42,7 +42,7 @@ void main(void) {
     result = _close(1);
     if (result < 0) {
         _msgout("_close failed");
-        _exit();
+        _exit(0);
     }
     _msgout("close passed");
 
@@ -50,7 +50,7 @@ void main(void) {
     result = _read(0, c, 1);
     if (result < 0) {
         _msgout("_read failed");
-        _exit();
+        _exit(0);
     }
     _msgout("read passed");
 
@@ -59,12 +59,12 @@ void main(void) {
     result = _write(0, "write passed\n\r", slen);
     if (result < 0) {
         _msgout("_write failed");
-        _exit();
+        _exit(0);
     }
     _msgout("write passed");
 
     //test exit
     _read(0, c, 1);
-    _exit();
+    _exit(0);
     _msgout("exit failed");
 }
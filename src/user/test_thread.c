@@ -0,0 +1,61 @@
+#include "syscall.h"
+#include "string.h"
+#include "sync.h"
+
+#define NWORKERS 4
+#define NITERS 1000
+
+static struct mutex count_lock = MUTEX_INITIALIZER;
+static struct condvar count_done = CONDVAR_INITIALIZER;
+static int count;
+static int finished;
+
+static void worker(void * arg) {
+    int i;
+
+    for (i = 0; i < NITERS; i++) {
+        mutex_lock(&count_lock);
+        count++;
+        mutex_unlock(&count_lock);
+    }
+
+    mutex_lock(&count_lock);
+    finished++;
+    condvar_broadcast(&count_done);
+    mutex_unlock(&count_lock);
+}
+
+void main(void) {
+    int tids[NWORKERS];
+    char buf[64];
+    int i;
+
+    for (i = 0; i < NWORKERS; i++) {
+        tids[i] = _thread_create(worker, NULL);
+        if (tids[i] < 0) {
+            _msgout("_thread_create failed");
+            _exit(0);
+        }
+    }
+
+    // Wait on the condition variable first, then join everyone
+
+    mutex_lock(&count_lock);
+    while (finished < NWORKERS)
+        condvar_wait(&count_done, &count_lock);
+    mutex_unlock(&count_lock);
+
+    for (i = 0; i < NWORKERS; i++)
+        _thread_join(tids[i]);
+
+    snprintf(buf, sizeof(buf), "count = %d (expected %d)",
+        count, NWORKERS * NITERS);
+    _msgout(buf);
+
+    if (count == NWORKERS * NITERS)
+        _msgout("test_thread passed");
+    else
+        _msgout("test_thread FAILED");
+    
+    _exit(0);
+}
@@ -0,0 +1,99 @@
+// top.c - Periodically prints per-thread CPU usage and scheduler latency
+//
+
+#include "syscall.h"
+#include "string.h"
+#include "stats.h"
+#include "error.h"
+
+#define MAXTHR 64       // upper bound on thread ids we ask about
+#define NSAMPLES 10     // number of refreshes before exiting
+#define INTERVAL_US 1000000
+
+static const char * const state_names[] = {
+    [0] = "?",
+    [STATS_THREAD_STOPPED] = "STOP",
+    [STATS_THREAD_WAITING] = "WAIT",
+    [STATS_THREAD_RUNNING] = "RUN",
+    [STATS_THREAD_READY] = "READY",
+    [STATS_THREAD_EXITED] = "EXIT"
+};
+
+static uint64_t prev_run[MAXTHR];
+static uint64_t prev_now;
+
+static void print_threads(const struct sched_stats * ss) {
+    struct thread_stats ts;
+    uint64_t interval;
+    uint64_t pct;
+    char buf[128];
+    int tid;
+
+    interval = ss->now - prev_now;
+    if (interval == 0)
+        interval = 1;
+
+    _msgout("  TID  PID STATE  %CPU  RUN(ms) READY(ms)   VOLSW INVOLSW NAME");
+
+    for (tid = 0; tid < MAXTHR; tid++) {
+        int result = _thrstat(tid, &ts);
+        if (result == -EINVAL)
+            break;
+        if (result < 0) {
+            prev_run[tid] = 0;
+            continue;
+        }
+
+        pct = 100 * (ts.run_time - prev_run[tid]) / interval;
+        prev_run[tid] = ts.run_time;
+
+        snprintf(buf, sizeof(buf),
+            "%5d %4d %5s %4lu %8lu %9lu %7lu %7lu %s",
+            ts.tid, ts.pid, state_names[ts.state], pct,
+            ts.run_time / (ss->timebase / 1000),
+            ts.ready_time / (ss->timebase / 1000),
+            ts.nvolsw, ts.ninvolsw, ts.name);
+        _msgout(buf);
+    }
+
+    prev_now = ss->now;
+}
+
+static void print_latency(const struct sched_stats * ss) {
+    uint64_t lo, hi;
+    char buf[96];
+    int i;
+
+    _msgout("wakeup-to-run latency (us): count");
+
+    for (i = 0; i < STATS_LATHIST_NBKT; i++) {
+        if (ss->lathist[i] == 0)
+            continue;
+        
+        lo = (i == 0) ? 0 : (1UL << i);
+        hi = 1UL << (i+1);
+        snprintf(buf, sizeof(buf), "  [%lu, %lu%s: %lu",
+            lo * 1000000 / ss->timebase, hi * 1000000 / ss->timebase,
+            (i == STATS_LATHIST_NBKT-1) ? "+)" : ")",
+            ss->lathist[i]);
+        _msgout(buf);
+    }
+}
+
+void main(void) {
+    struct sched_stats ss;
+    int n;
+
+    for (n = 0; n < NSAMPLES; n++) {
+        if (_schedstat(&ss) < 0) {
+            _msgout("_schedstat failed");
+            _exit(0);
+        }
+
+        print_threads(&ss);
+        print_latency(&ss);
+        _usleep(INTERVAL_US);
+    }
+
+    _exit(0);
+}
@@ -0,0 +1,91 @@
+// vdata.h - Kernel-maintained data page (shared with user programs)
+//
+
+#ifndef _VDATA_H_
+#define _VDATA_H_
+
+#include <stdint.h>
+
+// Every process has a read-only page at VDATA_VMA, just above the user stack,
+// that the kernel keeps up to date. User programs read it instead of making a
+// system call for the time base or their own pid and tid.
+
+#define VDATA_VMA 0xD0000000UL
+
+// The kernel increments gen before and after every update, so gen is odd while
+// an update is in progress. A reader that sees the same even gen before and
+// after reading the other fields has a consistent snapshot.
+
+struct vdata {
+    volatile uint32_t gen;
+    int32_t pid;
+    int32_t tid;        // thread currently running in this process
+    uint32_t reserved;
+    uint64_t timebase;  // frequency of the time CSR in Hz
+    uint64_t boot_offset; // wall-clock time at time CSR zero, ns since 1970
+};
+
+// The helpers below read the page without entering the kernel. Times come from
+// the time CSR, which start.s lets U mode read.
+
+static inline const struct vdata * vdata_page(void) {
+    return (const struct vdata *)VDATA_VMA;
+}
+
+static inline uint64_t vdata_rdtime(void) {
+    uint64_t val;
+
+    asm volatile ("rdtime %0" : "=r" (val));
+    return val;
+}
+
+// Copies a consistent snapshot of the page into /vd/.
+
+static inline void vdata_read(struct vdata * vd) {
+    const struct vdata * const pg = vdata_page();
+    uint32_t gen;
+
+    do {
+        gen = __atomic_load_n(&pg->gen, __ATOMIC_ACQUIRE);
+        vd->pid = pg->pid;
+        vd->tid = pg->tid;
+        vd->timebase = pg->timebase;
+        vd->boot_offset = pg->boot_offset;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((gen & 1) != 0 || gen != pg->gen);
+
+    vd->gen = gen;
+}
+
+// The pid only changes across exec, and the tid field always names the thread
+// that is running, i.e. the caller, so neither needs the gen check.
+
+static inline int vdata_getpid(void) {
+    return vdata_page()->pid;
+}
+
+static inline int vdata_gettid(void) {
+    return vdata_page()->tid;
+}
+
+// Converts a time CSR value to nanoseconds, without overflowing the product.
+
+static inline uint64_t vdata_ticks_to_ns(uint64_t ticks) {
+    const uint64_t tb = vdata_page()->timebase;
+
+    return (ticks / tb) * 1000000000UL + (ticks % tb) * 1000000000UL / tb;
+}
+
+// Time since boot in microseconds.
+
+static inline uint64_t vdata_uptime_us(void) {
+    return vdata_ticks_to_ns(vdata_rdtime()) / 1000;
+}
+
+// Wall-clock time in nanoseconds since 1970.
+
+static inline uint64_t vdata_walltime_ns(void) {
+    return vdata_page()->boot_offset + vdata_ticks_to_ns(vdata_rdtime());
+}
+
+#endif // _VDATA_H_